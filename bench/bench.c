@@ -0,0 +1,424 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define RAS_DEFAULT_SUFFIX X
+#include "ras/ras.h"
+#include "ras/ras_a64.h"
+
+// every benchmark prints one line of
+//   name,ops,seconds,ops_per_sec,unit
+// so results can be diffed or compared by a script. only the exec benchmark
+// runs generated code, the rest only encode and work on any host
+
+static double minTime = 0.2;
+static int noExec = 0;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static volatile size_t sink;
+
+static rasBlock* new_block(size_t size) {
+    if (noExec) return rasCreateNoExec(NULL, size, 0x400000);
+    return rasCreate(size);
+}
+
+// emits about n instructions into ctx, pseudo instructions can emit more
+typedef void (*emitFn)(rasBlock* ctx, size_t n);
+
+static const uint64_t constants[16] = {
+    0,          1,          0xfff,          0x1000,
+    0xffff,     0x12340000, 0xffffffff,     0xff00ff00ff00ff00,
+    0x12345678, -1,         -0x1234,        0x0000ffff0000ffff,
+    0x123456789abcdef0,     0x8000000000000000,
+    0xaaaaaaaaaaaaaaaa,     0xfedcba9876543210,
+};
+
+static void bench_alu_imm(rasBlock* ctx, size_t n) {
+    for (size_t i = 0; i < n; i += 4) {
+        uint64_t c = constants[i / 4 & 15];
+        MOV(R(i & 7), c);
+        ADD(R0, R1, c & 0xffffff, R16);
+        AND(R2, R3, constants[(i / 4 + 7) & 15], R16);
+        EOR(R4, R5, R6, LSL(i & 31));
+    }
+}
+
+// a stub with only constant operands, which the compiler can encode
+static void bench_const(rasBlock* ctx, size_t n) {
+    for (size_t i = 0; i < n; i += 8) {
+        STP(FP, LR, (SP, -32, PRE));
+        ADD(FP, SP, 0);
+        MOV(R0, 0x1234);
+        MOVW(R1, -2);
+        ADD(R2, R2, 0x10000, R16);
+        CMP(R0, -5, R16);
+        LDP(FP, LR, (SP, 32, POST));
+        RET();
+    }
+}
+
+static void bench_ldst(rasBlock* ctx, size_t n) {
+    for (size_t i = 0; i < n; i += 4) {
+        LDR(R0, (R1, (i & 63) * 8));
+        STRW(R2, (SP, -16, PRE));
+        LDRW(R3, (R4, R5, UXTW(2)));
+        LDP(R6, R7, (R8, 16));
+    }
+}
+
+static void bench_branch_fwd(rasBlock* ctx, size_t n) {
+    for (size_t i = 0; i < n; i += 8) {
+        LABEL(l1);
+        LABEL(l2);
+        CBZ(R0, l1);
+        ADD(R0, R0, 1);
+        BNE(l2);
+        SUB(R1, R1, 1);
+        L(l1);
+        TBNZ(R2, 3, l2);
+        B(l2);
+        NOP();
+        L(l2);
+        NOP();
+    }
+}
+
+static void bench_simd(rasBlock* ctx, size_t n) {
+    for (size_t i = 0; i < n; i += 4) {
+        ADD4S(V(i & 31), V1, V2);
+        MUL8H(V3, V4, V5);
+        FADDS(V6, V7, V8);
+        FMADDD(V9, V10, V11, V12);
+    }
+}
+
+// every instruction references a label so this is dominated by label and
+// patch bookkeeping
+static void bench_labels(rasBlock* ctx, size_t n) {
+    LABEL(ext, (void*) &sink);
+    for (size_t i = 0; i < n; i += 4) {
+        LABEL(l);
+        L(l);
+        B(l);
+        ADR(R0, l);
+        ADRP(R1, ext);
+        LDRL(R2, l);
+    }
+}
+
+// an inline cache guard with operands that change for every copy: checks
+// the type of the object in rn against a pointer in a literal and loads a
+// field or goes to lmiss. with holes the operands are marked as template
+// arguments instead
+static void emit_guard(rasBlock* ctx, int rn, uint64_t type, uint32_t field,
+                       rasLabel lmiss, int holes) {
+    LABEL(ltype);
+    LABEL(lhit);
+    LDR(R16, (R(rn), 0));
+    if (holes) HOLE(RN, 0);
+    LDRL(R17, ltype);
+    CMP(R16, R17);
+    BNE(lmiss);
+    LDR(R(rn), (R(rn), field * 8));
+    if (holes) {
+        HOLE(RD, 0);
+        HOLE(RN, 0);
+        HOLE(IMM12, 2);
+    }
+    B(lhit);
+    L(ltype);
+    DWORD(type);
+    if (holes) HOLE(DATA64, 1);
+    L(lhit);
+}
+
+static void bench_guard(rasBlock* ctx, size_t n) {
+    LABEL(lmiss);
+    for (size_t i = 0; i < n; i += 8) {
+        emit_guard(ctx, i & 15, 0x10000 + i * 64, i & 255, lmiss, 0);
+    }
+    L(lmiss);
+}
+
+// the same guard copied from a template
+static void bench_guard_template(rasBlock* ctx, size_t n) {
+    static rasTemplate* guard;
+    if (!guard) {
+        rasBlock* scratch = rasCreateNoExec(NULL, 4096, 0x400000);
+        rasBeginTemplate(scratch);
+        rasLabel lmiss = rasDeclareLabel(scratch);
+        rasTemplateLabel(scratch, lmiss, 0);
+        emit_guard(scratch, 0, 0, 0, lmiss, 1);
+        guard = rasEndTemplate(scratch);
+        rasDestroy(scratch);
+    }
+    LABEL(lmiss);
+    for (size_t i = 0; i < n; i += 8) {
+        uint64_t args[] = {i & 15, 0x10000 + i * 64, i & 255};
+        TEMPLATE(guard, args, &lmiss);
+    }
+    L(lmiss);
+}
+
+static double run_emit(const char* name, emitFn fn, size_t n) {
+    size_t ops = 0;
+    double total = 0;
+    while (total < minTime) {
+        rasBlock* ctx = new_block(n * 16 + 4096);
+        double t = now();
+        fn(ctx, n);
+        total += now() - t;
+        ops += rasGetSize(ctx) / 4;
+        rasDestroy(ctx);
+    }
+    printf("%s,%zu,%.6f,%.0f,inst/s\n", name, ops, total, ops / total);
+    return ops / total;
+}
+
+// cost of applying patches and changing protection, per byte of code
+static void run_ready(size_t ninsts) {
+    size_t bytes = 0;
+    double total = 0;
+    while (total < minTime) {
+        rasBlock* ctx = new_block(ninsts * 4 + 4096);
+        bench_branch_fwd(ctx, ninsts);
+        double t = now();
+        rasReady(ctx);
+        total += now() - t;
+        bytes += rasGetSize(ctx);
+        rasDestroy(ctx);
+    }
+    char name[64];
+    snprintf(name, sizeof name, "ready_%zu", ninsts);
+    printf("%s,%zu,%.6f,%.0f,bytes/s\n", name, bytes, total, bytes / total);
+}
+
+// cost of checking finished code with the verifier, per byte of code
+static void run_verify(size_t ninsts) {
+    size_t bytes = 0;
+    double total = 0;
+    while (total < minTime) {
+        rasBlock* ctx = new_block(ninsts * 4 + 4096);
+        bench_branch_fwd(ctx, ninsts);
+        RET();
+        rasReady(ctx);
+        double t = now();
+        sink += rasVerifyA64(ctx, NULL);
+        total += now() - t;
+        bytes += rasGetSize(ctx);
+        rasDestroy(ctx);
+    }
+    char name[64];
+    snprintf(name, sizeof name, "verify_%zu", ninsts);
+    printf("%s,%zu,%.6f,%.0f,bytes/s\n", name, bytes, total, bytes / total);
+}
+
+static void run_create(size_t size) {
+    size_t ops = 0;
+    double t = now(), total = 0;
+    while (total < minTime) {
+        for (int i = 0; i < 256; i++) {
+            rasBlock* ctx = new_block(size);
+            NOP();
+            rasDestroy(ctx);
+        }
+        ops += 256;
+        total = now() - t;
+    }
+    char name[64];
+    snprintf(name, sizeof name, "create_destroy_%zu", size);
+    printf("%s,%zu,%.6f,%.0f,blocks/s\n", name, ops, total, ops / total);
+}
+
+// blocks sharing pages from a pool, which are reused instead of unmapped
+static void run_pool_create(size_t size) {
+    rasBlockPool* pool = rasCreateBlockPool(size);
+    size_t ops = 0;
+    double t = now(), total = 0;
+    while (total < minTime) {
+        for (int i = 0; i < 256; i++) {
+            rasBlock* ctx = rasPoolGet(pool);
+            NOP();
+            rasPoolPut(pool, ctx);
+        }
+        ops += 256;
+        total = now() - t;
+    }
+    rasDestroyBlockPool(pool);
+    char name[64];
+    snprintf(name, sizeof name, "create_destroy_pool_%zu", size);
+    printf("%s,%zu,%.6f,%.0f,blocks/s\n", name, ops, total, ops / total);
+}
+
+#ifdef __aarch64__
+// calls a small generated loop to check the code runs at native speed
+static void run_exec(void) {
+    rasBlock* ctx = rasCreate(4096);
+    LABEL(loop);
+    MOV(R1, 0);
+    L(loop);
+    ADD(R1, R1, R0);
+    SUBS(R0, R0, 1);
+    BNE(loop);
+    MOV(R0, R1);
+    RET();
+    rasReady(ctx);
+    uint64_t (*f)(uint64_t) = rasGetCode(ctx);
+
+    size_t ops = 0;
+    double t = now(), total = 0;
+    while (total < minTime) {
+        sink += f(1 << 20);
+        ops += 1 << 20;
+        total = now() - t;
+    }
+    printf("exec_loop,%zu,%.6f,%.0f,iter/s\n", ops, total, ops / total);
+    rasDestroy(ctx);
+}
+
+// counts itlb misses of this thread, -1 if perf events are not available
+static int itlb_open(void) {
+#ifdef __linux__
+    // starts counting when opened
+    struct perf_event_attr attr = {
+        .type = PERF_TYPE_HW_CACHE,
+        .size = sizeof attr,
+        .config = PERF_COUNT_HW_CACHE_ITLB |
+                  PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                  PERF_COUNT_HW_CACHE_RESULT_MISS << 16,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+    };
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+static uint64_t itlb_close(int fd) {
+    uint64_t misses = 0;
+#ifdef __linux__
+    if (read(fd, &misses, sizeof misses) != sizeof misses) misses = 0;
+    close(fd);
+#endif
+    return misses;
+}
+
+// a chain of jumps through one instruction on each of npages pages in a
+// random order, which needs an itlb entry per page with 4KB pages
+static void run_itlb(const char* name, const rasAllocator* alloc) {
+    size_t npages = 8192;
+    rasBlock* ctx = rasCreateWithAllocator(npages * 4096 + 4096, alloc);
+    rasLabel* pages = malloc(npages * sizeof *pages);
+    size_t* order = malloc(npages * sizeof *order);
+    for (size_t i = 0; i < npages; i++) {
+        pages[i] = LNEW();
+        order[i] = i;
+    }
+    srand(1);
+    for (size_t i = npages - 1; i > 0; i--) {
+        size_t j = rand() % (i + 1);
+        size_t t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    LABEL(end);
+    B(pages[order[0]]);
+    rasLabel* next = malloc(npages * sizeof *next);
+    for (size_t i = 0; i < npages; i++) {
+        next[order[i]] = i + 1 < npages ? pages[order[i + 1]] : end;
+    }
+    for (size_t i = 0; i < npages; i++) {
+        ALIGN(4096);
+        L(pages[i]);
+        ADD(R0, R0, 1);
+        B(next[i]);
+    }
+    L(end);
+    RET();
+    rasReady(ctx);
+    uint64_t (*f)(uint64_t) = rasGetCode(ctx);
+
+    size_t ops = 0;
+    double t = now(), total = 0;
+    int fd = itlb_open();
+    while (total < minTime) {
+        sink += f(0);
+        ops += npages;
+        total = now() - t;
+    }
+    uint64_t misses = fd >= 0 ? itlb_close(fd) : 0;
+    printf("%s,%zu,%.6f,%.0f,jumps/s\n", name, ops, total, ops / total);
+    if (fd >= 0) {
+        printf("%s_misses,%zu,%.6f,%.4f,misses/jump\n", name, ops, total,
+               (double) misses / ops);
+    }
+    free(pages);
+    free(order);
+    free(next);
+    rasDestroy(ctx);
+}
+#endif
+
+static int selected(int argc, char** argv, const char* name) {
+    if (argc < 2) return 1;
+    for (int i = 1; i < argc; i++) {
+        if (!strncmp(name, argv[i], strlen(argv[i]))) return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    char* env = getenv("RAS_BENCH_TIME");
+    if (env) minTime = atof(env);
+    // heap blocks with a virtual base, no mmap/mprotect/cache maintenance
+    noExec = getenv("RAS_BENCH_NOEXEC") != NULL;
+
+    printf("name,ops,seconds,ops_per_sec,unit\n");
+
+    static const struct {
+        const char* name;
+        emitFn fn;
+    } emits[] = {
+        {"alu_imm", bench_alu_imm},   {"ldst", bench_ldst},
+        {"branch_fwd", bench_branch_fwd}, {"simd", bench_simd},
+        {"labels", bench_labels},     {"const", bench_const},
+        {"guard", bench_guard},       {"guard_template", bench_guard_template},
+    };
+    for (int i = 0; i < sizeof emits / sizeof emits[0]; i++) {
+        if (selected(argc, argv, emits[i].name))
+            run_emit(emits[i].name, emits[i].fn, 1 << 16);
+    }
+    if (selected(argc, argv, "ready")) {
+        for (size_t n = 1 << 8; n <= 1 << 18; n <<= 5) run_ready(n);
+    }
+    if (selected(argc, argv, "verify")) {
+        for (size_t n = 1 << 8; n <= 1 << 18; n <<= 5) run_verify(n);
+    }
+    if (selected(argc, argv, "create_destroy")) {
+        run_create(4096);
+        run_create(1 << 20);
+        if (!noExec) run_pool_create(256);
+    }
+#ifdef __aarch64__
+    if (!noExec && selected(argc, argv, "exec")) run_exec();
+    if (!noExec && selected(argc, argv, "exec_itlb")) {
+        run_itlb("exec_itlb_4k", &rasMmapAllocator);
+        run_itlb("exec_itlb_huge", &rasHugePageAllocator);
+    }
+#endif
+
+    return 0;
+}
@@ -1,124 +1,503 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "ras/ras_a64.h"
 
-char data[65536];
+#include <stdbool.h>
 
-int main(int argc, char** argv) {
-    rasBlock* ctx = rasCreate(16384);
+// padding on both sides for the 16 byte loads of scan loops
+#define TAPE_SIZE 65536
+#define TAPE_PAD 16
+unsigned char tape[TAPE_PAD + TAPE_SIZE + TAPE_PAD];
 
-    char* p;
-    if (argc < 2) {
-        // hello world from wikipedia
-        p = "++++++++[>++++[>++>+++>+++>+<<<<-]>+>+>->>+[<]<-]>>.>---.+++++++.."
-            "+++.>>.<-.<.+++.------.--------.>>+.>++.";
-    } else {
-        FILE* f = fopen(argv[1], "r");
-        fseek(f, 0, SEEK_END);
-        int len = ftell(f);
-        rewind(f);
-        p = malloc(len + 1);
-        fread(p, 1, len, f);
+typedef void (*bfFunc)(unsigned char* p, int (*out)(int), int (*in)(void));
+
+// R19: data ptr
+// R20: output function
+// R21: input function
+rasA64Frame frame = {.gprs = 1 << 19 | 1 << 20 | 1 << 21};
+
+// hello world from wikipedia
+const char* hello =
+    "++++++++[>++++[>++>+++>+++>+<<<<-]>+>+>->>+[<]<-]>>.>---.+++++++.."
+    "+++.>>.<-.<.+++.------.--------.>>+.>++.";
+
+typedef struct {
+    rasLabel start;
+    rasLabel end;
+} Loop;
+
+Loop* loops;
+int top;
+int maxLoops;
+
+void push_loop(rasBlock* ctx) {
+    if (top == maxLoops) {
+        maxLoops = maxLoops ? maxLoops * 2 : 64;
+        loops = realloc(loops, maxLoops * sizeof *loops);
+    }
+    loops[top].start = LNEW();
+    loops[top].end = LNEW();
+    top++;
+}
+
+Loop pop_loop() {
+    if (!top) {
+        fprintf(stderr, "unmatched ]\n");
+        exit(1);
     }
+    return loops[--top];
+}
 
-    rasLabel labs[100][2];
-    int top = 0;
+int count_run(const char** p, char c) {
+    int ct = 1;
+    while (**p == c) {
+        ct++;
+        (*p)++;
+    }
+    return ct;
+}
 
+// one instruction sequence per command, runs of +-<> are folded
+void compile_naive(rasBlock* ctx, const char* p) {
+    PROLOGUE(&frame);
+    MOVX(R19, R0);
+    MOVX(R20, R1);
+    MOVX(R21, R2);
     char c;
-    // R25: data ptr
-    // R26: idx
-    // R27: putchar ptr
-    // R28: getchar ptr
-    PUSH(FP, LR);
-    PUSH(R27, R28);
-    PUSH(R25, R26);
-    MOVX(R26, R0);
-    MOVX(R27, 0);
-    ADRL(R28, LNEW(putchar));
-    ADRL(R29, LNEW(getchar));
     while ((c = *p++)) {
         switch (c) {
-            case '>': {
-                int ct = 1;
-                while (*p == '>') {
-                    ct++;
-                    p++;
+            case '>':
+                ADDX(R19, R19, count_run(&p, c));
+                break;
+            case '<':
+                SUBX(R19, R19, count_run(&p, c));
+                break;
+            case '+':
+            case '-': {
+                int ct = count_run(&p, c);
+                LDRB(R0, (R19));
+                if (c == '+') {
+                    ADDW(R0, R0, ct);
+                } else {
+                    SUBW(R0, R0, ct);
                 }
-                ADDX(R27, R27, ct);
-                UXTH(R27, R27);
+                STRB(R0, (R19));
                 break;
             }
-            case '<': {
-                int ct = 1;
-                while (*p == '<') {
-                    ct++;
-                    p++;
-                }
-                SUBX(R27, R27, ct);
-                UXTH(R27, R27);
+            case '.':
+                LDRB(R0, (R19));
+                BLR(R20);
+                break;
+            case ',':
+                BLR(R21);
+                STRB(R0, (R19));
+                break;
+            case '[':
+                push_loop(ctx);
+                LDRB(R0, (R19));
+                CBZW(R0, loops[top - 1].end);
+                L(loops[top - 1].start);
+                break;
+            case ']': {
+                Loop l = pop_loop();
+                LDRB(R0, (R19));
+                CBNZW(R0, l.start);
+                L(l.end);
                 break;
             }
-            case '+': {
-                int ct = 1;
-                while (*p == '+') {
-                    ct++;
-                    p++;
+        }
+    }
+    EPILOGUE(&frame);
+    RET();
+}
+
+// cells are cached in W8-W15 across straight line code and pointer moves
+// are only emitted at loops, calls and scans. offsets are relative to R19
+#define NCELLS 8
+#define MAXOFF 255
+
+struct {
+    int off;
+    bool valid;
+    bool dirty;
+    unsigned used;
+} cells[NCELLS];
+unsigned useCount;
+// pointer movement not emitted yet
+int cur;
+
+void spill_cells(rasBlock* ctx, bool forget) {
+    for (int i = 0; i < NCELLS; i++) {
+        if (cells[i].valid && cells[i].dirty) {
+            STRB(R(8 + i), (R19, cells[i].off));
+            cells[i].dirty = false;
+        }
+        if (forget) cells[i].valid = false;
+    }
+}
+
+void emit_move(rasBlock* ctx) {
+    if (!cur) return;
+    if (cur > 0) {
+        ADDX(R19, R19, cur);
+    } else {
+        SUBX(R19, R19, -cur);
+    }
+    for (int i = 0; i < NCELLS; i++) cells[i].off -= cur;
+    cur = 0;
+}
+
+// the register holding the cell at rel from the current position
+rasA64Reg cell_reg(rasBlock* ctx, int rel, bool load) {
+    int off = cur + rel;
+    if (off > MAXOFF || off < -MAXOFF) {
+        emit_move(ctx);
+        off = rel;
+    }
+    int i, victim = 0;
+    for (i = 0; i < NCELLS; i++) {
+        if (cells[i].valid && cells[i].off == off) break;
+        if (!cells[i].valid ||
+            (cells[victim].valid && cells[i].used < cells[victim].used))
+            victim = i;
+    }
+    if (i == NCELLS) {
+        i = victim;
+        if (cells[i].valid && cells[i].dirty)
+            STRB(R(8 + i), (R19, cells[i].off));
+        cells[i].off = off;
+        cells[i].valid = true;
+        cells[i].dirty = false;
+        if (load) LDRB(R(8 + i), (R19, off));
+    }
+    cells[i].used = ++useCount;
+    return R(8 + i);
+}
+
+void set_dirty(rasA64Reg r) {
+    cells[r.idx - 8].dirty = true;
+}
+
+// [>] and [<] find the next zero 16 bytes at a time
+void compile_scan(rasBlock* ctx, int step) {
+    emit_move(ctx);
+    spill_cells(ctx, true);
+    LABEL(lloop);
+    LABEL(lfound0);
+    LABEL(lfound1);
+    LABEL(lend);
+    if (step == 1) {
+        EOR16B(V2, V2, V2);
+        L(lloop);
+        LDRQ(V0, (R19));
+        CMEQ16B(V1, V0, V2);
+        UMOVD(R0, V1, 0);
+        CBNZX(R0, lfound0);
+        UMOVD(R0, V1, 1);
+        CBNZX(R0, lfound1);
+        ADDX(R19, R19, 16);
+        B(lloop);
+        L(lfound1);
+        ADDX(R19, R19, 8);
+        L(lfound0);
+        RBITX(R0, R0);
+        CLZX(R0, R0);
+        ADDX(R19, R19, R0, LSR(3));
+    } else if (step == -1) {
+        EOR16B(V2, V2, V2);
+        L(lloop);
+        LDRQ(V0, (R19, -15));
+        CMEQ16B(V1, V0, V2);
+        UMOVD(R0, V1, 1);
+        CBNZX(R0, lfound1);
+        UMOVD(R0, V1, 0);
+        CBNZX(R0, lfound0);
+        SUBX(R19, R19, 16);
+        B(lloop);
+        L(lfound0);
+        SUBX(R19, R19, 8);
+        L(lfound1);
+        CLZX(R0, R0);
+        SUBX(R19, R19, R0, LSR(3));
+    } else {
+        LDRB(R0, (R19));
+        CBZW(R0, lend);
+        L(lloop);
+        if (step > 0) {
+            ADDX(R19, R19, step);
+        } else {
+            SUBX(R19, R19, -step);
+        }
+        LDRB(R0, (R19));
+        CBNZW(R0, lloop);
+    }
+    L(lend);
+}
+
+#define MAXTERMS 16
+
+// loops without io or nested loops that either move the pointer without
+// changing cells or change cells and return to the same cell which is
+// incremented or decremented once. returns false if the loop isn't one
+bool compile_simple_loop(rasBlock* ctx, const char** pp) {
+    const char* p = *pp + 1;
+    int offs[MAXTERMS], deltas[MAXTERMS];
+    int nterms = 0;
+    int pos = 0;
+    bool changes = false;
+    for (; *p != ']'; p++) {
+        switch (*p) {
+            case 0:
+            case '[':
+            case '.':
+            case ',':
+                return false;
+            case '>':
+                pos++;
+                break;
+            case '<':
+                pos--;
+                break;
+            case '+':
+            case '-': {
+                int t;
+                for (t = 0; t < nterms; t++) {
+                    if (offs[t] == pos) break;
+                }
+                if (t == nterms) {
+                    if (nterms == MAXTERMS) return false;
+                    offs[t] = pos;
+                    deltas[t] = 0;
+                    nterms++;
                 }
-                LDRB(R0, (R26, R27));
-                ADDW(R0, R0, ct);
-                STRB(R0, (R26, R27));
+                deltas[t] += *p == '+' ? 1 : -1;
+                changes = true;
                 break;
             }
+        }
+    }
+
+    if (!changes) {
+        if (!pos) return false;
+        compile_scan(ctx, pos);
+        *pp = p + 1;
+        return true;
+    }
+
+    int counter = -1;
+    for (int t = 0; t < nterms; t++) {
+        if (offs[t] > MAXOFF || offs[t] < -MAXOFF) return false;
+        if (offs[t] == 0) counter = t;
+    }
+    if (pos || counter < 0) return false;
+    int step = deltas[counter] & 0xff;
+    if (step != 1 && step != 0xff) return false;
+
+    // the loop runs cell times when it decrements, 256 - cell otherwise
+    for (int t = 0; t < nterms; t++) {
+        if (t == counter) continue;
+        int k = (step == 0xff ? deltas[t] : -deltas[t]) & 0xff;
+        if (!k) continue;
+        rasA64Reg src = cell_reg(ctx, 0, true);
+        rasA64Reg dst = cell_reg(ctx, offs[t], true);
+        if (k == 1) {
+            ADDW(dst, dst, src);
+        } else if (k == 0xff) {
+            SUBW(dst, dst, src);
+        } else if (!(k & (k - 1))) {
+            ADDW(dst, dst, src, LSL(__builtin_ctz(k)));
+        } else {
+            MOVW(R0, k);
+            MADDW(dst, src, R0, dst);
+        }
+        set_dirty(dst);
+    }
+    rasA64Reg r = cell_reg(ctx, 0, false);
+    MOVW(r, 0);
+    set_dirty(r);
+    *pp = p + 1;
+    return true;
+}
+
+void compile_opt(rasBlock* ctx, const char* p) {
+    memset(cells, 0, sizeof cells);
+    cur = 0;
+
+    PROLOGUE(&frame);
+    MOVX(R19, R0);
+    MOVX(R20, R1);
+    MOVX(R21, R2);
+    char c;
+    while ((c = *p)) {
+        switch (c) {
+            case '>':
+                cur++;
+                break;
+            case '<':
+                cur--;
+                break;
+            case '+':
             case '-': {
-                int ct = 1;
-                while (*p == '-') {
-                    ct++;
-                    p++;
+                int n = 0;
+                for (; *p == '+' || *p == '-'; p++) n += *p == '+' ? 1 : -1;
+                p--;
+                if (n & 0xff) {
+                    rasA64Reg r = cell_reg(ctx, 0, true);
+                    ADDW(r, r, n & 0xff);
+                    set_dirty(r);
                 }
-                LDRB(R0, (R26, R27));
-                SUBW(R0, R0, ct);
-                STRB(R0, (R26, R27));
                 break;
             }
             case '.': {
-                LDRB(R0, (R26, R27));
-                BLR(R28);
+                rasA64Reg r = cell_reg(ctx, 0, true);
+                MOVW(R0, r);
+                spill_cells(ctx, true);
+                BLR(R20);
                 break;
             }
             case ',': {
-                BLR(R29);
-                STRB(R0, (R26, R27));
+                spill_cells(ctx, true);
+                BLR(R21);
+                rasA64Reg r = cell_reg(ctx, 0, false);
+                MOVW(r, R0);
+                set_dirty(r);
                 break;
             }
             case '[': {
-                top++;
-                labs[top][0] = LNEW();
-                labs[top][1] = LNEW();
-                LDRB(R0, (R26, R27));
-                CBZW(R0, labs[top][1]);
-                L(labs[top][0]);
+                if (compile_simple_loop(ctx, &p)) continue;
+                emit_move(ctx);
+                push_loop(ctx);
+                rasA64Reg r = cell_reg(ctx, 0, true);
+                spill_cells(ctx, true);
+                TSTW(r, 0xff);
+                BEQ(loops[top - 1].end);
+                L(loops[top - 1].start);
                 break;
             }
             case ']': {
-                LDRB(R0, (R26, R27));
-                CBNZW(R0, labs[top][0]);
-                L(labs[top][1]);
-                top--;
+                emit_move(ctx);
+                Loop l = pop_loop();
+                rasA64Reg r = cell_reg(ctx, 0, true);
+                spill_cells(ctx, true);
+                TSTW(r, 0xff);
+                BNE(l.start);
+                L(l.end);
                 break;
             }
         }
+        p++;
     }
-
-    POP(R25, R26);
-    POP(R27, R28);
-    POP(FP, LR);
+    spill_cells(ctx, true);
+    EPILOGUE(&frame);
     RET();
+}
 
+rasBlock* compile(const char* p, bool naive) {
+    rasBlock* ctx = rasCreate(16384);
+    rasEnablePeephole(ctx, RAS_PEEPHOLE_ALL);
+    top = 0;
+    if (naive) {
+        compile_naive(ctx, p);
+    } else {
+        compile_opt(ctx, p);
+    }
+    if (top) {
+        fprintf(stderr, "unmatched [\n");
+        exit(1);
+    }
     rasReady(ctx);
+    return ctx;
+}
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// the benchmark checks that both versions print the same thing
+unsigned long outputHash;
+size_t outputLen;
+
+int bench_out(int c) {
+    outputHash = outputHash * 31 + (unsigned char) c;
+    outputLen++;
+    return c;
+}
+
+int bench_in() {
+    return 0;
+}
+
+int run_bench(const char* p) {
+    unsigned long hashes[2];
+    double times[2];
+    for (int naive = 1; naive >= 0; naive--) {
+        double t = now();
+        rasBlock* ctx = compile(p, naive);
+        double compileTime = now() - t;
+
+        memset(tape, 0, sizeof tape);
+        outputHash = 0;
+        outputLen = 0;
+        bfFunc f = rasGetCode(ctx);
+        t = now();
+        f(tape + TAPE_PAD, bench_out, bench_in);
+        times[naive] = now() - t;
+        hashes[naive] = outputHash;
+
+        printf("%s: compile %.3f ms, %zu bytes of code, run %.3f s, %zu bytes "
+               "of output\n",
+               naive ? "naive" : "optimized", compileTime * 1e3,
+               rasGetSize(ctx), times[naive], outputLen);
+        rasDestroy(ctx);
+    }
+    printf("speedup %.2fx\n", times[1] / times[0]);
+    if (hashes[0] != hashes[1]) {
+        printf("output differs\n");
+        return 1;
+    }
+    return 0;
+}
+
+char* read_file(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    rewind(f);
+    char* p = malloc(len + 1);
+    len = fread(p, 1, len, f);
+    p[len] = 0;
+    fclose(f);
+    return p;
+}
+
+// usage: bf [-n] [-b] [file]
+// -n uses the naive compiler, -b times both on the program
+int main(int argc, char** argv) {
+    bool naive = false, bench = false;
+    const char* p = hello;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n")) {
+            naive = true;
+        } else if (!strcmp(argv[i], "-b")) {
+            bench = true;
+        } else {
+            p = read_file(argv[i]);
+        }
+    }
 
-    void (*f)(char*) = rasGetCode(ctx);
-    f(data);
+    if (bench) return run_bench(p);
 
+    rasBlock* ctx = compile(p, naive);
+    bfFunc f = rasGetCode(ctx);
+    f(tape + TAPE_PAD, putchar, getchar);
     rasDestroy(ctx);
-}
\ No newline at end of file
+}
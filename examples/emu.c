@@ -0,0 +1,531 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ras/ras_a64.h"
+
+#include <stdbool.h>
+
+// an emulator for a small guest isa that translates basic blocks into a
+// code cache. blocks end in exits which return to the dispatcher until the
+// block they go to is translated, then the branch is patched to go there
+// directly. indirect jumps look the target up in a hash table and only
+// return to the dispatcher when it is not there. when the cache is full the
+// oldest half of the blocks is thrown away and the cache is compacted
+
+enum {
+    OP_LI,   // rd = imm
+    OP_ADD,  // rd = rs + rt
+    OP_SUB,  // rd = rs - rt
+    OP_AND,  // rd = rs & rt
+    OP_XOR,  // rd = rs ^ rt
+    OP_MUL,  // rd = rs * rt
+    OP_ADDI, // rd = rs + imm
+    OP_SHRI, // rd = rs >> imm
+    OP_LD,   // rd = mem[rs + imm]
+    OP_ST,   // mem[rs + imm] = rd
+    OP_BNZ,  // if (rs) pc = imm
+    OP_BZ,   // if (!rs) pc = imm
+    OP_J,    // pc = imm
+    OP_JAL,  // rd = pc + 1, pc = imm
+    OP_JALR, // rd = pc + 1, pc = rs
+    OP_JR,   // pc = rs
+    OP_HALT,
+};
+
+typedef struct {
+    uint8_t op, rd, rs, rt;
+    int32_t imm;
+} Insn;
+
+#define MAXPROG 65536
+Insn prog[MAXPROG];
+uint32_t nprog;
+
+#define MEMWORDS 8192
+#define MEMMASK (MEMWORDS - 1)
+
+typedef struct {
+    uint32_t pc;
+    void* code;
+} JumpEntry;
+
+#define JUMPBITS 12
+#define JUMPMASK ((1 << JUMPBITS) - 1)
+
+typedef struct {
+    uint32_t regs[8];
+    uint32_t* mem;
+    JumpEntry* jumps;
+} Cpu;
+
+uint32_t asm_insn(int op, int rd, int rs, int rt, int32_t imm) {
+    prog[nprog] = (Insn) {op, rd, rs, rt, imm};
+    return nprog++;
+}
+
+#define NFUNCS 1024
+#define FTABLE 4096
+
+uint32_t funcs[NFUNCS];
+
+// calls functions from a table in a random order, each of which loops a few
+// times and stores a value
+void gen_program(uint32_t iters) {
+    asm_insn(OP_LI, 1, 0, 0, iters);
+    asm_insn(OP_LI, 2, 0, 0, 1);
+    asm_insn(OP_LI, 5, 0, 0, 1103515245);
+    asm_insn(OP_LI, 0, 0, 0, 0);
+    uint32_t loop = asm_insn(OP_MUL, 2, 2, 5, 0);
+    asm_insn(OP_ADDI, 2, 2, 0, 12345);
+    asm_insn(OP_SHRI, 3, 2, 0, 16);
+    asm_insn(OP_LI, 6, 0, 0, NFUNCS - 1);
+    asm_insn(OP_AND, 3, 3, 6, 0);
+    asm_insn(OP_LD, 4, 3, 0, FTABLE);
+    asm_insn(OP_JALR, 7, 4, 0, 0);
+    asm_insn(OP_ADDI, 1, 1, 0, -1);
+    asm_insn(OP_BNZ, 0, 1, 0, loop);
+    asm_insn(OP_HALT, 0, 0, 0, 0);
+
+    for (int k = 0; k < NFUNCS; k++) {
+        funcs[k] = asm_insn(OP_LI, 6, 0, 0, k % 5 + 1);
+        uint32_t inner = asm_insn(OP_LI, 3, 0, 0, k * 2654435761u);
+        asm_insn(OP_XOR, 0, 0, 3, 0);
+        asm_insn(OP_SHRI, 3, 0, 0, 7 + k % 5);
+        asm_insn(OP_ADD, 0, 0, 3, 0);
+        asm_insn(OP_ADDI, 6, 6, 0, -1);
+        asm_insn(OP_BNZ, 0, 6, 0, inner);
+        asm_insn(OP_ST, 0, 6, 0, k);
+        asm_insn(OP_JR, 0, 7, 0, 0);
+    }
+}
+
+void init_cpu(Cpu* cpu) {
+    memset(cpu, 0, sizeof *cpu);
+    cpu->mem = calloc(MEMWORDS, sizeof *cpu->mem);
+    for (int k = 0; k < NFUNCS; k++) cpu->mem[FTABLE + k] = funcs[k];
+}
+
+void bad_pc(uint32_t pc) {
+    fprintf(stderr, "jump to invalid pc %u\n", pc);
+    exit(1);
+}
+
+uint64_t interpret(Cpu* cpu) {
+    uint32_t* r = cpu->regs;
+    uint32_t* mem = cpu->mem;
+    uint64_t count = 0;
+    uint32_t pc = 0;
+    for (;;) {
+        if (pc >= nprog) bad_pc(pc);
+        Insn* i = &prog[pc++];
+        count++;
+        switch (i->op) {
+            case OP_LI:
+                r[i->rd] = i->imm;
+                break;
+            case OP_ADD:
+                r[i->rd] = r[i->rs] + r[i->rt];
+                break;
+            case OP_SUB:
+                r[i->rd] = r[i->rs] - r[i->rt];
+                break;
+            case OP_AND:
+                r[i->rd] = r[i->rs] & r[i->rt];
+                break;
+            case OP_XOR:
+                r[i->rd] = r[i->rs] ^ r[i->rt];
+                break;
+            case OP_MUL:
+                r[i->rd] = r[i->rs] * r[i->rt];
+                break;
+            case OP_ADDI:
+                r[i->rd] = r[i->rs] + i->imm;
+                break;
+            case OP_SHRI:
+                r[i->rd] = r[i->rs] >> (i->imm & 31);
+                break;
+            case OP_LD:
+                r[i->rd] = mem[(r[i->rs] + i->imm) & MEMMASK];
+                break;
+            case OP_ST:
+                mem[(r[i->rs] + i->imm) & MEMMASK] = r[i->rd];
+                break;
+            case OP_BNZ:
+                if (r[i->rs]) pc = i->imm;
+                break;
+            case OP_BZ:
+                if (!r[i->rs]) pc = i->imm;
+                break;
+            case OP_J:
+                pc = i->imm;
+                break;
+            case OP_JAL:
+                r[i->rd] = pc;
+                pc = i->imm;
+                break;
+            case OP_JALR: {
+                uint32_t t = r[i->rs];
+                r[i->rd] = pc;
+                pc = t;
+                break;
+            }
+            case OP_JR:
+                pc = r[i->rs];
+                break;
+            case OP_HALT:
+                return count;
+        }
+    }
+}
+
+#define HALTPC UINT32_MAX
+#define MAXBLOCK 64
+
+typedef struct {
+    uint32_t target;
+    rasLabel label;
+    bool linked;
+} Exit;
+
+typedef struct {
+    uint32_t pc;
+    // updated by the code cache when the block moves
+    void* code;
+    Exit exits[2];
+    int nexits;
+} Block;
+
+rasCodeCache* cache;
+Block* blocks[MAXPROG];
+// live blocks, oldest first
+Block** live;
+size_t nlive;
+JumpEntry jumps[1 << JUMPBITS];
+
+void* exitAddr;
+void* lookupAddr;
+
+struct {
+    size_t translated;
+    size_t dispatches;
+    size_t links;
+    size_t repatches;
+    size_t evictions;
+    size_t released;
+} stats;
+
+// R19: cpu
+// R20-R27: guest registers
+// R28: guest memory
+#define GREG(n) R(20 + (n))
+
+// saves the host registers and loads the guest registers
+rasA64Frame frame = {.gprs = 0x3ff << 19};
+
+typedef uint32_t (*enterFunc)(Cpu* cpu, void* code);
+
+// enter(cpu, code) runs translated code until it exits with the next pc in
+// R0. lookup finds the code for the pc in R0 in the jump table or exits
+enterFunc build_trampoline() {
+    rasBlock* ctx = rasCreateNoExec(NULL, 4096, 0);
+    LABEL(lexit);
+    LABEL(llookup);
+
+    PROLOGUE(&frame);
+    MOVX(R19, R0);
+    LDRX(R28, (R19, offsetof(Cpu, mem)));
+    for (int i = 0; i < 8; i++) LDRW(GREG(i), (R19, 4 * i));
+    BR(R1);
+
+    L(llookup);
+    LDRX(R9, (R19, offsetof(Cpu, jumps)));
+    ANDW(R10, R0, JUMPMASK);
+    ADDX(R9, R9, R10, LSL(4));
+    LDRW(R11, (R9, offsetof(JumpEntry, pc)));
+    CMPW(R11, R0);
+    BNE(lexit);
+    LDRX(R9, (R9, offsetof(JumpEntry, code)));
+    BR(R9);
+
+    L(lexit);
+    for (int i = 0; i < 8; i++) STRW(GREG(i), (R19, 4 * i));
+    EPILOGUE(&frame);
+    RET();
+
+    uint8_t* start = rasGetCode(ctx);
+    ptrdiff_t exitOff = (uint8_t*) rasGetLabelAddr(ctx, lexit) - start;
+    ptrdiff_t lookupOff = (uint8_t*) rasGetLabelAddr(ctx, llookup) - start;
+    // the first function in the cache is never freed so it never moves
+    uint8_t* code = rasCacheAdd(cache, ctx, NULL);
+    exitAddr = code + exitOff;
+    lookupAddr = code + lookupOff;
+    return (enterFunc) code;
+}
+
+void exit_to(rasBlock* ctx, Block* b, uint32_t target) {
+    Exit* e = &b->exits[b->nexits++];
+    e->target = target;
+    e->label = LNEW();
+    e->linked = false;
+    MOVW(R0, target);
+    B(e->label);
+}
+
+void add_imm(rasBlock* ctx, rasA64Reg rd, rasA64Reg rs, int32_t imm) {
+    if (imm >= 0 && imm < 4096) {
+        ADDW(rd, rs, imm);
+    } else if (imm < 0 && imm > -4096) {
+        SUBW(rd, rs, -imm);
+    } else {
+        MOVW(R9, imm);
+        ADDW(rd, rs, R9);
+    }
+}
+
+void translate_block(rasBlock* ctx, Block* b, rasLabel llookup) {
+    uint32_t pc = b->pc;
+    for (int n = 0; n < MAXBLOCK; n++) {
+        if (pc >= nprog) bad_pc(pc);
+        Insn* i = &prog[pc++];
+        rasA64Reg rd = GREG(i->rd);
+        rasA64Reg rs = GREG(i->rs);
+        rasA64Reg rt = GREG(i->rt);
+        switch (i->op) {
+            case OP_LI:
+                MOVW(rd, (uint32_t) i->imm);
+                break;
+            case OP_ADD:
+                ADDW(rd, rs, rt);
+                break;
+            case OP_SUB:
+                SUBW(rd, rs, rt);
+                break;
+            case OP_AND:
+                ANDW(rd, rs, rt);
+                break;
+            case OP_XOR:
+                EORW(rd, rs, rt);
+                break;
+            case OP_MUL:
+                MULW(rd, rs, rt);
+                break;
+            case OP_ADDI:
+                add_imm(ctx, rd, rs, i->imm);
+                break;
+            case OP_SHRI:
+                LSRW(rd, rs, i->imm & 31);
+                break;
+            case OP_LD:
+            case OP_ST:
+                add_imm(ctx, R9, rs, i->imm);
+                ANDW(R9, R9, MEMMASK);
+                if (i->op == OP_LD) {
+                    LDRW(rd, (R28, R9, LSL(2)));
+                } else {
+                    STRW(rd, (R28, R9, LSL(2)));
+                }
+                break;
+            case OP_BNZ:
+            case OP_BZ: {
+                LABEL(ltaken);
+                if (i->op == OP_BNZ) {
+                    CBNZW(rs, ltaken);
+                } else {
+                    CBZW(rs, ltaken);
+                }
+                exit_to(ctx, b, pc);
+                L(ltaken);
+                exit_to(ctx, b, i->imm);
+                return;
+            }
+            case OP_J:
+                exit_to(ctx, b, i->imm);
+                return;
+            case OP_JAL:
+                MOVW(rd, pc);
+                exit_to(ctx, b, i->imm);
+                return;
+            case OP_JALR:
+            case OP_JR:
+                MOVW(R0, rs);
+                if (i->op == OP_JALR) MOVW(rd, pc);
+                B(llookup);
+                return;
+            case OP_HALT:
+                exit_to(ctx, b, HALTPC);
+                return;
+        }
+    }
+    exit_to(ctx, b, pc);
+}
+
+// exits go to the dispatcher until the block they go to is translated
+void resolve_exits(Block* b) {
+    for (int i = 0; i < b->nexits; i++) {
+        Exit* e = &b->exits[i];
+        Block* t = e->target < nprog ? blocks[e->target] : NULL;
+        rasDefineLabelExternal(e->label, t ? t->code : exitAddr);
+        e->linked = t;
+    }
+}
+
+void rebuild_jumps() {
+    for (int i = 0; i <= JUMPMASK; i++) jumps[i] = (JumpEntry) {HALTPC, NULL};
+    for (size_t i = 0; i < nlive; i++) {
+        jumps[live[i]->pc & JUMPMASK] = (JumpEntry) {live[i]->pc, live[i]->code};
+    }
+}
+
+void evict() {
+    size_t n = (nlive + 1) / 2;
+    for (size_t i = 0; i < n; i++) {
+        rasCacheFree(cache, live[i]->code);
+        blocks[live[i]->pc] = NULL;
+    }
+
+    // branches to freed blocks have to go back to the dispatcher before the
+    // cache moves them
+    for (size_t i = n; i < nlive; i++) {
+        Block* b = live[i];
+        bool changed = false;
+        for (int j = 0; j < b->nexits; j++) {
+            Exit* e = &b->exits[j];
+            if (e->linked && !blocks[e->target]) {
+                rasDefineLabelExternal(e->label, exitAddr);
+                e->linked = false;
+                changed = true;
+            }
+        }
+        if (changed) {
+            rasCacheRepatch(cache, b->code);
+            stats.repatches++;
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) free(live[i]);
+    memmove(live, live + n, (nlive - n) * sizeof *live);
+    nlive -= n;
+    stats.evictions++;
+    stats.released += rasCompactCodeCache(cache);
+    rebuild_jumps();
+}
+
+// links the exits of other blocks that go to b
+void link_block(Block* b) {
+    for (size_t i = 0; i < nlive; i++) {
+        Block* s = live[i];
+        bool changed = false;
+        for (int j = 0; j < s->nexits; j++) {
+            Exit* e = &s->exits[j];
+            if (!e->linked && e->target == b->pc) {
+                rasDefineLabelExternal(e->label, b->code);
+                e->linked = true;
+                changed = true;
+                stats.links++;
+            }
+        }
+        if (changed) {
+            rasCacheRepatch(cache, s->code);
+            stats.repatches++;
+        }
+    }
+}
+
+Block* translate(uint32_t pc) {
+    static size_t maxLive;
+    Block* b = calloc(1, sizeof *b);
+    b->pc = pc;
+
+    rasBlock* ctx = rasCreateNoExec(NULL, 4096, 0);
+    LABEL(llookup, lookupAddr);
+    translate_block(ctx, b, llookup);
+
+    for (;;) {
+        resolve_exits(b);
+        if (rasCacheAdd(cache, ctx, &b->code)) break;
+        if (!nlive) {
+            fprintf(stderr, "block does not fit in the code cache\n");
+            exit(1);
+        }
+        evict();
+    }
+
+    if (nlive == maxLive) {
+        maxLive = maxLive ? maxLive * 2 : 256;
+        live = realloc(live, maxLive * sizeof *live);
+    }
+    live[nlive++] = b;
+    blocks[pc] = b;
+    jumps[pc & JUMPMASK] = (JumpEntry) {pc, b->code};
+    link_block(b);
+    stats.translated++;
+    return b;
+}
+
+void run_translated(Cpu* cpu, enterFunc enter) {
+    cpu->jumps = jumps;
+    uint32_t pc = 0;
+    while (pc != HALTPC) {
+        if (pc >= nprog) bad_pc(pc);
+        Block* b = blocks[pc] ? blocks[pc] : translate(pc);
+        pc = enter(cpu, b->code);
+        stats.dispatches++;
+    }
+}
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// usage: emu [-n iterations] [-c cache KB]
+int main(int argc, char** argv) {
+    uint32_t iters = 1000000;
+    size_t cacheSize = 256 << 10;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "-n")) {
+            iters = strtoul(argv[i + 1], NULL, 0);
+        } else if (!strcmp(argv[i], "-c")) {
+            cacheSize = strtoul(argv[i + 1], NULL, 0) << 10;
+        }
+    }
+    gen_program(iters);
+
+    Cpu icpu, jcpu;
+    init_cpu(&icpu);
+    init_cpu(&jcpu);
+
+    double t = now();
+    uint64_t count = interpret(&icpu);
+    double interpTime = now() - t;
+
+    cache = rasCreateCodeCache(cacheSize, NULL);
+    rebuild_jumps();
+    enterFunc enter = build_trampoline();
+    t = now();
+    run_translated(&jcpu, enter);
+    double jitTime = now() - t;
+
+    bool same = !memcmp(icpu.regs, jcpu.regs, sizeof icpu.regs) &&
+                !memcmp(icpu.mem, jcpu.mem, MEMWORDS * sizeof *icpu.mem);
+
+    printf("%llu guest instructions, %u in the program\n",
+           (unsigned long long) count, nprog);
+    printf("interpreted: %.3f s, %.1f MIPS\n", interpTime,
+           count / interpTime / 1e6);
+    printf("translated: %.3f s, %.1f MIPS, speedup %.2fx\n", jitTime,
+           count / jitTime / 1e6, interpTime / jitTime);
+    printf("%zu blocks translated, %zu dispatches, %zu links, %zu repatches\n",
+           stats.translated, stats.dispatches, stats.links, stats.repatches);
+    printf("%zu evictions, %zu bytes released, %zu blocks live\n",
+           stats.evictions, stats.released, nlive);
+    if (!same) printf("guest state differs\n");
+
+    rasDestroyCodeCache(cache);
+    return !same;
+}
@@ -0,0 +1,501 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ras/ras_a64.h"
+
+#include <stdbool.h>
+
+// compiles an arithmetic expression over arrays a-f into a loop that
+// computes out[i] = expr(a[i], b[i], ...) with 4S/2D vectors and a scalar
+// loop for the remaining elements
+
+enum {
+    OP_CONST,
+    OP_VAR,
+    OP_NEG,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MIN,
+    OP_MAX,
+};
+
+#define MAXVARS 6
+
+typedef struct Node {
+    int op;
+    double val;
+    int var;
+    struct Node* a;
+    struct Node* b;
+    // register holding constants and variables
+    int reg;
+} Node;
+
+const char* src;
+
+Node* new_node(int op, Node* a, Node* b) {
+    Node* n = calloc(1, sizeof *n);
+    n->op = op;
+    n->a = a;
+    n->b = b;
+    return n;
+}
+
+void skip_space() {
+    while (isspace(*src)) src++;
+}
+
+void expect(char c) {
+    skip_space();
+    if (*src != c) {
+        fprintf(stderr, "expected '%c' at '%s'\n", c, src);
+        exit(1);
+    }
+    src++;
+}
+
+Node* parse_expr();
+
+Node* parse_primary() {
+    skip_space();
+    if (*src == '(') {
+        src++;
+        Node* n = parse_expr();
+        expect(')');
+        return n;
+    }
+    if (!strncmp(src, "min(", 4) || !strncmp(src, "max(", 4)) {
+        int op = src[1] == 'i' ? OP_MIN : OP_MAX;
+        src += 4;
+        Node* a = parse_expr();
+        expect(',');
+        Node* b = parse_expr();
+        expect(')');
+        return new_node(op, a, b);
+    }
+    if (*src >= 'a' && *src < 'a' + MAXVARS) {
+        Node* n = new_node(OP_VAR, NULL, NULL);
+        n->var = *src++ - 'a';
+        return n;
+    }
+    char* end;
+    double val = strtod(src, &end);
+    if (end == src) {
+        fprintf(stderr, "unexpected '%s'\n", src);
+        exit(1);
+    }
+    src = end;
+    Node* n = new_node(OP_CONST, NULL, NULL);
+    n->val = val;
+    return n;
+}
+
+Node* parse_unary() {
+    skip_space();
+    if (*src == '-') {
+        src++;
+        return new_node(OP_NEG, parse_unary(), NULL);
+    }
+    return parse_primary();
+}
+
+Node* parse_term() {
+    Node* n = parse_unary();
+    while (skip_space(), *src == '*' || *src == '/') {
+        int op = *src++ == '*' ? OP_MUL : OP_DIV;
+        n = new_node(op, n, parse_unary());
+    }
+    return n;
+}
+
+Node* parse_expr() {
+    Node* n = parse_term();
+    while (skip_space(), *src == '+' || *src == '-') {
+        int op = *src++ == '+' ? OP_ADD : OP_SUB;
+        n = new_node(op, n, parse_term());
+    }
+    return n;
+}
+
+double eval(Node* n, double* vars) {
+    switch (n->op) {
+        case OP_CONST:
+            return n->val;
+        case OP_VAR:
+            return vars[n->var];
+        case OP_NEG:
+            return -eval(n->a, vars);
+        case OP_ADD:
+            return eval(n->a, vars) + eval(n->b, vars);
+        case OP_SUB:
+            return eval(n->a, vars) - eval(n->b, vars);
+        case OP_MUL:
+            return eval(n->a, vars) * eval(n->b, vars);
+        case OP_DIV:
+            return eval(n->a, vars) / eval(n->b, vars);
+        case OP_MIN: {
+            double a = eval(n->a, vars), b = eval(n->b, vars);
+            return a < b ? a : b;
+        }
+        case OP_MAX: {
+            double a = eval(n->a, vars), b = eval(n->b, vars);
+            return a > b ? a : b;
+        }
+    }
+    return 0;
+}
+
+// element type and whether the code being generated is the vector loop
+bool single;
+bool vec;
+
+// picks the instruction for the current element type and loop
+#define FOP(name, ...)                                                         \
+    (vec ? (single ? name##4S(__VA_ARGS__) : name##2D(__VA_ARGS__))           \
+         : (single ? name##S(__VA_ARGS__) : name##D(__VA_ARGS__)))
+
+uint32_t freeRegs = ~0u;
+uint32_t usedRegs;
+
+int alloc_reg() {
+    if (!freeRegs) {
+        fprintf(stderr, "expression is too complex\n");
+        exit(1);
+    }
+    int r = __builtin_ctz(freeRegs);
+    freeRegs &= ~(1u << r);
+    usedRegs |= 1u << r;
+    return r;
+}
+
+void free_reg(int r) {
+    freeRegs |= 1u << r;
+}
+
+// constants get a register for the whole function, either from FMOV or a
+// literal pool after the code
+typedef struct {
+    double val;
+    int reg;
+    rasLabel pool;
+} Const;
+
+Const consts[32];
+int nconsts;
+int varRegs[MAXVARS];
+
+void collect(Node* n) {
+    if (!n) return;
+    if (n->op == OP_CONST) {
+        int i;
+        for (i = 0; i < nconsts; i++) {
+            if (consts[i].val == n->val) break;
+        }
+        if (i == nconsts) {
+            consts[i].val = n->val;
+            consts[i].reg = alloc_reg();
+            consts[i].pool = NULL;
+            nconsts++;
+        }
+        n->reg = consts[i].reg;
+    } else if (n->op == OP_VAR) {
+        if (varRegs[n->var] < 0) varRegs[n->var] = alloc_reg();
+        n->reg = varRegs[n->var];
+    }
+    collect(n->a);
+    collect(n->b);
+}
+
+void load_consts(rasBlock* ctx) {
+    for (int i = 0; i < nconsts; i++) {
+        double val = consts[i].val;
+        float fval = val;
+        uint8_t imm8;
+        // fmov can only encode a few values
+        if ((single || (double) fval == val) && rasGenerateFPImm(fval, &imm8)) {
+            if (single) {
+                FMOV4S(V(consts[i].reg), fval);
+            } else {
+                FMOV2D(V(consts[i].reg), val);
+            }
+        } else {
+            consts[i].pool = LNEW();
+            LDRLQ(V(consts[i].reg), consts[i].pool);
+        }
+    }
+}
+
+void emit_pool(rasBlock* ctx) {
+    for (int i = 0; i < nconsts; i++) {
+        if (!consts[i].pool) continue;
+        ALIGN(16);
+        L(consts[i].pool);
+        uint64_t bits;
+        if (single) {
+            float fval = consts[i].val;
+            uint32_t fbits;
+            memcpy(&fbits, &fval, 4);
+            bits = (uint64_t) fbits << 32 | fbits;
+        } else {
+            memcpy(&bits, &consts[i].val, 8);
+        }
+        DWORD(bits);
+        DWORD(bits);
+    }
+}
+
+typedef struct {
+    int reg;
+    // temporaries can be overwritten and freed
+    bool temp;
+} Val;
+
+Val gen(rasBlock* ctx, Node* n);
+
+// a * b + c with one rounding
+Val gen_fma(rasBlock* ctx, Node* mul, Node* c, bool sub) {
+    Val vc = gen(ctx, c);
+    Val va = gen(ctx, mul->a);
+    Val vb = gen(ctx, mul->b);
+    int d = vc.temp ? vc.reg : alloc_reg();
+    if (vec) {
+        if (!vc.temp) MOV16B(V(d), V(vc.reg));
+        if (sub) {
+            single ? FMLS4S(V(d), V(va.reg), V(vb.reg))
+                   : FMLS2D(V(d), V(va.reg), V(vb.reg));
+        } else {
+            single ? FMLA4S(V(d), V(va.reg), V(vb.reg))
+                   : FMLA2D(V(d), V(va.reg), V(vb.reg));
+        }
+    } else if (sub) {
+        single ? FMSUBS(V(d), V(va.reg), V(vb.reg), V(vc.reg))
+               : FMSUBD(V(d), V(va.reg), V(vb.reg), V(vc.reg));
+    } else {
+        single ? FMADDS(V(d), V(va.reg), V(vb.reg), V(vc.reg))
+               : FMADDD(V(d), V(va.reg), V(vb.reg), V(vc.reg));
+    }
+    if (va.temp) free_reg(va.reg);
+    if (vb.temp) free_reg(vb.reg);
+    return (Val) {d, true};
+}
+
+Val gen(rasBlock* ctx, Node* n) {
+    switch (n->op) {
+        case OP_CONST:
+        case OP_VAR:
+            return (Val) {n->reg, false};
+        case OP_NEG: {
+            Val a = gen(ctx, n->a);
+            int d = a.temp ? a.reg : alloc_reg();
+            FOP(FNEG, V(d), V(a.reg));
+            return (Val) {d, true};
+        }
+        case OP_ADD:
+            if (n->a->op == OP_MUL) return gen_fma(ctx, n->a, n->b, false);
+            if (n->b->op == OP_MUL) return gen_fma(ctx, n->b, n->a, false);
+            break;
+        case OP_SUB:
+            if (n->b->op == OP_MUL) return gen_fma(ctx, n->b, n->a, true);
+            break;
+    }
+
+    Val a = gen(ctx, n->a);
+    Val b = gen(ctx, n->b);
+    int d = a.temp ? a.reg : b.temp ? b.reg : alloc_reg();
+    rasA64VReg vd = V(d), va = V(a.reg), vb = V(b.reg);
+    switch (n->op) {
+        case OP_ADD:
+            FOP(FADD, vd, va, vb);
+            break;
+        case OP_SUB:
+            FOP(FSUB, vd, va, vb);
+            break;
+        case OP_MUL:
+            FOP(FMUL, vd, va, vb);
+            break;
+        case OP_DIV:
+            FOP(FDIV, vd, va, vb);
+            break;
+        case OP_MIN:
+            FOP(FMIN, vd, va, vb);
+            break;
+        case OP_MAX:
+            FOP(FMAX, vd, va, vb);
+            break;
+    }
+    if (a.temp && a.reg != d) free_reg(a.reg);
+    if (b.temp && b.reg != d) free_reg(b.reg);
+    return (Val) {d, true};
+}
+
+// one iteration of the vector or scalar loop, the input pointers are in
+// R9-R14 and the output pointer in R1
+void gen_iteration(rasBlock* ctx, Node* root) {
+    int step = vec ? 16 : single ? 4 : 8;
+    for (int v = 0; v < MAXVARS; v++) {
+        if (varRegs[v] < 0) continue;
+        rasA64VReg r = V(varRegs[v]);
+        if (vec) {
+            LDRQ(r, (R(9 + v), step, POST));
+        } else if (single) {
+            LDRS(r, (R(9 + v), step, POST));
+        } else {
+            LDRD(r, (R(9 + v), step, POST));
+        }
+    }
+    Val res = gen(ctx, root);
+    if (vec) {
+        STRQ(V(res.reg), (R1, step, POST));
+    } else if (single) {
+        STRS(V(res.reg), (R1, step, POST));
+    } else {
+        STRD(V(res.reg), (R1, step, POST));
+    }
+    if (res.temp) free_reg(res.reg);
+}
+
+typedef void (*exprFunc)(void** in, void* out, size_t n);
+
+rasBlock* compile(Node* root) {
+    rasBlock* ctx = rasCreate(16384);
+    freeRegs = ~0u;
+    usedRegs = 0;
+    nconsts = 0;
+    for (int v = 0; v < MAXVARS; v++) varRegs[v] = -1;
+    collect(root);
+
+    // only the low halves of V8-V15 have to be preserved
+    rasA64Frame frame = {.vregs = 0xff00, .omitFP = true};
+    // the registers used aren't known until the loop is generated so
+    // emit it in a fragment after the prologue
+    uint32_t body = rasCreateFragment(ctx, false);
+    FRAGMENT(body);
+
+    LABEL(lvloop);
+    LABEL(ltail);
+    LABEL(lsloop);
+    LABEL(ldone);
+    load_consts(ctx);
+    for (int v = 0; v < MAXVARS; v++) {
+        if (varRegs[v] >= 0) LDRX(R(9 + v), (R0, v * 8));
+    }
+    int lanes = single ? 4 : 2;
+    LSRX(R3, R2, __builtin_ctz(lanes));
+    CBZX(R3, ltail);
+    L(lvloop);
+    vec = true;
+    gen_iteration(ctx, root);
+    SUBSX(R3, R3, 1);
+    BNE(lvloop);
+    L(ltail);
+    ANDX(R3, R2, lanes - 1);
+    CBZX(R3, ldone);
+    L(lsloop);
+    vec = false;
+    gen_iteration(ctx, root);
+    SUBSX(R3, R3, 1);
+    BNE(lsloop);
+    L(ldone);
+
+    frame.vregs &= usedRegs;
+    EPILOGUE(&frame);
+    RET();
+    emit_pool(ctx);
+
+    FRAGMENT(0);
+    PROLOGUE(&frame);
+
+    rasReady(ctx);
+    return ctx;
+}
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// usage: expr [-f] [-n rows] [expression]
+// variables a-f are columns of random values in [0.5, 2), -f uses floats
+int main(int argc, char** argv) {
+    const char* text = "a * b + c * 1.7 - a / (b + 3)";
+    size_t rows = 1 << 20;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-f")) {
+            single = true;
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            rows = strtoul(argv[++i], NULL, 0);
+        } else {
+            text = argv[i];
+        }
+    }
+
+    src = text;
+    Node* root = parse_expr();
+    skip_space();
+    if (*src) {
+        fprintf(stderr, "unexpected '%s'\n", src);
+        return 1;
+    }
+
+    double t = now();
+    rasBlock* ctx = compile(root);
+    double compileTime = now() - t;
+    exprFunc f = rasGetCode(ctx);
+
+    size_t elem = single ? sizeof(float) : sizeof(double);
+    void* in[MAXVARS];
+    for (int v = 0; v < MAXVARS; v++) {
+        in[v] = malloc(rows * elem);
+        for (size_t i = 0; i < rows; i++) {
+            double x = 0.5 + 1.5 * rand() / ((double) RAND_MAX + 1);
+            if (single) {
+                ((float*) in[v])[i] = x;
+            } else {
+                ((double*) in[v])[i] = x;
+            }
+        }
+    }
+    void* out = malloc(rows * elem);
+    double* ref = malloc(rows * sizeof(double));
+
+    t = now();
+    for (size_t i = 0; i < rows; i++) {
+        double vars[MAXVARS];
+        for (int v = 0; v < MAXVARS; v++) {
+            vars[v] = single ? ((float*) in[v])[i] : ((double*) in[v])[i];
+        }
+        ref[i] = eval(root, vars);
+    }
+    double interpTime = now() - t;
+
+    t = now();
+    f(in, out, rows);
+    double jitTime = now() - t;
+
+    // fused multiply adds round differently
+    double maxErr = 0;
+    for (size_t i = 0; i < rows; i++) {
+        double x = single ? ((float*) out)[i] : ((double*) out)[i];
+        double mag = ref[i] < 0 ? -ref[i] : ref[i];
+        double err = (x > ref[i] ? x - ref[i] : ref[i] - x) / (mag > 1 ? mag : 1);
+        if (err > maxErr) maxErr = err;
+    }
+
+    printf("%s, %zu rows of %s, %zu bytes of code compiled in %.3f ms\n",
+           text, rows, single ? "float" : "double", rasGetSize(ctx),
+           compileTime * 1e3);
+    printf("interpreted: %.3f s, %.1f Mrows/s\n", interpTime,
+           rows / interpTime / 1e6);
+    printf("compiled: %.3f s, %.1f Mrows/s\n", jitTime, rows / jitTime / 1e6);
+    printf("speedup %.2fx, max relative error %g\n", interpTime / jitTime,
+           maxErr);
+
+    rasDestroy(ctx);
+    return maxErr > (single ? 1e-5 : 1e-12);
+}
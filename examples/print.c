@@ -9,9 +9,7 @@ int main() {
     rasBlock* ctx = rasCreate(16384);
 
     PUSH(FP, LR);
-    ADR(R0, LNEW(message));
-    ADRL(IP1, LNEW(printf));
-    BLR(IP1);
+    CALL(LNEW(printf), ARG(LNEW(message)));
     POP(FP, LR);
     RET();
 
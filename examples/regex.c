@@ -0,0 +1,443 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ras/ras_a64.h"
+
+#include <stdbool.h>
+
+// compiles a regex into a dfa and the dfa into code. the count of matches
+// in a buffer is the number of times the dfa reaches an accepting state
+// when it starts again after every match, so it is the same for the code
+// and the table driven version
+//
+// supported syntax: literals, ., [a-z], [^a-z], \x, (), |, *, + and ?
+
+#define MAXNFA 1024
+#define MAXDFA 512
+#define NFAWORDS (MAXNFA / 64)
+
+typedef struct {
+    // bytes that move to next
+    uint64_t bytes[4];
+    int next;
+    // epsilon moves, -1 if unused
+    int eps[2];
+} NfaState;
+
+NfaState nfa[MAXNFA];
+int nnfa;
+int nfaMatch;
+
+typedef struct {
+    int start;
+    int end;
+} Frag;
+
+const char* src;
+
+void fail(const char* msg) {
+    fprintf(stderr, "%s at '%s'\n", msg, src);
+    exit(1);
+}
+
+int new_state() {
+    if (nnfa == MAXNFA) fail("regex is too big");
+    NfaState* s = &nfa[nnfa];
+    memset(s, 0, sizeof *s);
+    s->next = -1;
+    s->eps[0] = s->eps[1] = -1;
+    return nnfa++;
+}
+
+void add_eps(int from, int to) {
+    if (nfa[from].eps[0] < 0) {
+        nfa[from].eps[0] = to;
+    } else {
+        nfa[from].eps[1] = to;
+    }
+}
+
+// a state moving on the bytes in set to a new end state
+Frag byte_frag(const uint64_t* set) {
+    Frag f = {new_state(), new_state()};
+    memcpy(nfa[f.start].bytes, set, sizeof nfa[f.start].bytes);
+    nfa[f.start].next = f.end;
+    return f;
+}
+
+#define SETBIT(set, b) ((set)[(b) >> 6] |= 1ull << ((b) & 63))
+
+Frag parse_alt();
+
+Frag parse_atom() {
+    uint64_t set[4] = {0};
+    char c = *src++;
+    switch (c) {
+        case '(': {
+            Frag f = parse_alt();
+            if (*src++ != ')') fail("expected )");
+            return f;
+        }
+        case '.':
+            memset(set, 0xff, sizeof set);
+            break;
+        case '[': {
+            bool neg = *src == '^';
+            if (neg) src++;
+            do {
+                if (!*src) fail("unterminated class");
+                unsigned char lo = *src++;
+                if (lo == '\\' && *src) lo = *src++;
+                unsigned char hi = lo;
+                if (src[0] == '-' && src[1] && src[1] != ']') {
+                    hi = src[1];
+                    src += 2;
+                }
+                for (int b = lo; b <= hi; b++) SETBIT(set, b);
+            } while (*src != ']');
+            src++;
+            if (neg) {
+                for (int i = 0; i < 4; i++) set[i] = ~set[i];
+            }
+            break;
+        }
+        case '\\':
+            if (!*src) fail("trailing \\");
+            c = *src++;
+            __attribute__((fallthrough));
+        default:
+            SETBIT(set, (unsigned char) c);
+            break;
+    }
+    return byte_frag(set);
+}
+
+Frag parse_repeat() {
+    Frag f = parse_atom();
+    while (*src == '*' || *src == '+' || *src == '?') {
+        char op = *src++;
+        Frag r = {new_state(), new_state()};
+        add_eps(r.start, f.start);
+        if (op != '+') add_eps(r.start, r.end);
+        add_eps(f.end, r.end);
+        if (op != '?') add_eps(f.end, f.start);
+        f = r;
+    }
+    return f;
+}
+
+Frag parse_concat() {
+    int s = new_state();
+    Frag f = {s, s};
+    while (*src && *src != '|' && *src != ')') {
+        if (strchr("*+?", *src)) fail("nothing to repeat");
+        Frag next = parse_repeat();
+        add_eps(f.end, next.start);
+        f.end = next.end;
+    }
+    return f;
+}
+
+Frag parse_alt() {
+    Frag f = parse_concat();
+    while (*src == '|') {
+        src++;
+        Frag b = parse_concat();
+        Frag r = {new_state(), new_state()};
+        add_eps(r.start, f.start);
+        add_eps(r.start, b.start);
+        add_eps(f.end, r.end);
+        add_eps(b.end, r.end);
+        f = r;
+    }
+    return f;
+}
+
+typedef struct {
+    uint64_t set[NFAWORDS];
+} NfaSet;
+
+void closure(NfaSet* s, int state) {
+    if (state < 0 || s->set[state >> 6] & 1ull << (state & 63)) return;
+    s->set[state >> 6] |= 1ull << (state & 63);
+    closure(s, nfa[state].eps[0]);
+    closure(s, nfa[state].eps[1]);
+}
+
+NfaSet dfaSets[MAXDFA];
+int trans[MAXDFA][256];
+bool accept[MAXDFA];
+int ndfa;
+NfaSet startSet;
+
+int dfa_state(NfaSet* s) {
+    for (int i = 0; i < ndfa; i++) {
+        if (!memcmp(&dfaSets[i], s, sizeof *s)) return i;
+    }
+    if (ndfa == MAXDFA) {
+        fprintf(stderr, "too many dfa states\n");
+        exit(1);
+    }
+    dfaSets[ndfa] = *s;
+    accept[ndfa] = s->set[nfaMatch >> 6] & 1ull << (nfaMatch & 63);
+    return ndfa++;
+}
+
+// subset construction, every state includes the start so a match can
+// begin anywhere
+void build_dfa(const char* pattern) {
+    src = pattern;
+    Frag f = parse_alt();
+    if (*src) fail("unexpected");
+    nfaMatch = f.end;
+
+    memset(&startSet, 0, sizeof startSet);
+    closure(&startSet, f.start);
+    dfa_state(&startSet);
+    if (accept[0]) {
+        fprintf(stderr, "regex matches the empty string\n");
+        exit(1);
+    }
+    for (int d = 0; d < ndfa; d++) {
+        for (int c = 0; c < 256; c++) {
+            // accepting states are never left, the search starts again
+            if (accept[d]) {
+                trans[d][c] = 0;
+                continue;
+            }
+            NfaSet next = startSet;
+            for (int s = 0; s < nnfa; s++) {
+                if (!(dfaSets[d].set[s >> 6] & 1ull << (s & 63))) continue;
+                if (nfa[s].bytes[c >> 6] & 1ull << (c & 63))
+                    closure(&next, nfa[s].next);
+            }
+            trans[d][c] = dfa_state(&next);
+        }
+    }
+}
+
+size_t match_table(const unsigned char* p, size_t n) {
+    size_t count = 0;
+    int s = 0;
+    for (size_t i = 0; i < n; i++) {
+        s = trans[s][p[i]];
+        if (accept[s]) {
+            count++;
+            s = 0;
+        }
+    }
+    return count;
+}
+
+// bytes that leave the start state, up to this many get a simd prefilter
+#define MAXPREFILTER 4
+
+typedef size_t (*matchFunc)(const unsigned char* p, size_t n);
+
+// R0: current position
+// R1: end
+// R2: number of matches
+// R3: current byte
+rasBlock* compile() {
+    rasBlock* ctx = rasCreate(65536);
+    rasLabel states[MAXDFA];
+    for (int d = 0; d < ndfa; d++) states[d] = LNEW();
+    LABEL(lmatch);
+    LABEL(ldone);
+
+    ADDX(R1, R0, R1);
+    MOVX(R2, 0);
+
+    int firsts[256];
+    int nfirsts = 0;
+    for (int c = 0; c < 256; c++) {
+        if (trans[0][c] != 0) firsts[nfirsts++] = c;
+    }
+
+    // skips 16 bytes at a time while none of them leave the start state
+    LABEL(lscalar);
+    if (nfirsts <= MAXPREFILTER) {
+        for (int i = 0; i < nfirsts; i++) {
+            MOVW(R4, firsts[i]);
+            DUP16B(V(4 + i), R4);
+        }
+        L(states[0]);
+        SUBX(R4, R1, R0);
+        CMPX(R4, 16);
+        BLO(lscalar);
+        LDRQ(V0, (R0));
+        for (int i = 0; i < nfirsts; i++) {
+            CMEQ16B(i ? V2 : V1, V0, V(4 + i));
+            if (i) ORR16B(V1, V1, V2);
+        }
+        UMAXP16B(V1, V1, V1);
+        UMOVD(R4, V1, 0);
+        CBNZX(R4, lscalar);
+        ADDX(R0, R0, 16);
+        B(states[0]);
+    } else {
+        L(states[0]);
+    }
+
+    for (int d = 0; d < ndfa; d++) {
+        if (accept[d]) continue;
+        if (d == 0) {
+            L(lscalar);
+        } else {
+            L(states[d]);
+        }
+        CMPX(R0, R1);
+        BHS(ldone);
+        LDRB(R3, (R0, 1, POST));
+
+        rasLabel targets[256];
+        int counts[MAXDFA] = {0};
+        for (int c = 0; c < 256; c++) {
+            int t = trans[d][c];
+            targets[c] = accept[t] ? lmatch : states[t];
+            counts[t]++;
+        }
+
+        // ranges of bytes going to the same state, the most common state
+        // is the fallthrough
+        int best = 0;
+        for (int t = 0; t < ndfa; t++) {
+            if (counts[t] > counts[best]) best = t;
+        }
+        rasLabel dflt = accept[best] ? lmatch : states[best];
+        int nranges = 0;
+        for (int c = 0; c < 256; c++) {
+            if (targets[c] != dflt &&
+                (c == 0 || targets[c] != targets[c - 1]))
+                nranges++;
+        }
+
+        // the byte is always in range so the table doesn't need the bounds
+        // check from SWITCH16
+        if (nranges > 8) {
+            LABEL(ltable);
+            ADR(IP0, ltable);
+            LDRSHX(IP1, (IP0, R3, UXTW(1)));
+            ADDX(IP0, IP0, IP1, LSL(2));
+            BR(IP0);
+            L(ltable);
+            for (int c = 0; c < 256; c++) TABLE16(ltable, targets[c]);
+            continue;
+        }
+        for (int c = 0; c < 256;) {
+            int lo = c;
+            while (c < 256 && targets[c] == targets[lo]) c++;
+            if (targets[lo] == dflt) continue;
+            int hi = c - 1;
+            if (lo == hi) {
+                CMPW(R3, lo);
+                BEQ(targets[lo]);
+            } else {
+                SUBW(R4, R3, lo);
+                CMPW(R4, hi - lo);
+                BLS(targets[lo]);
+            }
+        }
+        B(dflt);
+    }
+
+    L(lmatch);
+    ADDX(R2, R2, 1);
+    B(states[0]);
+
+    L(ldone);
+    MOVX(R0, R2);
+    RET();
+
+    rasReady(ctx);
+    return ctx;
+}
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// random lowercase words with some digits, like a log file
+unsigned char* gen_input(size_t n) {
+    static const char* words[] = {"the", "quick", "brown", "fox", "jumps",
+                                  "over", "lazy", "dog", "error", "warning",
+                                  "hello", "world", "foo", "bar", "request"};
+    unsigned char* p = malloc(n);
+    size_t i = 0;
+    while (i < n) {
+        int r = rand();
+        const char* w = words[r % 15];
+        char num[16];
+        if (r % 7 == 0) {
+            snprintf(num, sizeof num, "%d", r % 1000);
+            w = num;
+        }
+        for (; *w && i < n; w++) p[i++] = *w;
+        if (i < n) p[i++] = r % 11 ? ' ' : '\n';
+    }
+    return p;
+}
+
+// usage: regex [-n megabytes] [pattern] [file]
+int main(int argc, char** argv) {
+    const char* pattern = "error [0-9]+|hello world";
+    const char* path = NULL;
+    size_t size = 16 << 20;
+    int arg = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            size = strtoul(argv[++i], NULL, 0) << 20;
+        } else if (arg++ == 0) {
+            pattern = argv[i];
+        } else {
+            path = argv[i];
+        }
+    }
+
+    unsigned char* input;
+    if (path) {
+        FILE* f = fopen(path, "rb");
+        if (!f) {
+            perror(path);
+            return 1;
+        }
+        fseek(f, 0, SEEK_END);
+        size = ftell(f);
+        rewind(f);
+        input = malloc(size);
+        size = fread(input, 1, size, f);
+        fclose(f);
+    } else {
+        input = gen_input(size);
+    }
+
+    double t = now();
+    build_dfa(pattern);
+    rasBlock* ctx = compile();
+    double compileTime = now() - t;
+    matchFunc f = rasGetCode(ctx);
+
+    t = now();
+    size_t tableCount = match_table(input, size);
+    double tableTime = now() - t;
+
+    t = now();
+    size_t codeCount = f(input, size);
+    double codeTime = now() - t;
+
+    printf("%s: %d nfa states, %d dfa states, %zu bytes of code compiled in "
+           "%.3f ms\n",
+           pattern, nnfa, ndfa, rasGetSize(ctx), compileTime * 1e3);
+    printf("table: %zu matches, %.3f s, %.1f MB/s\n", tableCount, tableTime,
+           size / tableTime / (1 << 20));
+    printf("compiled: %zu matches, %.3f s, %.1f MB/s\n", codeCount, codeTime,
+           size / codeTime / (1 << 20));
+    printf("speedup %.2fx\n", tableTime / codeTime);
+
+    rasDestroy(ctx);
+    return tableCount != codeCount;
+}
@@ -1,87 +1,11 @@
-#include "ras.h"
+#include "ras_impl.h"
 
-#include <stdbool.h>
 #include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
 
-#include <sys/mman.h>
+#include <unistd.h>
 
-typedef int8_t s8;
-typedef uint8_t u8;
-typedef int16_t s16;
-typedef uint16_t u16;
-typedef int32_t s32;
-typedef uint32_t u32;
-typedef int64_t s64;
-typedef uint64_t u64;
-
-#define BIT(B) (1ull << (B))
-#define MASK(B) (BIT(B) - 1)
-#define ISNBITSU64(n, B) ((u64) (n) >> (B) == 0)
-#define ISNBITSS64(n, B)                                                       \
-    ((s64) (n) >> ((B) - 1) == 0 || (s64) (n) >> ((B) - 1) == -1)
-#define ISLOWBITS0(n, B) (((n) & MASK(B)) == 0)
-
-typedef enum {
-    SYM_UNDEFINED,
-    SYM_INTERNAL,
-    SYM_EXTERNAL,
-} rasSymbolType;
-
-typedef struct _rasSymbol {
-    rasSymbolType type;
-    union {
-        size_t intOffset;
-        void* extAddr;
-    };
-} rasSymbol;
-
-typedef struct _rasPatch {
-    rasPatchType type;
-    size_t offset;
-    rasLabel sym;
-} rasPatch;
-
-#define LISTNODELEN 64
-
-#define LISTNODE(T)                                                            \
-    struct ListNode_##T {                                                      \
-        T d[LISTNODELEN];                                                      \
-        size_t count;                                                          \
-        struct ListNode_##T* next;                                             \
-    }*
-
-#define LISTNEXT(l)                                                            \
-    ({                                                                         \
-        if (!(l) || (l)->count == LISTNODELEN) {                               \
-            typeof(l) n = malloc(sizeof *n);                                   \
-            n->count = 0;                                                      \
-            n->next = (l);                                                     \
-            (l) = n;                                                           \
-        }                                                                      \
-        &(l)->d[(l)->count++];                                                 \
-    })
-
-#define LISTPOP(l)                                                             \
-    ({                                                                         \
-        typeof(l) tmp = (l)->next;                                             \
-        free(l);                                                               \
-        (l) = tmp;                                                             \
-    })
-
-typedef struct _rasBlock {
-
-    u8* code;
-    u8* curr;
-    size_t size;
-
-    size_t initialSize;
-
-    LISTNODE(rasSymbol) symbols;
-    LISTNODE(rasPatch) patches;
-
-} rasBlock;
+#include <sys/mman.h>
 
 char* rasErrorStrings[RAS_ERR_MAX] = {
     [RAS_OK] = "no error",
@@ -91,12 +15,18 @@ char* rasErrorStrings[RAS_ERR_MAX] = {
     [RAS_ERR_BAD_CONST] = "invalid constant operand (SHIFT, extend, etc)",
     [RAS_ERR_UNDEF_LABEL] = "undefined label",
     [RAS_ERR_BAD_LABEL] = "label out of range or misaligned",
+    [RAS_ERR_UNNAMED_LABEL] = "external label has no name",
+    [RAS_ERR_BAD_FORMAT] = "invalid serialized code",
+    [RAS_ERR_PROFILE_FULL] = "ran out of profile counters",
+    [RAS_ERR_BAD_FRAGMENT] = "invalid fragment",
+    [RAS_ERR_NOT_PIC] = "reference is not position independent",
+    [RAS_ERR_BAD_CODE] = "generated code failed verification",
 };
 
 rasErrorCallback errorCallback = NULL;
 void* errorUserdata = NULL;
 
-static void* jit_alloc(size_t size) {
+static void* jit_alloc(size_t* size, void* userdata) {
 #ifdef RAS_USE_RWX
     int prot = PROT_READ | PROT_WRITE | PROT_EXEC;
 #else
@@ -104,7 +34,7 @@ static void* jit_alloc(size_t size) {
 #endif
     // try to map near the static code
     void* ptr =
-        mmap(rasErrorStrings, size, prot, MAP_PRIVATE | MAP_ANON, -1, 0);
+        mmap(rasErrorStrings, *size, prot, MAP_PRIVATE | MAP_ANON, -1, 0);
     if (ptr == MAP_FAILED) {
         perror("mmap");
         abort();
@@ -112,27 +42,18 @@ static void* jit_alloc(size_t size) {
     return ptr;
 }
 
-enum Perm {
-    RW,
-    RX,
-    RWX,
-};
-
-static void jit_protect(void* code, size_t size, enum Perm perm) {
-    switch (perm) {
-        case RW:
-            mprotect(code, size, PROT_READ | PROT_WRITE);
-            break;
-        case RX:
-            mprotect(code, size, PROT_READ | PROT_EXEC);
-            break;
-        case RWX:
-            mprotect(code, size, PROT_READ | PROT_WRITE | PROT_EXEC);
-            break;
+static void jit_protect(void* code, size_t size, bool exec, void* userdata) {
+#ifndef RAS_USE_RWX
+    // the code would fault on the next write or call
+    if (mprotect(code, size,
+                 exec ? PROT_READ | PROT_EXEC : PROT_READ | PROT_WRITE)) {
+        perror("mprotect");
+        abort();
     }
+#endif
 }
 
-static void jit_free(void* code, size_t size) {
+static void jit_free(void* code, size_t size, void* userdata) {
     munmap(code, size);
 }
 
@@ -140,15 +61,85 @@ static void jit_clearcache(void* code, size_t size) {
     __builtin___clear_cache(code, code + size);
 }
 
+const rasAllocator rasMmapAllocator = {jit_alloc, jit_free, jit_protect};
+
+#define HUGE_PAGE_SIZE (2ull << 20)
+
+// 2MB aligned chunks so the code can be on huge pages, explicit ones if the
+// system has any reserved and transparent ones otherwise
+static void* jit_alloc_huge(size_t* size, void* userdata) {
+#ifdef RAS_USE_RWX
+    int prot = PROT_READ | PROT_WRITE | PROT_EXEC;
+#else
+    int prot = PROT_READ | PROT_WRITE;
+#endif
+    size_t sz = (*size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    *size = sz;
+    void* ptr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    ptr = mmap(NULL, sz, prot, MAP_PRIVATE | MAP_ANON | MAP_HUGETLB, -1, 0);
+#endif
+    if (ptr != MAP_FAILED) return ptr;
+
+    u8* raw = mmap(NULL, sz + HUGE_PAGE_SIZE, prot, MAP_PRIVATE | MAP_ANON, -1,
+                   0);
+    if (raw == MAP_FAILED) {
+        perror("mmap");
+        abort();
+    }
+    u8* aligned =
+        (u8*) (((uintptr_t) raw + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+    if (aligned != raw) munmap(raw, aligned - raw);
+    if (raw + HUGE_PAGE_SIZE != aligned)
+        munmap(aligned + sz, raw + HUGE_PAGE_SIZE - aligned);
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, sz, MADV_HUGEPAGE);
+#endif
+    return aligned;
+}
+
+// hugetlb mappings can only change protection in whole huge pages, and
+// changing part of a transparent huge page splits it
+static void jit_protect_huge(void* code, size_t size, bool exec,
+                             void* userdata) {
+    uintptr_t start = (uintptr_t) code & ~(HUGE_PAGE_SIZE - 1);
+    uintptr_t end = ((uintptr_t) code + size + HUGE_PAGE_SIZE - 1) &
+                    ~(HUGE_PAGE_SIZE - 1);
+    jit_protect((void*) start, end - start, exec, userdata);
+}
+
+const rasAllocator rasHugePageAllocator = {jit_alloc_huge, jit_free,
+                                           jit_protect_huge};
+
+static void* heap_alloc(size_t* size, void* userdata) {
+    return calloc(1, *size);
+}
+
+static void heap_free(void* code, size_t size, void* userdata) {
+    free(code);
+}
+
+static const rasAllocator heapAllocator = {heap_alloc, heap_free};
+
+static void* ras_alloc(rasBlock* ctx, size_t* size) {
+    return ctx->alloc.alloc(size, ctx->alloc.userdata);
+}
+
+static void ras_free(rasBlock* ctx, void* code, size_t size) {
+    if (code != ctx->userBuf) ctx->alloc.free(code, size, ctx->alloc.userdata);
+}
+
 void rasSetErrorCallback(rasErrorCallback cb, void* userdata) {
     errorCallback = cb;
     errorUserdata = userdata;
 }
 
-rasBlock* rasCreate(size_t initialSize) {
-    rasBlock* ctx = calloc(1, sizeof *ctx);
+void rasInitBlock(rasBlock* ctx, size_t initialSize,
+                  const rasAllocator* alloc) {
+    memset(ctx, 0, sizeof *ctx);
 
-    ctx->code = jit_alloc(initialSize);
+    ctx->alloc = *alloc;
+    ctx->code = ras_alloc(ctx, &initialSize);
     ctx->curr = ctx->code;
     ctx->size = initialSize;
 
@@ -156,25 +147,93 @@ rasBlock* rasCreate(size_t initialSize) {
 
     ctx->symbols = NULL;
     ctx->patches = NULL;
+}
 
+rasBlock* rasCreateWithAllocator(size_t initialSize,
+                                 const rasAllocator* alloc) {
+    rasBlock* ctx = malloc(sizeof *ctx);
+    rasInitBlock(ctx, initialSize, alloc);
     return ctx;
 }
 
-void rasDestroy(rasBlock* ctx) {
-    jit_free(ctx->code, ctx->size);
+rasBlock* rasCreate(size_t initialSize) {
+    return rasCreateWithAllocator(initialSize, &rasMmapAllocator);
+}
+
+rasBlock* rasCreateInRegion(void* buf, size_t size) {
+    rasBlock* ctx = calloc(1, sizeof *ctx);
+
+    // fragments still need memory of their own
+    ctx->alloc = rasMmapAllocator;
+    ctx->userBuf = buf;
+    ctx->code = buf;
+    ctx->curr = ctx->code;
+    ctx->size = size;
+    ctx->initialSize = size;
+
+    return ctx;
+}
+
+rasBlock* rasCreateNoExec(void* buf, size_t size, uintptr_t vbase) {
+    rasBlock* ctx = buf ? rasCreateInRegion(buf, size)
+                        : rasCreateWithAllocator(size, &heapAllocator);
+
+    ctx->alloc = heapAllocator;
+    ctx->noExec = true;
+    ctx->vbase = vbase;
 
+    return ctx;
+}
+
+void rasReleaseBlock(rasBlock* ctx) {
+    ras_free(ctx, ctx->code, ctx->size);
+
+    while (ctx->symbols) {
+        for (int i = 0; i < ctx->symbols->count; i++) {
+            free(ctx->symbols->d[i].name);
+        }
+        LISTPOP(ctx->symbols);
+    }
+    while (ctx->patches) LISTPOP(ctx->patches);
+    for (u32 i = 0; i < ctx->nfrags; i++) {
+        if (i == ctx->frag) continue;
+        ras_free(ctx, ctx->frags[i].code, ctx->frags[i].size);
+    }
+    free(ctx->frags);
+    free(ctx->fragOrder);
+    free(ctx->peephole);
+    if (ctx->profile) {
+        munmap(ctx->profile->counters, ctx->profile->maxCounters * sizeof(u64));
+        free(ctx->profile->labels);
+        free(ctx->profile->pages);
+        free(ctx->profile);
+    }
+    if (ctx->got) {
+        free(ctx->got->entries);
+        free(ctx->got);
+    }
+    if (ctx->tmpl) rasDestroyTemplate(ctx->tmpl);
+}
+
+void rasDestroy(rasBlock* ctx) {
+    rasReleaseBlock(ctx);
     free(ctx);
 }
 
 rasLabel rasDeclareLabel(rasBlock* ctx) {
     rasSymbol* l = LISTNEXT(ctx->symbols);
     l->type = SYM_UNDEFINED;
+    l->frag = 0;
+    l->name = NULL;
     return l;
 }
 
 rasLabel rasDefineLabel(rasBlock* ctx, rasLabel l) {
     l->type = SYM_INTERNAL;
     l->intOffset = ctx->curr - ctx->code;
+    l->frag = ctx->frag;
+    ctx->barrier = l->intOffset;
+    RAS_COUNT(ctx, labels, 1);
     return l;
 }
 
@@ -184,10 +243,24 @@ rasLabel rasDefineLabelExternal(rasLabel l, void* addr) {
     return l;
 }
 
+rasLabel rasNameLabel(rasLabel l, const char* name) {
+    free(l->name);
+    l->name = name ? strdup(name) : NULL;
+    return l;
+}
+
+const char* rasGetLabelName(rasLabel l) {
+    return l->name;
+}
+
+static u8* ras_frag_code(rasBlock* ctx, u32 frag) {
+    return frag == ctx->frag ? ctx->code : ctx->frags[frag].code;
+}
+
 void* rasGetLabelAddr(rasBlock* ctx, rasLabel l) {
     switch (l->type) {
         case SYM_INTERNAL:
-            return ctx->code + l->intOffset;
+            return ras_frag_code(ctx, l->frag) + l->intOffset;
         case SYM_EXTERNAL:
             return l->extAddr;
         case SYM_UNDEFINED:
@@ -196,25 +269,44 @@ void* rasGetLabelAddr(rasBlock* ctx, rasLabel l) {
     }
 }
 
+uintptr_t rasGetBaseAddr(rasBlock* ctx) {
+    return ctx->vbase ? ctx->vbase : (uintptr_t) ctx->code;
+}
+
+void rasSetBaseAddr(rasBlock* ctx, uintptr_t vbase) {
+    ctx->vbase = vbase;
+    // patches depend on the address
+    ctx->appliedPatches = 0;
+}
+
+uintptr_t rasGetLabelRunAddr(rasBlock* ctx, rasLabel l) {
+    if (l->type == SYM_INTERNAL && ctx->vbase)
+        return ctx->vbase + l->intOffset;
+    return (uintptr_t) rasGetLabelAddr(ctx, l);
+}
+
 void rasAddPatch(rasBlock* ctx, rasPatchType type, rasLabel l) {
     rasPatch* p = LISTNEXT(ctx->patches);
     p->type = type;
+    p->frag = ctx->frag;
     p->offset = ctx->curr - ctx->code;
+    p->tbl = 0;
+    p->veneer = false;
     p->sym = l;
+    ctx->npatches++;
+    RAS_COUNT(ctx, patches[type], 1);
 }
 
-void rasApplyPatch(rasBlock* ctx, rasPatch p) {
-    void* patchaddr = ctx->code + p.offset;
-    void* symaddr = rasGetLabelAddr(ctx, p.sym);
-    rasAssert(symaddr != NULL, RAS_ERR_UNDEF_LABEL);
-
-    ptrdiff_t reladdr = symaddr - patchaddr;
+void rasPatchAt(void* patchaddr, uintptr_t pc, uintptr_t symaddr,
+                rasPatchType type) {
+    ptrdiff_t reladdr = symaddr - pc;
 
     u32* patchinst = patchaddr;
 
-    switch (p.type) {
+    // clear the field first so patches can be reapplied after moving code
+    switch (type) {
         case RAS_PATCH_ABS64: {
-            *(void**) patchaddr = symaddr;
+            *(u64*) patchaddr = symaddr;
             break;
         }
         case RAS_PATCH_REL26: {
@@ -222,17 +314,19 @@ void rasApplyPatch(rasBlock* ctx, rasPatch p) {
             reladdr >>= 2;
             rasAssert(ISNBITSS64(reladdr, 26), RAS_ERR_BAD_LABEL);
             reladdr &= MASK(26);
-            *patchinst |= reladdr;
+            *patchinst = (*patchinst & ~MASK(26)) | reladdr;
             break;
         }
         case RAS_PATCH_PGREL21:
-            reladdr = ((size_t) symaddr >> 12) - ((size_t) patchaddr >> 12);
+            reladdr = (symaddr >> 12) - (pc >> 12);
             __attribute__((fallthrough));
         case RAS_PATCH_REL19:
         case RAS_PATCH_REL21: {
-            if (p.type == RAS_PATCH_REL19) {
+            *patchinst &= ~(MASK(19) << 5);
+            if (type == RAS_PATCH_REL19) {
                 rasAssert(ISLOWBITS0(reladdr, 2), RAS_ERR_BAD_LABEL);
             } else {
+                *patchinst &= ~(MASK(2) << 29);
                 *patchinst |= (reladdr & MASK(2)) << 29;
             }
             reladdr >>= 2;
@@ -246,38 +340,234 @@ void rasApplyPatch(rasBlock* ctx, rasPatch p) {
             reladdr >>= 2;
             rasAssert(ISNBITSS64(reladdr, 14), RAS_ERR_BAD_LABEL);
             reladdr &= MASK(14);
-            *patchinst |= reladdr << 5;
+            *patchinst = (*patchinst & ~(MASK(14) << 5)) | reladdr << 5;
             break;
         }
         case RAS_PATCH_PGOFF12: {
-            *patchinst |= ((uintptr_t) symaddr & MASK(12)) << 10;
+            *patchinst &= ~(MASK(12) << 10);
+            *patchinst |= (symaddr & MASK(12)) << 10;
+            break;
+        }
+        // pc is the start of the table for these
+        case RAS_PATCH_TBL32: {
+            rasAssert(ISNBITSS64(reladdr, 32), RAS_ERR_BAD_LABEL);
+            *(s32*) patchaddr = reladdr;
             break;
         }
+        case RAS_PATCH_TBL16: {
+            rasAssert(ISLOWBITS0(reladdr, 2), RAS_ERR_BAD_LABEL);
+            reladdr >>= 2;
+            rasAssert(ISNBITSS64(reladdr, 16), RAS_ERR_BAD_LABEL);
+            *(s16*) patchaddr = reladdr;
+            break;
+        }
+        case RAS_PATCH_TBL8: {
+            rasAssert(ISLOWBITS0(reladdr, 2), RAS_ERR_BAD_LABEL);
+            reladdr >>= 2;
+            rasAssert(ISNBITSS64(reladdr, 8), RAS_ERR_BAD_LABEL);
+            *(s8*) patchaddr = reladdr;
+            break;
+        }
+        default:
+            break;
     }
 }
 
+void rasApplyPatch(rasBlock* ctx, rasPatch p) {
+    void* patchaddr = ras_frag_code(ctx, p.frag) + p.offset;
+    uintptr_t pc = ctx->vbase ? ctx->vbase + p.offset : (uintptr_t) patchaddr;
+    uintptr_t symaddr = rasGetLabelRunAddr(ctx, p.sym);
+    rasAssert(symaddr != 0, RAS_ERR_UNDEF_LABEL);
+    // jump tables can only point into the block
+    rasAssert(p.type < RAS_PATCH_TBL32 || p.sym->type == SYM_INTERNAL,
+              RAS_ERR_BAD_LABEL);
+    pc -= p.tbl;
+
+    rasPatchAt(patchaddr, pc, symaddr, p.type);
+}
+
+// patches are kept after being applied so the code can be relocated later
 void rasApplyAllPatches(rasBlock* ctx) {
-    while (ctx->patches) {
-        for (int i = 0; i < ctx->patches->count; i++) {
-            rasApplyPatch(ctx, ctx->patches->d[i]);
+    size_t todo = ctx->npatches - ctx->appliedPatches;
+    for (typeof(ctx->patches) n = ctx->patches; n && todo; n = n->next) {
+        for (int i = n->count - 1; i >= 0 && todo; i--, todo--) {
+            rasApplyPatch(ctx, n->d[i]);
         }
-        LISTPOP(ctx->patches);
     }
+    ctx->appliedPatches = ctx->npatches;
+}
+
+u32 rasCreateFragment(rasBlock* ctx, bool cold) {
+    if (!ctx->frags) {
+        // the code emitted so far is fragment 0
+        ctx->frags = calloc(1, sizeof *ctx->frags);
+        ctx->frags[0].align = 4;
+        ctx->nfrags = 1;
+    }
+    ctx->frags = realloc(ctx->frags, (ctx->nfrags + 1) * sizeof *ctx->frags);
+    rasFragmentBuf* f = &ctx->frags[ctx->nfrags];
+    f->size = ctx->initialSize;
+    f->code = ras_alloc(ctx, &f->size);
+    f->curr = f->code;
+    f->align = 4;
+    f->cold = cold;
+    return ctx->nfrags++;
+}
+
+u32 rasSwitchFragment(rasBlock* ctx, u32 frag) {
+    u32 prev = ctx->frag;
+    rasAssert(frag < (ctx->nfrags ? ctx->nfrags : 1), RAS_ERR_BAD_FRAGMENT);
+    if (frag == prev || frag >= ctx->nfrags) return prev;
+    rasFragmentBuf* old = &ctx->frags[prev];
+    old->code = ctx->code;
+    old->curr = ctx->curr;
+    old->size = ctx->size;
+    rasFragmentBuf* f = &ctx->frags[frag];
+    ctx->code = f->code;
+    ctx->curr = f->curr;
+    ctx->size = f->size;
+    ctx->frag = frag;
+    ctx->barrier = ctx->curr - ctx->code;
+    return prev;
+}
+
+void rasOrderFragments(rasBlock* ctx, const u32* order, size_t count) {
+    free(ctx->fragOrder);
+    ctx->fragOrder = malloc((count ? count : 1) * sizeof *order);
+    memcpy(ctx->fragOrder, order, count * sizeof *order);
+    ctx->nfragOrder = count;
+}
+
+// hot fragments in the requested order then creation order, followed by
+// the cold ones starting on a new page
+void rasMergeFragments(rasBlock* ctx) {
+    rasEmitGot(ctx);
+    if (!ctx->frags) return;
+    rasSwitchFragment(ctx, 0);
+    ctx->frags[0].code = ctx->code;
+    ctx->frags[0].curr = ctx->curr;
+    ctx->frags[0].size = ctx->size;
+
+    u32 n = ctx->nfrags;
+    u32* seq = malloc((ctx->nfragOrder + n) * sizeof *seq);
+    memcpy(seq, ctx->fragOrder, ctx->nfragOrder * sizeof *seq);
+    for (u32 i = 0; i < n; i++) seq[ctx->nfragOrder + i] = i;
+    size_t* base = malloc(n * sizeof *base);
+    bool* placed = calloc(n, sizeof *placed);
+
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    size_t total = 0;
+    for (int cold = 0; cold < 2; cold++) {
+        bool first = true;
+        for (u32 i = 0; i < ctx->nfragOrder + n; i++) {
+            u32 fi = seq[i];
+            if (fi >= n || placed[fi] || ctx->frags[fi].cold != cold) continue;
+            rasFragmentBuf* f = &ctx->frags[fi];
+            size_t align = cold && first ? pagesize : f->align;
+            if (total) total = (total + align - 1) & ~(align - 1);
+            first = false;
+            base[fi] = total;
+            total += f->curr - f->code;
+            placed[fi] = true;
+        }
+    }
+
+    size_t size = (total + pagesize - 1) & ~(pagesize - 1);
+    if (size < ctx->frags[0].size) size = ctx->frags[0].size;
+    if (!size) size = pagesize;
+    u8* code = ras_alloc(ctx, &size);
+    for (u32 i = 0; i < n; i++) {
+        rasFragmentBuf* f = &ctx->frags[i];
+        memcpy(code + base[i], f->code, f->curr - f->code);
+        ras_free(ctx, f->code, f->size);
+    }
+    if (ctx->userBuf) {
+        // the merged code goes back into the caller's buffer
+        rasAssert(total <= ctx->frags[0].size, RAS_ERR_CODE_SIZE);
+        if (total > ctx->frags[0].size) total = ctx->frags[0].size;
+        memcpy(ctx->userBuf, code, total);
+        ras_free(ctx, code, size);
+        code = ctx->userBuf;
+        size = ctx->frags[0].size;
+    }
+
+    for (typeof(ctx->symbols) l = ctx->symbols; l; l = l->next) {
+        for (int i = 0; i < l->count; i++) {
+            rasSymbol* s = &l->d[i];
+            if (s->type == SYM_INTERNAL) s->intOffset += base[s->frag];
+            s->frag = 0;
+        }
+    }
+    for (typeof(ctx->patches) l = ctx->patches; l; l = l->next) {
+        for (int i = 0; i < l->count; i++) {
+            l->d[i].offset += base[l->d[i].frag];
+            l->d[i].frag = 0;
+        }
+    }
+    // everything has moved so every patch is applied again
+    ctx->appliedPatches = 0;
+
+    ctx->code = code;
+    ctx->curr = code + total;
+    ctx->size = size;
+    ctx->barrier = total;
+    free(ctx->frags);
+    free(ctx->fragOrder);
+    ctx->frags = NULL;
+    ctx->fragOrder = NULL;
+    ctx->nfrags = 0;
+    ctx->nfragOrder = 0;
+    free(seq);
+    free(base);
+    free(placed);
+}
+
+void rasDetachCode(rasBlock* ctx) {
+    if (ctx->noExec) return;
+    size_t used = ctx->curr - ctx->code;
+    size_t size = used ? used : 1;
+    u8* code = heap_alloc(&size, NULL);
+    memcpy(code, ctx->code, used);
+    ras_free(ctx, ctx->code, ctx->size);
+    ctx->alloc = heapAllocator;
+    ctx->userBuf = NULL;
+    ctx->noExec = true;
+    ctx->code = code;
+    ctx->curr = code + used;
+    ctx->size = size;
 }
 
 void rasReady(rasBlock* ctx) {
+    rasMergeFragments(ctx);
     rasApplyAllPatches(ctx);
-
-#ifndef RAS_USE_RWX
-    jit_protect(ctx->code, ctx->size, RX);
+#ifdef RAS_VERIFY
+    // not rasAssert, this has to work with RAS_NO_CHECKS too
+    if (rasVerifyA64(ctx, stderr)) rasAssertFail(RAS_ERR_BAD_CODE);
 #endif
+    if (ctx->noExec) return;
+
+    if (ctx->alloc.protect)
+        ctx->alloc.protect(ctx->code, ctx->size, true, ctx->alloc.userdata);
     jit_clearcache(ctx->code, ctx->size);
 }
 
 void rasUnready(rasBlock* ctx) {
-#ifndef RAS_USE_RWX
-    jit_protect(ctx->code, ctx->size, RW);
-#endif
+    if (ctx->noExec || !ctx->alloc.protect) return;
+    ctx->alloc.protect(ctx->code, ctx->size, false, ctx->alloc.userdata);
+}
+
+void rasProtectRange(rasBlock* ctx, size_t offset, size_t size, bool exec) {
+    if (ctx->noExec) return;
+    if (ctx->alloc.protect) {
+        size_t pagesize = sysconf(_SC_PAGESIZE);
+        size_t start = offset & ~(pagesize - 1);
+        size_t end = (offset + size + pagesize - 1) & ~(pagesize - 1);
+        if (end > ctx->size) end = ctx->size;
+        ctx->alloc.protect(ctx->code + start, end - start, exec,
+                           ctx->alloc.userdata);
+    }
+    // rwx memory still needs the flush
+    if (exec) jit_clearcache(ctx->code + offset, size);
 }
 
 void* rasGetCode(rasBlock* ctx) {
@@ -288,29 +578,43 @@ size_t rasGetSize(rasBlock* ctx) {
     return ctx->curr - ctx->code;
 }
 
-void rasAssert(bool condition, rasError err) {
-    if (!condition) {
-        if (errorCallback) {
-            errorCallback(err, errorUserdata);
-        } else {
-            fprintf(stderr, "ras error: %s\n", rasErrorStrings[err]);
-            abort();
-        }
+void rasAssertFail(rasError err) {
+    if (errorCallback) {
+        errorCallback(err, errorUserdata);
+    } else {
+        fprintf(stderr, "ras error: %s\n", rasErrorStrings[err]);
+        abort();
     }
 }
 
 #ifdef RAS_AUTOGROW
 static void ras_grow(rasBlock* ctx) {
+    // the caller's buffer can't grow
+    rasAssert(!ctx->userBuf, RAS_ERR_CODE_SIZE);
+    if (ctx->userBuf) return;
     u8* oldCode = ctx->code;
+    u8* oldCurr = ctx->curr;
     size_t oldSize = ctx->size;
     ctx->size *= 2;
-    ctx->code = jit_alloc(ctx->size);
-    ctx->curr = ctx->code + oldSize;
+    ctx->code = ras_alloc(ctx, &ctx->size);
+    // rasReserve can grow before the buffer is full
+    ctx->curr = ctx->code + (oldCurr - oldCode);
     memcpy(ctx->code, oldCode, oldSize);
-    jit_free(oldCode, oldSize);
+    ras_free(ctx, oldCode, oldSize);
+    RAS_COUNT(ctx, grows, 1);
 }
 #endif
 
+bool rasReserve(rasBlock* ctx, size_t n) {
+#ifdef RAS_AUTOGROW
+    while (ctx->curr + n > ctx->code + ctx->size && !ctx->userBuf)
+        ras_grow(ctx);
+#endif
+    bool fits = ctx->curr + n <= ctx->code + ctx->size;
+    rasAssert(fits, RAS_ERR_CODE_SIZE);
+    return fits;
+}
+
 void rasEmit8(rasBlock* ctx, u8 b) {
     #ifdef RAS_AUTOGROW
         if (ctx->curr == ctx->code + ctx->size) ras_grow(ctx);
@@ -318,6 +622,8 @@ void rasEmit8(rasBlock* ctx, u8 b) {
         rasAssert(ctx->curr != ctx->code + ctx->size, RAS_ERR_CODE_SIZE);
     #endif
         *ctx->curr++ = b;
+        ctx->barrier = ctx->curr - ctx->code;
+        RAS_COUNT(ctx, dataBytes, 1);
 }
 
 void rasEmit16(rasBlock* ctx, u16 h) {
@@ -325,7 +631,7 @@ void rasEmit16(rasBlock* ctx, u16 h) {
     rasEmit8(ctx, h >> 8);
 }
 
-void rasEmit32(rasBlock* ctx, u32 w) {
+static void ras_emit32(rasBlock* ctx, u32 w) {
 #ifdef RAS_AUTOGROW
     if (ctx->curr + 4 > ctx->code + ctx->size) ras_grow(ctx);
 #else
@@ -335,9 +641,60 @@ void rasEmit32(rasBlock* ctx, u32 w) {
     ctx->curr += 4;
 }
 
+#ifdef RAS_STATS
+// indexed by op0 (bits 25-28)
+static const u8 instClasses[16] = {
+    RAS_CLASS_OTHER, RAS_CLASS_OTHER, RAS_CLASS_OTHER,  RAS_CLASS_OTHER,
+    RAS_CLASS_LDST,  RAS_CLASS_DPREG, RAS_CLASS_LDST,   RAS_CLASS_FPSIMD,
+    RAS_CLASS_DPIMM, RAS_CLASS_DPIMM, RAS_CLASS_BRANCH, RAS_CLASS_BRANCH,
+    RAS_CLASS_LDST,  RAS_CLASS_DPREG, RAS_CLASS_LDST,   RAS_CLASS_FPSIMD,
+};
+#endif
+
+void rasEmit32(rasBlock* ctx, u32 w) {
+    ras_emit32(ctx, w);
+    RAS_COUNT(ctx, insts, 1);
+    RAS_COUNT(ctx, classes[instClasses[w >> 25 & 15]], 1);
+    if (ctx->emitHook) ctx->emitHook(ctx);
+}
+
 void rasEmit64(rasBlock* ctx, u64 d) {
-    rasEmit32(ctx, d);
-    rasEmit32(ctx, d >> 32);
+    ras_emit32(ctx, d);
+    ras_emit32(ctx, d >> 32);
+    ctx->barrier = ctx->curr - ctx->code;
+    RAS_COUNT(ctx, dataBytes, 8);
+}
+
+void rasEmitWord(rasBlock* ctx, u32 w) {
+    ras_emit32(ctx, w);
+    ctx->barrier = ctx->curr - ctx->code;
+    RAS_COUNT(ctx, dataBytes, 4);
+}
+
+void rasEmitTableEntry(rasBlock* ctx, rasPatchType type, rasLabel base,
+                       rasLabel l) {
+    bool valid = base->type == SYM_INTERNAL && base->frag == ctx->frag;
+    rasAssert(valid, RAS_ERR_BAD_LABEL);
+    rasAddPatch(ctx, type, l);
+    if (valid) {
+        ctx->patches->d[ctx->patches->count - 1].tbl =
+            ctx->curr - ctx->code - base->intOffset;
+    }
+    switch (type) {
+        case RAS_PATCH_TBL32:
+            rasEmit16(ctx, 0);
+            rasEmit16(ctx, 0);
+            break;
+        case RAS_PATCH_TBL16:
+            rasEmit16(ctx, 0);
+            break;
+        case RAS_PATCH_TBL8:
+            rasEmit8(ctx, 0);
+            break;
+        default:
+            rasAssert(false, RAS_ERR_BAD_CONST);
+            break;
+    }
 }
 
 void rasAlign(rasBlock* ctx, size_t alignment) {
@@ -350,4 +707,61 @@ void rasAlign(rasBlock* ctx, size_t alignment) {
     size_t cur = ctx->curr - ctx->code;
     size_t aligned = (cur + (alignment - 1)) & ~(alignment - 1);
     ctx->curr += aligned - cur;
+    ctx->barrier = aligned;
+    if (ctx->maxAlign < alignment) ctx->maxAlign = alignment;
+    if (ctx->frags && ctx->frags[ctx->frag].align < alignment)
+        ctx->frags[ctx->frag].align = alignment;
+    if (ctx->tmpl) rasTemplateAlign(ctx, alignment);
+    RAS_COUNT(ctx, alignBytes, aligned - cur);
+}
+
+rasStats rasGetStats(rasBlock* ctx) {
+    return ctx->stats;
+}
+
+void rasResetStats(rasBlock* ctx) {
+    ctx->stats = (rasStats) {};
+}
+
+#ifdef RAS_STATS
+static const char* classNames[RAS_CLASS_MAX] = {
+    [RAS_CLASS_OTHER] = "other",
+    [RAS_CLASS_DPIMM] = "data processing imm",
+    [RAS_CLASS_BRANCH] = "branch/system",
+    [RAS_CLASS_LDST] = "load/store",
+    [RAS_CLASS_DPREG] = "data processing reg",
+    [RAS_CLASS_FPSIMD] = "fp/simd",
+};
+
+static const char* patchNames[RAS_PATCH_MAX] = {
+    [RAS_PATCH_ABS64] = "abs64",     [RAS_PATCH_REL26] = "rel26",
+    [RAS_PATCH_REL19] = "rel19",     [RAS_PATCH_REL14] = "rel14",
+    [RAS_PATCH_REL21] = "rel21",     [RAS_PATCH_PGREL21] = "pgrel21",
+    [RAS_PATCH_PGOFF12] = "pgoff12", [RAS_PATCH_TBL32] = "tbl32",
+    [RAS_PATCH_TBL16] = "tbl16",     [RAS_PATCH_TBL8] = "tbl8",
+};
+#endif
+
+void rasDumpStats(rasBlock* ctx, FILE* f) {
+#ifndef RAS_STATS
+    fprintf(f, "ras stats: not enabled (build with RAS_STATS)\n");
+#else
+    rasStats* s = &ctx->stats;
+    fprintf(f, "ras stats:\n");
+    fprintf(f, "  instructions: %zu\n", s->insts);
+    for (int i = 0; i < RAS_CLASS_MAX; i++) {
+        if (s->classes[i])
+            fprintf(f, "    %s: %zu\n", classNames[i], s->classes[i]);
+    }
+    fprintf(f, "  data bytes: %zu\n", s->dataBytes);
+    fprintf(f, "  alignment bytes: %zu\n", s->alignBytes);
+    fprintf(f, "  labels: %zu\n", s->labels);
+    for (int i = 0; i < RAS_PATCH_MAX; i++) {
+        if (s->patches[i])
+            fprintf(f, "  %s patches: %zu\n", patchNames[i], s->patches[i]);
+    }
+    fprintf(f, "  add/sub imm via rtmp: %zu\n", s->addSubTmp);
+    fprintf(f, "  logical imm via rtmp: %zu\n", s->logicalTmp);
+    fprintf(f, "  grows: %zu\n", s->grows);
+#endif
 }
@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #define bool _Bool
 #define u8 uint8_t
@@ -23,6 +24,12 @@ typedef enum {
     RAS_ERR_BAD_CONST,
     RAS_ERR_UNDEF_LABEL,
     RAS_ERR_BAD_LABEL,
+    RAS_ERR_UNNAMED_LABEL,
+    RAS_ERR_BAD_FORMAT,
+    RAS_ERR_PROFILE_FULL,
+    RAS_ERR_BAD_FRAGMENT,
+    RAS_ERR_NOT_PIC,
+    RAS_ERR_BAD_CODE,
 
     RAS_ERR_MAX
 } rasError;
@@ -36,15 +43,74 @@ typedef enum {
     RAS_PATCH_REL21,
     RAS_PATCH_PGREL21,
     RAS_PATCH_PGOFF12,
+    // jump table entries holding the offset of the label from the start of
+    // the table, 16 and 8 bit entries are divided by 4
+    RAS_PATCH_TBL32,
+    RAS_PATCH_TBL16,
+    RAS_PATCH_TBL8,
+
+    RAS_PATCH_MAX
 } rasPatchType;
 
+// top level encoding groups
+typedef enum {
+    RAS_CLASS_OTHER,
+    RAS_CLASS_DPIMM,
+    RAS_CLASS_BRANCH,
+    RAS_CLASS_LDST,
+    RAS_CLASS_DPREG,
+    RAS_CLASS_FPSIMD,
+
+    RAS_CLASS_MAX
+} rasInstClass;
+
+// only counted when the implementation is built with RAS_STATS
+typedef struct {
+    // every word written with rasEmit32 including ones the peephole pass
+    // removes later
+    size_t insts;
+    size_t classes[RAS_CLASS_MAX];
+    size_t dataBytes;
+    size_t alignBytes;
+    size_t labels;
+    size_t patches[RAS_PATCH_MAX];
+    // pseudo instructions that had to load the immediate into rtmp
+    size_t addSubTmp;
+    size_t logicalTmp;
+    size_t grows;
+} rasStats;
+
 extern char* rasErrorStrings[];
 
 typedef void (*rasErrorCallback)(rasError, void*);
 
 void rasSetErrorCallback(rasErrorCallback cb, void* userdata);
 
+// memory for code. alloc can round the size up, protect switches between
+// executable and writable and can be NULL for rwx memory
+typedef struct {
+    void* (*alloc)(size_t* size, void* userdata);
+    void (*free)(void* code, size_t size, void* userdata);
+    void (*protect)(void* code, size_t size, bool exec, void* userdata);
+    void* userdata;
+} rasAllocator;
+
+// mmap near the static code, used by rasCreate
+extern const rasAllocator rasMmapAllocator;
+// 2MB aligned memory on huge pages to reduce itlb misses for large code.
+// protect works on whole 2MB pages, so writing to a code or stub cache
+// makes the rest of the huge page writable too
+extern const rasAllocator rasHugePageAllocator;
+
 rasBlock* rasCreate(size_t initialSize);
+rasBlock* rasCreateWithAllocator(size_t initialSize,
+                                 const rasAllocator* alloc);
+// buf has to be page aligned and mapped executable, it is not freed
+rasBlock* rasCreateInRegion(void* buf, size_t size);
+// for code that is not run on this machine. the code is written to buf, or
+// heap memory when it is NULL, and patches are computed as if it was at
+// vbase. rasReady only applies the patches
+rasBlock* rasCreateNoExec(void* buf, size_t size, uintptr_t vbase);
 void rasDestroy(rasBlock* ctx);
 
 void rasReady(rasBlock* ctx);
@@ -52,12 +118,23 @@ void rasUnready(rasBlock* ctx);
 void* rasGetCode(rasBlock* ctx);
 size_t rasGetSize(rasBlock* ctx);
 
-void rasAssert(bool condition, rasError err);
+void rasAssertFail(rasError err);
+// inline so checks on constants cost nothing
+static inline void rasAssert(bool condition, rasError err) {
+#ifndef RAS_NO_CHECKS
+    if (__builtin_expect(!condition, 0)) rasAssertFail(err);
+#endif
+}
 
 rasLabel rasDeclareLabel(rasBlock* ctx);
 rasLabel rasDefineLabel(rasBlock* ctx, rasLabel l);
 rasLabel rasDefineLabelExternal(rasLabel l, void* addr);
 void* rasGetLabelAddr(rasBlock* ctx, rasLabel l);
+// the address the code runs at, which is rasGetCode unless a base was set
+uintptr_t rasGetBaseAddr(rasBlock* ctx);
+void rasSetBaseAddr(rasBlock* ctx, uintptr_t vbase);
+rasLabel rasNameLabel(rasLabel l, const char* name);
+const char* rasGetLabelName(rasLabel l);
 
 void rasAddPatch(rasBlock* ctx, rasPatchType type, rasLabel l);
 
@@ -65,14 +142,149 @@ void rasEmit8(rasBlock* ctx, u8 b);
 void rasEmit16(rasBlock* ctx, u16 h);
 void rasEmit32(rasBlock* ctx, u32 w);
 void rasEmit64(rasBlock* ctx, u64 d);
+// a data word, rasEmit32 is for instructions and runs the peephole pass
+void rasEmitWord(rasBlock* ctx, u32 w);
 
 static inline void rasEmitAbsAddr(rasBlock* ctx, rasLabel l) {
     rasAddPatch(ctx, RAS_PATCH_ABS64, l);
     rasEmit64(ctx, 0);
 }
 
+// emits a jump table entry, base is the start of the table and has to be
+// defined before it in the same fragment
+void rasEmitTableEntry(rasBlock* ctx, rasPatchType type, rasLabel base,
+                       rasLabel l);
+
 void rasAlign(rasBlock* ctx, size_t alignment);
 
+// fragments are separate streams of code that are concatenated when the
+// block is made ready, fragment 0 is the code emitted before any are created
+u32 rasCreateFragment(rasBlock* ctx, bool cold);
+// returns the previous fragment
+u32 rasSwitchFragment(rasBlock* ctx, u32 frag);
+// hot fragments not in the order follow in creation order, cold fragments
+// always go after the hot ones
+void rasOrderFragments(rasBlock* ctx, const u32* order, size_t count);
+void rasMergeFragments(rasBlock* ctx);
+
+rasStats rasGetStats(rasBlock* ctx);
+void rasResetStats(rasBlock* ctx);
+void rasDumpStats(rasBlock* ctx, FILE* f);
+
+// resolves the name of an external label when loading code, dlsym is used
+// when no resolver is given
+typedef void* (*rasResolver)(const char* name, void* userdata);
+
+// serializes the code and the patches that depend on its address or on
+// external labels, returns the size needed which may be more than size
+size_t rasSerialize(rasBlock* ctx, void* buf, size_t size);
+// returns NULL if the data is invalid or an external label can't be resolved
+rasBlock* rasDeserialize(const void* buf, size_t size, rasResolver resolve,
+                         void* userdata);
+bool rasSaveFile(rasBlock* ctx, const char* path);
+rasBlock* rasLoadFile(const char* path, rasResolver resolve, void* userdata);
+
+typedef struct _rasBlockPool rasBlockPool;
+
+// many small blocks sharing pages. blocks from rasPoolGet have blockSize
+// bytes for code, blocks that grow past it get their own pages. rasPoolPut
+// keeps the block and its memory for the next rasPoolGet. pages are only
+// executable while none of the blocks on them are being written (between
+// rasPoolGet or rasUnready and rasReady), unless RAS_USE_RWX is used
+rasBlockPool* rasCreateBlockPool(size_t blockSize);
+// blocks from the pool have to be put back or destroyed first
+void rasDestroyBlockPool(rasBlockPool* pool);
+rasBlock* rasPoolGet(rasBlockPool* pool);
+void rasPoolPut(rasBlockPool* pool, rasBlock* ctx);
+
+typedef struct _rasStubCache rasStubCache;
+
+typedef struct {
+    size_t lookups;
+    size_t hits;
+    size_t bytesSaved;
+} rasStubCacheStats;
+
+// small pieces of code that are generated many times can be shared through a
+// stub cache, which keeps one copy of each in its own block. stubs start at
+// the largest alignment they passed to rasAlign. the cache is not thread
+// safe, but interning only makes the pages the new stub is on writable
+rasStubCache* rasCreateStubCache(size_t size);
+void rasDestroyStubCache(rasStubCache* cache);
+// returns the address of a stub with the same code and patches as stub,
+// copying it into the cache if there isn't one, or NULL if the cache is full.
+// labels used by stub have to be defined in it or external
+void* rasInternStub(rasStubCache* cache, rasBlock* stub);
+rasStubCacheStats rasGetStubCacheStats(rasStubCache* cache);
+
+typedef struct _rasTemplate rasTemplate;
+
+// fields of an instruction or data that a template leaves open
+typedef enum {
+    // bits 0-4, also Rt
+    RAS_HOLE_RD,
+    // bits 5-9
+    RAS_HOLE_RN,
+    // bits 10-14, also Rt2
+    RAS_HOLE_RA,
+    // bits 16-20
+    RAS_HOLE_RM,
+    // bits 10-21, add/sub and scaled load/store offsets
+    RAS_HOLE_IMM12,
+    // bits 5-20, movz/movn/movk
+    RAS_HOLE_IMM16,
+    // a whole data word or doubleword
+    RAS_HOLE_DATA32,
+    RAS_HOLE_DATA64,
+
+    RAS_HOLE_MAX
+} rasHoleType;
+
+// a sequence of code assembled once and copied with its holes filled in.
+// code emitted to ctx after rasBeginTemplate is recorded until
+// rasEndTemplate, which removes it from ctx again, so ctx should be a scratch
+// block without the peephole pass. copies are aligned to the largest
+// alignment passed to rasAlign in the template, which has to start aligned
+void rasBeginTemplate(rasBlock* ctx);
+// makes a field of the last instruction (or the last data for the data
+// holes) argument arg of the template
+void rasTemplateHole(rasBlock* ctx, rasHoleType type, u32 arg);
+// l is label argument arg, it has to be left undefined. other labels have to
+// be defined in the template or external
+void rasTemplateLabel(rasBlock* ctx, rasLabel l, u32 arg);
+rasTemplate* rasEndTemplate(rasBlock* ctx);
+void rasDestroyTemplate(rasTemplate* t);
+// copies the template to ctx, args[i] is written to the holes for argument i
+// and labels[i] is used for label argument i
+void rasEmitTemplate(rasBlock* ctx, const rasTemplate* t, const u64* args,
+                     const rasLabel* labels);
+
+typedef struct _rasCodeCache rasCodeCache;
+
+// a region holding many functions which can be freed separately and moved
+// together to reuse the space. functions start at the largest alignment
+// they passed to rasAlign. the cache is not thread safe, but adding or
+// repatching a function only makes the pages it is on writable, so other
+// threads can keep running functions on other pages. the allocator's
+// protect has to accept any range of pages
+rasCodeCache* rasCreateCodeCache(size_t size, const rasAllocator* alloc);
+void rasDestroyCodeCache(rasCodeCache* cache);
+// copies the code of fn into the cache and takes ownership of the block,
+// which is kept to patch the code again when it moves. its code is moved to
+// the heap, so blocks from rasCreate don't keep their own mapping. slot is
+// set to the address of the code whenever it changes. returns NULL if there
+// is no space, fn still belongs to the caller then
+void* rasCacheAdd(rasCodeCache* cache, rasBlock* fn, void** slot);
+void rasCacheFree(rasCodeCache* cache, void* code);
+// applies the patches of a function in the cache again, after external
+// labels it uses were redefined
+void rasCacheRepatch(rasCodeCache* cache, void* code);
+// bytes used by freed functions that compaction would reclaim
+size_t rasGetCodeCacheFree(rasCodeCache* cache);
+// moves the live functions together and releases the pages after them,
+// returns the number of bytes released. no code in the cache can be running
+size_t rasCompactCodeCache(rasCodeCache* cache);
+
 #undef bool
 #undef u8
 #undef u16
@@ -1,22 +1,5 @@
 #include "ras_a64.h"
-
-#include <stdbool.h>
-
-typedef int8_t s8;
-typedef uint8_t u8;
-typedef int16_t s16;
-typedef uint16_t u16;
-typedef int32_t s32;
-typedef uint32_t u32;
-typedef int64_t s64;
-typedef uint64_t u64;
-
-#define BIT(B) (1ull << (B))
-#define MASK(B) (BIT(B) - 1)
-#define ISNBITSU64(n, B) ((u64) (n) >> (B) == 0)
-#define ISNBITSS64(n, B)                                                       \
-    ((s64) (n) >> ((B) - 1) == 0 || (s64) (n) >> ((B) - 1) == -1)
-#define ISLOWBITS0(n, B) (((n) & MASK(B)) == 0)
+#include "ras_impl.h"
 
 bool rasGenerateLogicalImm(u64 imm, u32 sf, u32* immr, u32* imms, u32* n) {
     if (!imm || !~imm) return false;
@@ -98,8 +81,9 @@ bool rasGenerateFPImm(float fimm, u8* imm8) {
     return 1;
 }
 
-void rasEmitPseudoAddSubImm(rasBlock* ctx, u32 sf, u32 op, u32 s, rasA64Reg rd,
-                            rasA64Reg rn, u64 imm, rasA64Reg rtmp) {
+void rasEmitPseudoAddSubImmSlow(rasBlock* ctx, u32 sf, u32 op, u32 s,
+                                rasA64Reg rd, rasA64Reg rn, u64 imm,
+                                rasA64Reg rtmp) {
     if (!sf) imm = (s32) imm;
     if (ISNBITSU64(imm, 12)) {
         ADDSUB(sf, op, s, rd, rn, imm);
@@ -113,6 +97,7 @@ void rasEmitPseudoAddSubImm(rasBlock* ctx, u32 sf, u32 op, u32 s, rasA64Reg rd,
             ADDSUB(sf, !op, s, rd, rn, imm >> 12, LSL(12));
         } else {
             imm = -imm;
+            RAS_COUNT(ctx, addSubTmp, 1);
             if (sf) {
                 MOVX(rtmp, imm);
             } else {
@@ -129,6 +114,7 @@ void rasEmitPseudoLogicalImm(rasBlock* ctx, u32 sf, u32 opc, rasA64Reg rd,
     if (rasGenerateLogicalImm(imm, sf, &immr, &imms, &n)) {
         LOGICAL(sf, opc, 0, rd, rn, imm);
     } else {
+        RAS_COUNT(ctx, logicalTmp, 1);
         if (sf) {
             MOVX(rtmp, imm);
         } else {
@@ -138,7 +124,7 @@ void rasEmitPseudoLogicalImm(rasBlock* ctx, u32 sf, u32 opc, rasA64Reg rd,
     }
 }
 
-void rasEmitPseudoMovImm(rasBlock* ctx, u32 sf, rasA64Reg rd, u64 imm) {
+void rasEmitPseudoMovImmSlow(rasBlock* ctx, u32 sf, rasA64Reg rd, u64 imm) {
     if (imm == 0) {
         if (sf) {
             MOVZX(rd, 0);
@@ -258,3 +244,247 @@ void rasEmitPseudoPCRelAddrLong(rasBlock* ctx, rasA64Reg rd, rasLabel lab) {
     rasAddPatch(ctx, RAS_PATCH_PGOFF12, lab);
     ADDX(rd, rd, 0);
 }
+
+typedef struct {
+    u32 vr;
+    u32 r1, r2;
+    bool pair;
+    s32 off;
+} FrameSlot;
+
+static int ras_frame_slots(rasA64Frame* f, FrameSlot* slots) {
+    int n = 0;
+    u32 gprs = f->gprs & MASK(31);
+    if (!f->omitFP) {
+        slots[n++] = (FrameSlot) {0, 29, 30, true};
+        gprs &= ~(BIT(29) | BIT(30));
+    }
+    for (int vr = 0; vr < 2; vr++) {
+        u32 regs = vr ? f->vregs : gprs;
+        int prev = -1;
+        for (int i = 0; i < 32; i++) {
+            if (!(regs & BIT(i))) continue;
+            if (prev < 0) {
+                prev = i;
+            } else {
+                slots[n++] = (FrameSlot) {vr, prev, i, true};
+                prev = -1;
+            }
+        }
+        if (prev >= 0) slots[n++] = (FrameSlot) {vr, prev, 0, false};
+    }
+    s32 off = 0;
+    for (int i = 0; i < n; i++) {
+        slots[i].off = off;
+        off += slots[i].pair ? 16 : 8;
+    }
+    return n;
+}
+
+void rasLayoutFrame(rasA64Frame* f) {
+    FrameSlot slots[64];
+    int n = ras_frame_slots(f, slots);
+    for (int i = 0; i < 32; i++) {
+        f->gprOffset[i] = -1;
+        f->vregOffset[i] = -1;
+    }
+    u32 saveSize = 0;
+    for (int i = 0; i < n; i++) {
+        s16* offs = slots[i].vr ? f->vregOffset : f->gprOffset;
+        offs[slots[i].r1] = slots[i].off;
+        if (slots[i].pair) offs[slots[i].r2] = slots[i].off + 8;
+        saveSize = slots[i].off + (slots[i].pair ? 16 : 8);
+    }
+    f->localOffset = (saveSize + 15) & ~15;
+    f->frameSize = (f->localOffset + f->localSize + 15) & ~15;
+}
+
+// mod: 2 offset, 3 pre index, 1 post index
+static void ras_frame_slot(rasBlock* ctx, FrameSlot* s, u32 load, u32 mod,
+                           s32 off) {
+    rasA64Reg r1 = {s->r1};
+    rasA64Reg r2 = {s->r2};
+    if (s->pair) {
+        rasEmitLoadStorePair(ctx, s->vr ? 1 : 2, s->vr, mod, load, off, r2, SP,
+                             r1);
+    } else {
+        rasEmitLoadStoreImmOff(ctx, 3, s->vr, load, off, mod == 2 ? 0 : mod,
+                               SP, r1);
+    }
+}
+
+void rasEmitPseudoPrologue(rasBlock* ctx, rasA64Frame* f) {
+    FrameSlot slots[64];
+    int n = ras_frame_slots(f, slots);
+    rasLayoutFrame(f);
+    if (!f->frameSize) return;
+
+    // fold the stack adjustment into the first store when it fits
+    int first = 0;
+    if (n && f->frameSize <= (slots[0].pair ? 504 : 256)) {
+        ras_frame_slot(ctx, &slots[0], 0, 3, -f->frameSize);
+        first = 1;
+    } else {
+        SUBX(SP, SP, f->frameSize, IP0);
+    }
+    for (int i = first; i < n; i++) {
+        ras_frame_slot(ctx, &slots[i], 0, 2, slots[i].off);
+    }
+    if (!f->omitFP) MOVX(FP, SP);
+}
+
+void rasEmitPseudoEpilogue(rasBlock* ctx, rasA64Frame* f) {
+    FrameSlot slots[64];
+    int n = ras_frame_slots(f, slots);
+    rasLayoutFrame(f);
+    if (!f->frameSize) return;
+
+    int last = 0;
+    if (n && f->frameSize <= (slots[0].pair ? 504 : 255)) last = 1;
+    for (int i = n - 1; i >= last; i--) {
+        ras_frame_slot(ctx, &slots[i], 1, 2, slots[i].off);
+    }
+    if (last) {
+        ras_frame_slot(ctx, &slots[0], 1, 1, f->frameSize);
+    } else {
+        ADDX(SP, SP, f->frameSize, IP0);
+    }
+}
+
+static void ras_call_moves(rasBlock* ctx, u32 nargs, rasA64Arg* args) {
+    int src[8];
+    u32 srcUsed = 0;
+    for (int i = 0; i < nargs; i++) {
+        src[i] = -1;
+        if (args[i].type == RAS_ARG_REG && !(args[i].reg.idx == 31)) {
+            src[i] = args[i].reg.idx;
+            srcUsed |= BIT(src[i]);
+            if (src[i] == i) src[i] = -1;
+        }
+    }
+    // any scratch register that is not an argument works for cycles
+    static const int tmps[] = {16, 17, 9, 10, 11, 12, 13, 14, 15};
+    int tmp = -1;
+    for (int i = 0; i < sizeof tmps / sizeof tmps[0] && tmp < 0; i++) {
+        if (!(srcUsed & BIT(tmps[i]))) tmp = tmps[i];
+    }
+
+    // sequentialize the parallel register moves, each cycle costs a
+    // single extra move through tmp
+    for (;;) {
+        int pending = 0;
+        bool progress = false;
+        for (int i = 0; i < nargs; i++) {
+            if (src[i] < 0) continue;
+            pending++;
+            bool blocked = false;
+            for (int j = 0; j < nargs; j++) {
+                if (j != i && src[j] == i) blocked = true;
+            }
+            if (blocked) continue;
+            MOVX(R(i), R(src[i]));
+            src[i] = -1;
+            progress = true;
+        }
+        if (!pending) break;
+        if (progress) continue;
+        for (int i = 0; i < nargs; i++) {
+            if (src[i] < 0) continue;
+            MOVX(R(tmp), R(i));
+            for (int j = 0; j < nargs; j++) {
+                if (src[j] == i) src[j] = tmp;
+            }
+            break;
+        }
+    }
+
+    for (int i = 0; i < nargs; i++) {
+        switch (args[i].type) {
+            case RAS_ARG_REG:
+                if (args[i].reg.idx == 31) {
+                    if (args[i].reg.isSp) {
+                        MOVX(R(i), SP);
+                    } else {
+                        MOVX(R(i), 0);
+                    }
+                }
+                break;
+            case RAS_ARG_IMM:
+                MOVX(R(i), args[i].imm);
+                break;
+            case RAS_ARG_STACK:
+                LDRX(R(i), (SP, args[i].spOffset));
+                break;
+            case RAS_ARG_LABEL:
+                ADRL(R(i), args[i].label);
+                break;
+        }
+    }
+}
+
+void rasEmitPseudoCall(rasBlock* ctx, rasLabel target, u32 nargs,
+                       rasA64Arg* args, bool tail, rasA64Frame* frame) {
+    rasAssert(nargs <= 8, RAS_ERR_BAD_CONST);
+    ras_call_moves(ctx, nargs, args);
+    if (tail && frame) EPILOGUE(frame);
+
+    if (target->type != SYM_EXTERNAL) {
+        // labels in the block are always in range. a label that isn't
+        // defined yet is sent through a veneer when the block is merged if
+        // it becomes external
+        if (tail) {
+            B(target);
+        } else {
+            BL(target);
+        }
+        ctx->patches->d[ctx->patches->count - 1].veneer = true;
+        return;
+    }
+
+    // whether an external label is in range of the code depends on where the
+    // code ends up (code cache, rasDeserialize, RAS_AUTOGROW), so the address
+    // comes from a table entry, an ABS64 patch that is redone wherever the
+    // code goes and is a relocation in serialized code and objects
+    LDRLX(IP1, rasGotLabel(ctx, target));
+    if (tail) {
+        BR(IP1);
+    } else {
+        BLR(IP1);
+    }
+}
+
+void rasEmitPseudoSwitch(rasBlock* ctx, rasPatchType type, rasA64Reg idx,
+                         rasLabel ldefault, u32 n, rasLabel* targets) {
+    // IP0 holds the table address before idx is read and IP1 is the
+    // scratch for large n
+    bool scratch = idx.idx == IP0.idx || idx.idx == IP1.idx;
+    rasAssert(!scratch, RAS_ERR_BAD_CONST);
+    if (scratch) return;
+    LABEL(ltable);
+    CMPW(idx, n, IP1);
+    BHS(ldefault);
+    ADR(IP0, ltable);
+    switch (type) {
+        case RAS_PATCH_TBL32:
+            LDRSW(IP1, (IP0, idx, UXTW(2)));
+            ADDX(IP0, IP0, IP1);
+            break;
+        case RAS_PATCH_TBL16:
+            LDRSHX(IP1, (IP0, idx, UXTW(1)));
+            ADDX(IP0, IP0, IP1, LSL(2));
+            break;
+        case RAS_PATCH_TBL8:
+            LDRSBX(IP1, (IP0, idx, UXTW()));
+            ADDX(IP0, IP0, IP1, LSL(2));
+            break;
+        default:
+            rasAssert(false, RAS_ERR_BAD_CONST);
+            return;
+    }
+    BR(IP0);
+    L(ltable);
+    for (u32 i = 0; i < n; i++) {
+        rasEmitTableEntry(ctx, type, ltable, targets[i]);
+    }
+    ALIGN(4);
+}
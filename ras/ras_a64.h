@@ -3,9 +3,12 @@
 
 #include "ras.h"
 
+#include <stdio.h>
+
 #define bool _Bool
 #define u8 uint8_t
 #define u16 uint16_t
+#define s16 int16_t
 #define u32 uint32_t
 #define s32 int32_t
 #define u64 uint64_t
@@ -256,6 +259,16 @@ __RAS_EMIT_DECL(LoadStorePair, u32 opc, u32 vr, u32 mod, u32 l, s32 imm,
                          0x28000000);
 }
 
+__RAS_EMIT_DECL(AtomicMemOp, u32 size, u32 a, u32 r, rasA64Reg rs, u32 o3,
+                u32 opc, u32 off, rasA64Reg rn, rasA64Reg rt) {
+    RAS_CHECKR31(rs, 0);
+    RAS_CHECKR31(rn, 1);
+    RAS_CHECKR31(rt, 0);
+    rasAssert(off == 0, RAS_ERR_BAD_IMM);
+    rasEmit32(ctx, rt.idx | rn.idx << 5 | opc << 12 | o3 << 15 | rs.idx << 16 |
+                         r << 22 | a << 23 | size << 30 | 0x38200000);
+}
+
 __RAS_EMIT_DECL(BranchUncondImm, u32 op, rasLabel lab) {
     rasAddPatch(ctx, RAS_PATCH_REL26, lab);
     rasEmit32(ctx, op << 31 | 0x14000000);
@@ -383,19 +396,225 @@ __RAS_EMIT_DECL(AdvSIMDModImmFloat, u32 q, u32 op, u32 cmode, u32 o2,
 #undef RAS_ISLOWBITS0
 #undef RAS_CHECKR31
 
-void rasEmitPseudoAddSubImm(rasBlock* ctx, u32 sf, u32 op, u32 s, rasA64Reg rd,
-                            rasA64Reg rn, u64 imm, rasA64Reg rtmp);
+void rasEmitPseudoAddSubImmSlow(rasBlock* ctx, u32 sf, u32 op, u32 s,
+                                rasA64Reg rd, rasA64Reg rn, u64 imm,
+                                rasA64Reg rtmp);
 void rasEmitPseudoLogicalImm(rasBlock* ctx, u32 sf, u32 opc, rasA64Reg rd,
                              rasA64Reg rn, u64 imm, rasA64Reg rtmp);
-void rasEmitPseudoMovImm(rasBlock* ctx, u32 sf, rasA64Reg rd, u64 imm);
+void rasEmitPseudoMovImmSlow(rasBlock* ctx, u32 sf, rasA64Reg rd, u64 imm);
+
+// immediates known at compile time that fit in one instruction are encoded
+// inline so the compiler can fold the whole instruction into a constant,
+// anything else picks the encoding at runtime. both give the same encoding
+
+static inline bool rasFoldAddSubImm(rasBlock* ctx, u32 sf, u32 op, u32 s,
+                                    rasA64Reg rd, rasA64Reg rn, u64 imm) {
+    if (!sf) imm = (s32) imm;
+    for (u32 neg = 0; neg < 2; neg++, imm = -imm) {
+        if (imm >> 12 == 0) {
+            rasEmitAddSubImm(ctx, sf, op ^ neg, s, (rasA64Shift) {0}, imm, rn,
+                             rd);
+            return 1;
+        }
+        if (imm >> 24 == 0 && (imm & 0xfff) == 0) {
+            rasEmitAddSubImm(ctx, sf, op ^ neg, s, (rasA64Shift) {12},
+                             imm >> 12, rn, rd);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static inline void rasEmitPseudoAddSubImm(rasBlock* ctx, u32 sf, u32 op, u32 s,
+                                          rasA64Reg rd, rasA64Reg rn, u64 imm,
+                                          rasA64Reg rtmp) {
+    if (__builtin_constant_p(imm) &&
+        rasFoldAddSubImm(ctx, sf, op, s, rd, rn, imm))
+        return;
+    rasEmitPseudoAddSubImmSlow(ctx, sf, op, s, rd, rn, imm, rtmp);
+}
+
+// a value with one halfword that isn't 0 (or 0xffff for MOVN) is a logical
+// immediate, which MOV prefers, only if its ones are contiguous. then the
+// element size is the register size and the ORR fields follow from the run
+static inline bool rasFoldMovImm(rasBlock* ctx, u32 sf, rasA64Reg rd,
+                                 u64 imm) {
+    u64 mask = sf ? ~0ull : ~0u;
+    if (imm == 0 || imm == mask || imm == ~0ull) {
+        rasEmitMoveWide(ctx, sf, imm ? 0 : 2, (rasA64Shift) {0}, 0, rd);
+        return 1;
+    }
+    u64 v = imm & mask;
+    if (!sf && imm >> 32 && imm >> 32 != ~0u) return 0;
+    if (v == 0 || v == mask) return 0;
+    for (u32 neg = 0; neg < 2; neg++, v ^= mask) {
+        for (u32 i = 0; i < (sf ? 4 : 2); i++) {
+            if (v & ~(0xffffull << 16 * i)) continue;
+            u32 start = __builtin_ctzll(v);
+            u64 run = v >> start;
+            if (run & (run + 1)) {
+                rasEmitMoveWide(ctx, sf, neg ? 0 : 2, (rasA64Shift) {16 * i},
+                                v >> 16 * i, rd);
+                return 1;
+            }
+            u32 size = sf ? 64 : 32;
+            u32 len = __builtin_popcountll(v);
+            if (neg) {
+                start = (start + len) % size;
+                len = size - len;
+            }
+            rasAssert(rd.idx != 31 || rd.isSp, RAS_ERR_BAD_R31);
+            rasEmit32(ctx, rd.idx | 31 << 5 | (len - 1) << 10 |
+                               (size - start) % size << 16 | sf << 22 |
+                               1 << 29 | sf << 31 | 0x12000000);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static inline void rasEmitPseudoMovImm(rasBlock* ctx, u32 sf, rasA64Reg rd,
+                                       u64 imm) {
+    if (__builtin_constant_p(imm) && rasFoldMovImm(ctx, sf, rd, imm)) return;
+    rasEmitPseudoMovImmSlow(ctx, sf, rd, imm);
+}
 void rasEmitPseudoMovReg(rasBlock* ctx, u32 sf, rasA64Reg rd, rasA64Reg rm);
 void rasEmitPseudoShiftImm(rasBlock* ctx, u32 sf, u32 type, rasA64Reg rd,
                            rasA64Reg rn, u32 imm);
 void rasEmitPseudoPCRelAddrLong(rasBlock* ctx, rasA64Reg rd, rasLabel lab);
 
+typedef struct {
+    // callee saved registers to save, bit n is Rn/Vn
+    // only the low 64 bits of vector registers are saved
+    u32 gprs;
+    u32 vregs;
+    u32 localSize;
+    // don't create a frame record (FP, LR) for leaf functions
+    bool omitFP;
+
+    // layout filled in by rasLayoutFrame, offsets are from SP after the
+    // prologue and -1 for registers that are not saved
+    u32 frameSize;
+    u32 localOffset;
+    s16 gprOffset[32];
+    s16 vregOffset[32];
+} rasA64Frame;
+
+void rasLayoutFrame(rasA64Frame* f);
+void rasEmitPseudoPrologue(rasBlock* ctx, rasA64Frame* f);
+void rasEmitPseudoEpilogue(rasBlock* ctx, rasA64Frame* f);
+
+typedef enum {
+    RAS_ARG_REG,
+    RAS_ARG_IMM,
+    RAS_ARG_STACK,
+    RAS_ARG_LABEL,
+} rasA64ArgType;
+
+typedef struct {
+    rasA64ArgType type;
+    union {
+        rasA64Reg reg;
+        u64 imm;
+        s32 spOffset;
+        rasLabel label;
+    };
+} rasA64Arg;
+
+void rasEmitPseudoCall(rasBlock* ctx, rasLabel target, u32 nargs,
+                       rasA64Arg* args, bool tail, rasA64Frame* frame);
+
+// branches to targets[idx] through a table of type entries following the
+// code, or ldefault if idx (a 32 bit unsigned value) is out of range.
+// clobbers IP0 and IP1, so idx can't be either of them
+void rasEmitPseudoSwitch(rasBlock* ctx, rasPatchType type, rasA64Reg idx,
+                         rasLabel ldefault, u32 n, rasLabel* targets);
+
+typedef enum {
+    // redundant loads and stores to the same address
+    RAS_PEEPHOLE_MEM = 1,
+    // overwritten or self movs and repeated zero extensions
+    RAS_PEEPHOLE_MOV = 2,
+    // cmp/tst + b.cond to cbz/tbz, flags must be dead after the branch
+    RAS_PEEPHOLE_BRANCH = 4,
+    // add + ldr to a single ldr with the add folded into the address
+    RAS_PEEPHOLE_ADDR = 8,
+    RAS_PEEPHOLE_ALL = 15,
+} rasPeepholeFlags;
+
+typedef struct {
+    size_t removed;
+    size_t mem;
+    size_t mov;
+    size_t branch;
+    size_t addr;
+} rasPeepholeStats;
+
+void rasEnablePeephole(rasBlock* ctx, u32 flags);
+rasPeepholeStats rasGetPeepholeStats(rasBlock* ctx);
+
+typedef enum {
+    // use lse STADD so counts are exact when the code runs on several threads
+    RAS_PROFILE_ATOMIC = 1,
+} rasProfileFlags;
+
+typedef struct {
+    rasLabel label;
+    u64 count;
+} rasProfileEntry;
+
+// labels defined with rasDefineLabelProfiled get code that increments a
+// counter each time it runs, tmp1 and tmp2 are clobbered by it. the
+// counters are reached through unnamed external labels, so a profiled
+// block can't be serialized or written as an elf object
+void rasEnableProfiling(rasBlock* ctx, size_t maxCounters, rasA64Reg tmp1,
+                        rasA64Reg tmp2, u32 flags);
+rasLabel rasDefineLabelProfiled(rasBlock* ctx, rasLabel l);
+u64 rasGetProfileCount(rasBlock* ctx, rasLabel l);
+// entries are sorted by count, returns the number of profiled labels
+size_t rasGetProfile(rasBlock* ctx, rasProfileEntry* entries, size_t max);
+void rasResetProfile(rasBlock* ctx);
+void rasDumpProfile(rasBlock* ctx, FILE* f);
+
+// in a pic block the code only refers to itself with pc relative
+// addresses and external labels are reached through a table at the end of
+// the block, so the code can be copied to any page aligned address and only
+// the table needs to be rewritten. branches to external labels go through
+// a veneer using IP1, other references to them (including literal loads
+// from them, use LDRGOT) have to use rasGotLabel
+void rasEnablePIC(rasBlock* ctx);
+// the table entry holding the address of an external label, this can be
+// used in any block
+rasLabel rasGotLabel(rasBlock* ctx, rasLabel ext);
+// rewrites the table in a copy of the code with addresses from resolve or
+// the ones the labels have now if it is NULL
+void rasWriteGot(rasBlock* ctx, void* code, rasResolver resolve,
+                 void* userdata);
+
+// writes an elf relocatable object with the code in .text, named labels
+// become global symbols and patches to external labels become relocations
+// returns the size needed which may be more than size
+size_t rasWriteElf(rasBlock* ctx, void* buf, size_t size);
+bool rasSaveElf(rasBlock* ctx, const char* path);
+
+// writes the instruction in the macro syntax, branch targets are printed
+// as addresses relative to pc. returns false and writes a WORD if the
+// instruction is not one that ras can emit
+bool rasDisasmA64(u32 inst, u64 pc, char* buf, size_t size);
+void rasDumpA64(rasBlock* ctx, FILE* f);
+
+// checks a ready block without trusting the encoders. code is followed from
+// the start, named labels and jump table entries, and every instruction
+// reached has to be one ras can emit, branches and pc relative addresses
+// have to stay in the block or go to external labels, the code can't run
+// off the end and SP has to stay 16 byte aligned when it is moved by a
+// constant. problems are printed to f unless it is NULL, returns how many
+size_t rasVerifyA64(rasBlock* ctx, FILE* f);
+
 #undef bool
 #undef u8
 #undef u16
+#undef s16
 #undef u32
 #undef s32
 #undef u64
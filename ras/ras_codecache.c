@@ -0,0 +1,178 @@
+#include "ras_impl.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+typedef struct {
+    rasBlock* fn;
+    size_t offset;
+    size_t size;
+    size_t align;
+    void** slot;
+} rasCacheEntry;
+
+struct _rasCodeCache {
+    rasBlock* block;
+    // sorted by offset, freed functions have no block until compaction
+    rasCacheEntry* entries;
+    size_t count;
+    size_t capacity;
+    size_t freeBytes;
+};
+
+#define FUNC_ALIGN 16
+
+// functions start at FUNC_ALIGN or at the largest alignment they asked for,
+// counted from the address so it works for any alignment of the cache
+static size_t ras_cache_offset(rasCodeCache* cache, size_t end, size_t align) {
+    uintptr_t base = (uintptr_t) cache->block->code;
+    return ((base + end + align - 1) & ~(uintptr_t) (align - 1)) - base;
+}
+
+rasCodeCache* rasCreateCodeCache(size_t size, const rasAllocator* alloc) {
+    rasCodeCache* cache = calloc(1, sizeof *cache);
+    cache->block = rasCreateWithAllocator(size, alloc ? alloc : &rasMmapAllocator);
+    return cache;
+}
+
+void rasDestroyCodeCache(rasCodeCache* cache) {
+    for (size_t i = 0; i < cache->count; i++) {
+        if (cache->entries[i].fn) rasDestroy(cache->entries[i].fn);
+    }
+    free(cache->entries);
+    rasDestroy(cache->block);
+    free(cache);
+}
+
+// patches the function for the address it will run at and copies it there
+static void ras_cache_place(rasCodeCache* cache, rasCacheEntry* e) {
+    u8* dst = cache->block->code + e->offset;
+    rasSetBaseAddr(e->fn, (uintptr_t) dst);
+    rasReady(e->fn);
+    memmove(dst, e->fn->code, e->size);
+    if (e->slot) *e->slot = dst;
+}
+
+void* rasCacheAdd(rasCodeCache* cache, rasBlock* fn, void** slot) {
+    rasBlock* ctx = cache->block;
+    rasMergeFragments(fn);
+    // the block is only needed for its labels and patches, keeping its
+    // mapping would cost a page per function and changing its protection
+    // every time it is placed
+    rasDetachCode(fn);
+    size_t size = fn->curr - fn->code;
+    size_t align = fn->maxAlign > FUNC_ALIGN ? fn->maxAlign : FUNC_ALIGN;
+    size_t offset = ras_cache_offset(cache, ctx->curr - ctx->code, align);
+    if (offset + size > ctx->size) return NULL;
+
+    if (cache->count == cache->capacity) {
+        cache->capacity = cache->capacity ? cache->capacity * 2 : 64;
+        cache->entries =
+            realloc(cache->entries, cache->capacity * sizeof *cache->entries);
+    }
+    rasCacheEntry* e = &cache->entries[cache->count++];
+    *e = (rasCacheEntry) {fn, offset, size, align, slot};
+
+    rasProtectRange(ctx, offset, size, false);
+    ras_cache_place(cache, e);
+    ctx->curr = ctx->code + offset + size;
+    rasProtectRange(ctx, offset, size, true);
+    return ctx->code + offset;
+}
+
+static rasCacheEntry* ras_cache_find(rasCodeCache* cache, uintptr_t addr) {
+    uintptr_t base = (uintptr_t) cache->block->code;
+    size_t lo = 0, hi = cache->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        rasCacheEntry* e = &cache->entries[mid];
+        if (addr < base + e->offset) {
+            hi = mid;
+        } else if (addr >= base + e->offset + e->size) {
+            lo = mid + 1;
+        } else {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+void rasCacheFree(rasCodeCache* cache, void* code) {
+    rasCacheEntry* e = ras_cache_find(cache, (uintptr_t) code);
+    if (!e || !e->fn) return;
+    rasDestroy(e->fn);
+    e->fn = NULL;
+    cache->freeBytes += e->size;
+}
+
+void rasCacheRepatch(rasCodeCache* cache, void* code) {
+    rasCacheEntry* e = ras_cache_find(cache, (uintptr_t) code);
+    if (!e || !e->fn) return;
+    rasProtectRange(cache->block, e->offset, e->size, false);
+    ras_cache_place(cache, e);
+    rasProtectRange(cache->block, e->offset, e->size, true);
+}
+
+size_t rasCompactCodeCache(rasCodeCache* cache) {
+    rasBlock* ctx = cache->block;
+    uintptr_t base = (uintptr_t) ctx->code;
+    size_t oldEnd = ctx->curr - ctx->code;
+
+    size_t live = 0;
+    size_t* newOffsets =
+        malloc((cache->count ? cache->count : 1) * sizeof *newOffsets);
+    size_t end = 0;
+    for (size_t i = 0; i < cache->count; i++) {
+        if (!cache->entries[i].fn) continue;
+        end = ras_cache_offset(cache, end, cache->entries[i].align);
+        newOffsets[i] = end;
+        end += cache->entries[i].size;
+    }
+
+    // references between functions in the cache are external labels which
+    // have to follow the functions they point to
+    for (size_t i = 0; i < cache->count; i++) {
+        rasBlock* fn = cache->entries[i].fn;
+        if (!fn) continue;
+        for (typeof(fn->symbols) n = fn->symbols; n; n = n->next) {
+            for (int j = 0; j < n->count; j++) {
+                rasLabel l = &n->d[j];
+                if (l->type != SYM_EXTERNAL) continue;
+                rasCacheEntry* t = ras_cache_find(cache, (uintptr_t) l->extAddr);
+                if (!t || !t->fn) continue;
+                size_t k = t - cache->entries;
+                l->extAddr = (u8*) l->extAddr - t->offset + newOffsets[k];
+            }
+        }
+    }
+
+    rasUnready(ctx);
+    for (size_t i = 0; i < cache->count; i++) {
+        rasCacheEntry* e = &cache->entries[i];
+        if (!e->fn) continue;
+        e->offset = newOffsets[i];
+        ras_cache_place(cache, e);
+        cache->entries[live++] = *e;
+    }
+    cache->count = live;
+    cache->freeBytes = 0;
+    free(newOffsets);
+    ctx->curr = ctx->code + end;
+
+    // give the pages that are no longer used back to the system
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    size_t keep = (end + pagesize - 1) & ~(pagesize - 1);
+    size_t released = 0;
+    if (oldEnd > keep) {
+        released = ((oldEnd + pagesize - 1) & ~(pagesize - 1)) - keep;
+        madvise((u8*) base + keep, released, MADV_DONTNEED);
+    }
+    rasReady(ctx);
+    return released;
+}
+
+size_t rasGetCodeCacheFree(rasCodeCache* cache) {
+    return cache->freeBytes;
+}
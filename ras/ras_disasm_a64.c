@@ -0,0 +1,844 @@
+#include "ras_a64.h"
+#include "ras_impl.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+// prints instructions in the syntax of the macro api, so the output of
+// everything ras can emit can be pasted back into a generator
+
+typedef struct {
+    char* buf;
+    size_t size;
+    size_t len;
+    int args;
+} rasDisasmOut;
+
+static void ras_printf(rasDisasmOut* o, const char* fmt, ...) {
+    // only checking if the instruction is valid
+    if (!o->size) return;
+    va_list va;
+    va_start(va, fmt);
+    size_t left = o->len < o->size ? o->size - o->len : 0;
+    int n = vsnprintf(o->buf + (left ? o->len : 0), left, fmt, va);
+    va_end(va);
+    if (n > 0) o->len += n;
+}
+
+static void ras_op(rasDisasmOut* o, const char* name, const char* suffix) {
+    ras_printf(o, "%s%s(", name, suffix);
+    o->args = 0;
+}
+
+static void ras_arg(rasDisasmOut* o, const char* fmt, ...) {
+    if (!o->size) return;
+    if (o->args++) ras_printf(o, ", ");
+    char tmp[64];
+    va_list va;
+    va_start(va, fmt);
+    vsnprintf(tmp, sizeof tmp, fmt, va);
+    va_end(va);
+    ras_printf(o, "%s", tmp);
+}
+
+static void ras_end(rasDisasmOut* o) {
+    ras_printf(o, ")");
+}
+
+#define F(w, lo, n) (((w) >> (lo)) & MASK(n))
+#define RD(w) F(w, 0, 5)
+#define RN(w) F(w, 5, 5)
+#define RM(w) F(w, 16, 5)
+#define SF(w) F(w, 31, 1)
+#define WX(sf) ((sf) ? "X" : "W")
+
+static void ras_reg(rasDisasmOut* o, u32 r, bool sp) {
+    if (r == 31) {
+        ras_arg(o, sp ? "SP" : "ZR");
+    } else {
+        ras_arg(o, "R%d", r);
+    }
+}
+
+static void ras_vreg(rasDisasmOut* o, u32 r) {
+    ras_arg(o, "V%d", r);
+}
+
+static void ras_imm(rasDisasmOut* o, s64 imm) {
+    if (imm < 0) {
+        ras_arg(o, "-0x%llx", (unsigned long long) -imm);
+    } else {
+        ras_arg(o, "0x%llx", (unsigned long long) imm);
+    }
+}
+
+static void ras_addr(rasDisasmOut* o, u64 addr) {
+    ras_arg(o, "0x%llx", (unsigned long long) addr);
+}
+
+static s64 ras_sext(u64 v, u32 bits) {
+    return (s64) (v << (64 - bits)) >> (64 - bits);
+}
+
+static const char* conds[16] = {"EQ", "NE", "CS", "CC", "MI", "PL",
+                                "VS", "VC", "HI", "LS", "GE", "LT",
+                                "GT", "LE", "AL", "NV"};
+static const char* shifts[4] = {"LSL", "LSR", "ASR", "ROR"};
+static const char* extends[8] = {"UXTB", "UXTH", "UXTW", "UXTX",
+                                  "SXTB", "SXTH", "SXTW", "SXTX"};
+static const char* arrangements[8] = {"8B", "16B", "4H", "8H",
+                                      "2S", "4S", "1D", "2D"};
+
+static void ras_shift(rasDisasmOut* o, u32 type, u32 amt) {
+    if (type == 3) {
+        // there is no macro for ror shifted registers
+        ras_arg(o, "((rasA64Shift) {%d, 3})", amt);
+    } else if (type || amt) {
+        ras_arg(o, "%s(%d)", shifts[type], amt);
+    }
+}
+
+static void ras_fimm(rasDisasmOut* o, u32 imm8) {
+    float f = 1 + (imm8 & 15) / 16.0f;
+    u32 e = F(imm8, 4, 2);
+    int exp = F(imm8, 6, 1) ? (int) e - 3 : (int) e + 1;
+    for (; exp > 0; exp--) f *= 2;
+    for (; exp < 0; exp++) f /= 2;
+    if (imm8 >> 7) f = -f;
+    char tmp[32];
+    snprintf(tmp, sizeof tmp, "%.7g", f);
+    ras_arg(o, strchr(tmp, '.') ? "%s" : "%s.0", tmp);
+}
+
+static bool ras_decode_bitmask(u32 n, u32 immr, u32 imms, u32 sf, u64* imm) {
+    u32 val = n << 6 | (~imms & MASK(6));
+    if (!val) return false;
+    u32 len = 31 - __builtin_clz(val);
+    if (len < 1 || (!sf && n)) return false;
+    u32 esize = 1 << len;
+    u32 s = imms & (esize - 1);
+    u32 r = immr & (esize - 1);
+    if (s == esize - 1) return false;
+    u64 elem = MASK(s + 1);
+    if (r) elem = (elem >> r | elem << (esize - r)) & (esize == 64 ? ~0ull : MASK(esize));
+    for (u32 i = esize; i < 64; i *= 2) elem |= elem << i;
+    *imm = sf ? elem : elem & MASK(32);
+    return true;
+}
+
+static bool ras_dis_addsubimm(rasDisasmOut* o, u32 w) {
+    u32 sf = SF(w), op = F(w, 30, 1), s = F(w, 29, 1);
+    u32 rd = RD(w), rn = RN(w);
+    if (s && rd == 31) {
+        ras_op(o, op ? "CMP" : "CMN", WX(sf));
+    } else if (!s && !op && !F(w, 10, 13) && (rd == 31 || rn == 31)) {
+        ras_op(o, "MOV", WX(sf));
+        ras_reg(o, rd, 1);
+        ras_reg(o, rn, 1);
+        ras_end(o);
+        return true;
+    } else {
+        ras_op(o, op ? (s ? "SUBS" : "SUB") : (s ? "ADDS" : "ADD"), WX(sf));
+        ras_reg(o, rd, !s);
+    }
+    ras_reg(o, rn, 1);
+    ras_imm(o, F(w, 10, 12));
+    if (F(w, 22, 1)) ras_shift(o, 0, 12);
+    ras_end(o);
+    return true;
+}
+
+static bool ras_dis_addsubreg(rasDisasmOut* o, u32 w, bool ext) {
+    u32 sf = SF(w), op = F(w, 30, 1), s = F(w, 29, 1);
+    u32 rd = RD(w), rn = RN(w), rm = RM(w);
+    u32 amt = F(w, 10, ext ? 3 : 6);
+    if (ext ? amt > 4 : F(w, 22, 2) == 3) return false;
+    if (!ext && !sf && amt > 31) return false;
+    if (s && rd == 31) {
+        ras_op(o, op ? "CMP" : "CMN", WX(sf));
+    } else {
+        ras_op(o, op ? (s ? "SUBS" : "SUB") : (s ? "ADDS" : "ADD"), WX(sf));
+        ras_reg(o, rd, ext && !s);
+    }
+    ras_reg(o, rn, ext);
+    ras_reg(o, rm, 0);
+    if (ext) {
+        ras_arg(o, "%s(%d)", extends[F(w, 13, 3)], amt);
+    } else {
+        ras_shift(o, F(w, 22, 2), amt);
+    }
+    ras_end(o);
+    return true;
+}
+
+static bool ras_dis_addsubcarry(rasDisasmOut* o, u32 w) {
+    static const char* names[4] = {"ADC", "ADCS", "SBC", "SBCS"};
+    ras_op(o, names[F(w, 29, 2)], WX(SF(w)));
+    ras_reg(o, RD(w), 0);
+    ras_reg(o, RN(w), 0);
+    ras_reg(o, RM(w), 0);
+    ras_end(o);
+    return true;
+}
+
+static const char* logicalNames[8] = {"AND", "BIC", "ORR", "ORN",
+                                      "EOR", "EON", "ANDS", "BICS"};
+
+static bool ras_dis_logicalimm(rasDisasmOut* o, u32 w) {
+    u32 sf = SF(w), opc = F(w, 29, 2);
+    u64 imm;
+    if (!ras_decode_bitmask(F(w, 22, 1), F(w, 16, 6), F(w, 10, 6), sf, &imm))
+        return false;
+    if (opc == 3 && RD(w) == 31) {
+        ras_op(o, "TST", WX(sf));
+    } else {
+        ras_op(o, logicalNames[opc << 1], WX(sf));
+        ras_reg(o, RD(w), opc != 3);
+    }
+    ras_reg(o, RN(w), 0);
+    ras_arg(o, "0x%llx", (unsigned long long) imm);
+    ras_end(o);
+    return true;
+}
+
+static bool ras_dis_logicalreg(rasDisasmOut* o, u32 w) {
+    u32 sf = SF(w), opc = F(w, 29, 2), n = F(w, 21, 1);
+    u32 type = F(w, 22, 2), amt = F(w, 10, 6);
+    u32 rd = RD(w), rn = RN(w), rm = RM(w);
+    if (!sf && amt > 31) return false;
+    if (opc == 1 && !n && rn == 31 && !type && !amt) {
+        ras_op(o, "MOV", WX(sf));
+        ras_reg(o, rd, 0);
+        ras_reg(o, rm, 0);
+        ras_end(o);
+        return true;
+    }
+    if (opc == 3 && !n && rd == 31) {
+        ras_op(o, "TST", WX(sf));
+    } else {
+        ras_op(o, logicalNames[opc << 1 | n], WX(sf));
+        ras_reg(o, rd, 0);
+    }
+    ras_reg(o, rn, 0);
+    ras_reg(o, rm, 0);
+    ras_shift(o, type, amt);
+    ras_end(o);
+    return true;
+}
+
+static bool ras_dis_dataproc1(rasDisasmOut* o, u32 w) {
+    static const char* names[2][6] = {
+        {"RBITW", "REV16W", "REVW", NULL, "CLZW", "CLSW"},
+        {"RBITX", "REV16X", "REV32", "REVX", "CLZX", "CLSX"},
+    };
+    u32 opcode = F(w, 10, 6);
+    if (opcode > 5 || !names[SF(w)][opcode]) return false;
+    ras_op(o, names[SF(w)][opcode], "");
+    ras_reg(o, RD(w), 0);
+    ras_reg(o, RN(w), 0);
+    ras_end(o);
+    return true;
+}
+
+static bool ras_dis_dataproc2(rasDisasmOut* o, u32 w) {
+    static const char* names[12] = {NULL,   NULL,   "UDIV", "SDIV",
+                                    NULL,   NULL,   NULL,   NULL,
+                                    "LSLV", "LSRV", "ASRV", "RORV"};
+    u32 opcode = F(w, 10, 6);
+    if (opcode > 11 || !names[opcode]) return false;
+    ras_op(o, names[opcode], WX(SF(w)));
+    ras_reg(o, RD(w), 0);
+    ras_reg(o, RN(w), 0);
+    ras_reg(o, RM(w), 0);
+    ras_end(o);
+    return true;
+}
+
+static bool ras_dis_dataproc3(rasDisasmOut* o, u32 w) {
+    u32 sf = SF(w), op31 = F(w, 21, 3), o0 = F(w, 15, 1), ra = F(w, 10, 5);
+    const char* name;
+    const char* suffix = "";
+    if (op31 == 0) {
+        name = ra == 31 ? (o0 ? "MNEG" : "MUL") : (o0 ? "MSUB" : "MADD");
+        suffix = WX(sf);
+    } else if (sf && !o0 && (op31 == 1 || op31 == 5)) {
+        name = ra == 31 ? (op31 == 1 ? "SMULL" : "UMULL")
+                        : (op31 == 1 ? "SMADDL" : "UMADDL");
+    } else {
+        return false;
+    }
+    ras_op(o, name, suffix);
+    ras_reg(o, RD(w), 0);
+    ras_reg(o, RN(w), 0);
+    ras_reg(o, RM(w), 0);
+    if (ra != 31) ras_reg(o, ra, 0);
+    ras_end(o);
+    return true;
+}
+
+static bool ras_dis_condselect(rasDisasmOut* o, u32 w) {
+    static const char* names[4] = {"CSEL", "CSINC", "CSINV", "CSNEG"};
+    ras_op(o, names[F(w, 30, 1) << 1 | F(w, 10, 1)], WX(SF(w)));
+    ras_reg(o, RD(w), 0);
+    ras_reg(o, RN(w), 0);
+    ras_reg(o, RM(w), 0);
+    ras_arg(o, "%s", conds[F(w, 12, 4)]);
+    ras_end(o);
+    return true;
+}
+
+static bool ras_dis_pcreladdr(rasDisasmOut* o, u32 w, u64 pc) {
+    s64 imm = ras_sext(F(w, 5, 19) << 2 | F(w, 29, 2), 21);
+    u32 op = SF(w);
+    ras_op(o, op ? "ADRP" : "ADR", "");
+    ras_reg(o, RD(w), 0);
+    ras_addr(o, op ? (pc & ~MASK(12)) + (imm << 12) : pc + imm);
+    ras_end(o);
+    return true;
+}
+
+static bool ras_dis_bitfield(rasDisasmOut* o, u32 w) {
+    static const char* names[3] = {"SBFM", "BFM", "UBFM"};
+    u32 sf = SF(w), opc = F(w, 29, 2);
+    u32 immr = F(w, 16, 6), imms = F(w, 10, 6);
+    u32 top = sf ? 63 : 31;
+    if (opc == 3 || F(w, 22, 1) != sf) return false;
+    if (!sf && (immr > 31 || imms > 31)) return false;
+    if (opc == 2 && imms != top && imms + 1 == immr) {
+        ras_op(o, "LSL", WX(sf));
+        ras_reg(o, RD(w), 0);
+        ras_reg(o, RN(w), 0);
+        ras_arg(o, "%d", top - imms);
+    } else if (opc != 1 && imms == top) {
+        ras_op(o, opc ? "LSR" : "ASR", WX(sf));
+        ras_reg(o, RD(w), 0);
+        ras_reg(o, RN(w), 0);
+        ras_arg(o, "%d", immr);
+    } else {
+        ras_op(o, names[opc], WX(sf));
+        ras_reg(o, RD(w), 0);
+        ras_reg(o, RN(w), 0);
+        ras_arg(o, "%d", immr);
+        ras_arg(o, "%d", imms);
+    }
+    ras_end(o);
+    return true;
+}
+
+static bool ras_dis_extract(rasDisasmOut* o, u32 w) {
+    u32 sf = SF(w), imms = F(w, 10, 6);
+    if (F(w, 22, 1) != sf || (!sf && imms > 31)) return false;
+    ras_op(o, "EXTR", WX(sf));
+    ras_reg(o, RD(w), 0);
+    ras_reg(o, RN(w), 0);
+    ras_reg(o, RM(w), 0);
+    ras_arg(o, "%d", imms);
+    ras_end(o);
+    return true;
+}
+
+static bool ras_dis_movewide(rasDisasmOut* o, u32 w) {
+    static const char* names[4] = {"MOVN", NULL, "MOVZ", "MOVK"};
+    u32 sf = SF(w), opc = F(w, 29, 2), hw = F(w, 21, 2);
+    if (!names[opc] || (!sf && hw > 1)) return false;
+    ras_op(o, names[opc], WX(sf));
+    ras_reg(o, RD(w), 0);
+    ras_imm(o, F(w, 5, 16));
+    if (hw) ras_shift(o, 0, hw * 16);
+    ras_end(o);
+    return true;
+}
+
+// names indexed by size and opc, vector registers use the same encoding
+// with q registers in size 0
+static const char* ldstNames[2][4][4] = {
+    {
+        {"STRB", "LDRB", "LDRSBX", "LDRSBW"},
+        {"STRH", "LDRH", "LDRSHX", "LDRSHW"},
+        {"STRW", "LDRW", "LDRSW", NULL},
+        {"STRX", "LDRX", NULL, NULL},
+    },
+    {
+        {NULL, NULL, "STRQ", "LDRQ"},
+        {NULL, NULL, NULL, NULL},
+        {"STRS", "LDRS", NULL, NULL},
+        {"STRD", "LDRD", NULL, NULL},
+    },
+};
+
+static void ras_rt(rasDisasmOut* o, u32 r, u32 vr) {
+    if (vr) {
+        ras_vreg(o, r);
+    } else {
+        ras_reg(o, r, 0);
+    }
+}
+
+static bool ras_dis_ldstimm(rasDisasmOut* o, u32 w) {
+    u32 size = F(w, 30, 2), vr = F(w, 26, 1), opc = F(w, 22, 2);
+    const char* name = ldstNames[vr][size][opc];
+    if (!name) return false;
+    u32 scale = (vr && (opc & 2)) ? 4 : size;
+    s64 imm;
+    u32 mod = 0;
+    if (F(w, 24, 1)) {
+        imm = F(w, 10, 12) << scale;
+    } else {
+        mod = F(w, 10, 2);
+        if (mod == 2) return false;
+        imm = ras_sext(F(w, 12, 9), 9);
+    }
+    ras_op(o, name, "");
+    ras_rt(o, RD(w), vr);
+    ras_printf(o, ", (");
+    o->args = 0;
+    ras_reg(o, RN(w), 1);
+    if (imm || mod) ras_imm(o, imm);
+    if (mod) ras_arg(o, mod == 1 ? "POST" : "PRE");
+    ras_printf(o, "))");
+    return true;
+}
+
+static bool ras_dis_ldstreg(rasDisasmOut* o, u32 w) {
+    u32 size = F(w, 30, 2), vr = F(w, 26, 1), opc = F(w, 22, 2);
+    u32 type = F(w, 13, 3), s = F(w, 12, 1);
+    const char* name = ldstNames[vr][size][opc];
+    if (!name || !(type & 2)) return false;
+    u32 scale = (vr && (opc & 2)) ? 4 : size;
+    ras_op(o, name, "");
+    ras_rt(o, RD(w), vr);
+    ras_printf(o, ", (");
+    o->args = 0;
+    ras_reg(o, RN(w), 1);
+    ras_reg(o, RM(w), 0);
+    if (type == 3) {
+        if (s) ras_arg(o, "LSL(%d)", scale);
+    } else {
+        ras_arg(o, "%s(%d)", extends[type], s ? scale : 0);
+    }
+    ras_printf(o, "))");
+    return true;
+}
+
+static bool ras_dis_ldrliteral(rasDisasmOut* o, u32 w, u64 pc) {
+    static const char* names[2][3] = {{"LDRLW", "LDRLX", "LDRLSW"},
+                                      {"LDRLS", "LDRLD", "LDRLQ"}};
+    u32 opc = F(w, 30, 2), vr = F(w, 26, 1);
+    if (opc == 3) return false;
+    ras_op(o, names[vr][opc], "");
+    ras_rt(o, RD(w), vr);
+    ras_addr(o, pc + (ras_sext(F(w, 5, 19), 19) << 2));
+    ras_end(o);
+    return true;
+}
+
+static bool ras_dis_ldstpair(rasDisasmOut* o, u32 w) {
+    static const char* names[2][3][2] = {
+        {{"STPW", "LDPW"}, {NULL, "LDPSW"}, {"STPX", "LDPX"}},
+        {{"STPS", "LDPS"}, {"STPD", "LDPD"}, {"STPQ", "LDPQ"}},
+    };
+    u32 opc = F(w, 30, 2), vr = F(w, 26, 1), mod = F(w, 23, 2);
+    u32 l = F(w, 22, 1);
+    if (opc == 3 || mod == 0 || !names[vr][opc][l]) return false;
+    u32 size = vr ? opc + 2 : (opc & 2) ? 3 : 2;
+    s64 imm = ras_sext(F(w, 15, 7), 7) << size;
+    ras_op(o, names[vr][opc][l], "");
+    ras_rt(o, RD(w), vr);
+    ras_rt(o, F(w, 10, 5), vr);
+    ras_printf(o, ", (");
+    o->args = 0;
+    ras_reg(o, RN(w), 1);
+    if (imm || mod != 2) ras_imm(o, imm);
+    if (mod != 2) ras_arg(o, mod == 1 ? "POST" : "PRE");
+    ras_printf(o, "))");
+    return true;
+}
+
+static bool ras_dis_atomic(rasDisasmOut* o, u32 w) {
+    static const char* ops[4] = {"ADD", "CLR", "EOR", "SET"};
+    static const char* orders[4] = {"", "L", "A", "AL"};
+    u32 size = F(w, 30, 2), a = F(w, 23, 1), r = F(w, 22, 1);
+    u32 o3 = F(w, 15, 1), opc = F(w, 12, 3);
+    if (size < 2 || opc > 3 || (o3 && opc)) return false;
+    char name[16];
+    if (o3) {
+        snprintf(name, sizeof name, "SWP%s", orders[a << 1 | r]);
+    } else if (RD(w) == 31 && !a) {
+        snprintf(name, sizeof name, "ST%s%s", ops[opc], orders[r]);
+    } else {
+        snprintf(name, sizeof name, "LD%s%s", ops[opc], orders[a << 1 | r]);
+    }
+    ras_op(o, name, WX(size & 1));
+    ras_reg(o, RM(w), 0);
+    if (strncmp(name, "ST", 2)) ras_reg(o, RD(w), 0);
+    ras_printf(o, ", (");
+    o->args = 0;
+    ras_reg(o, RN(w), 1);
+    ras_printf(o, "))");
+    return true;
+}
+
+static bool ras_dis_branch(rasDisasmOut* o, u32 w, u64 pc) {
+    if ((w & 0x7c000000) == 0x14000000) {
+        ras_op(o, SF(w) ? "BL" : "B", "");
+        ras_addr(o, pc + (ras_sext(F(w, 0, 26), 26) << 2));
+    } else if ((w & 0xff000010) == 0x54000000) {
+        ras_op(o, "B", conds[F(w, 0, 4)]);
+        ras_addr(o, pc + (ras_sext(F(w, 5, 19), 19) << 2));
+    } else if ((w & 0x7e000000) == 0x34000000) {
+        ras_op(o, F(w, 24, 1) ? "CBNZ" : "CBZ", WX(SF(w)));
+        ras_reg(o, RD(w), 0);
+        ras_addr(o, pc + (ras_sext(F(w, 5, 19), 19) << 2));
+    } else if ((w & 0x7e000000) == 0x36000000) {
+        ras_op(o, F(w, 24, 1) ? "TBNZ" : "TBZ", "");
+        ras_reg(o, RD(w), 0);
+        ras_arg(o, "%d", SF(w) << 5 | F(w, 19, 5));
+        ras_addr(o, pc + (ras_sext(F(w, 5, 14), 14) << 2));
+    } else {
+        switch (w & 0xfffffc1f) {
+            case 0xd61f0000:
+                ras_op(o, "BR", "");
+                break;
+            case 0xd63f0000:
+                ras_op(o, "BLR", "");
+                break;
+            case 0xd65f0000:
+                ras_op(o, "RET", "");
+                if (RN(w) == 30) {
+                    ras_end(o);
+                    return true;
+                }
+                break;
+            default:
+                return false;
+        }
+        ras_reg(o, RN(w), 0);
+    }
+    ras_end(o);
+    return true;
+}
+
+static bool ras_dis_system(rasDisasmOut* o, u32 w) {
+    if ((w & 0xfffff01f) == 0xd503201f) {
+        u32 opc = F(w, 5, 7);
+        ras_op(o, opc ? "HINT" : "NOP", "");
+        if (opc) ras_arg(o, "%d", opc);
+    } else if ((w & 0xffd00000) == 0xd5100000) {
+        u32 l = F(w, 21, 1), opc = F(w, 5, 16);
+        ras_op(o, l ? "MRS" : "MSR", "");
+        if (l) ras_reg(o, RD(w), 0);
+        if (opc == NZCV) {
+            ras_arg(o, "NZCV");
+        } else {
+            ras_arg(o, "0x%x", opc);
+        }
+        if (!l) ras_reg(o, RD(w), 0);
+    } else {
+        return false;
+    }
+    ras_end(o);
+    return true;
+}
+
+#define FTYPE(w) F(w, 22, 2)
+#define SD(ftype) ((ftype) ? "D" : "S")
+
+static bool ras_dis_fp(rasDisasmOut* o, u32 w) {
+    u32 ftype = FTYPE(w);
+    if (ftype > 1) return false;
+
+    if ((w & 0xff201fe0) == 0x1e201000) {
+        ras_op(o, "FMOV", SD(ftype));
+        ras_vreg(o, RD(w));
+        ras_fimm(o, F(w, 13, 8));
+    } else if ((w & 0xff207c00) == 0x1e204000) {
+        static const char* names[2][11] = {
+            {"FMOVS", "FABSS", "FNEGS", "FSQRTS", NULL, "FCVTDS", [10] = "FRINTMS"},
+            {"FMOVD", "FABSD", "FNEGD", "FSQRTD", "FCVTSD"},
+        };
+        u32 opcode = F(w, 15, 6);
+        if (opcode > 10 || !names[ftype][opcode]) return false;
+        ras_op(o, names[ftype][opcode], "");
+        ras_vreg(o, RD(w));
+        ras_vreg(o, RN(w));
+    } else if ((w & 0xff20fc17) == 0x1e202000) {
+        u32 zero = F(w, 3, 1);
+        ras_op(o, zero ? "FCMPZ" : "FCMP", SD(ftype));
+        ras_vreg(o, RN(w));
+        if (!zero) ras_vreg(o, RM(w));
+    } else if ((w & 0xff200c00) == 0x1e200800) {
+        static const char* names[9] = {"FMUL",   "FDIV",   "FADD",
+                                       "FSUB",   "FMAX",   "FMIN",
+                                       "FMAXNM", "FMINNM", "FNMUL"};
+        u32 opcode = F(w, 12, 4);
+        if (opcode > 8) return false;
+        ras_op(o, names[opcode], SD(ftype));
+        ras_vreg(o, RD(w));
+        ras_vreg(o, RN(w));
+        ras_vreg(o, RM(w));
+    } else if ((w & 0xff000000) == 0x1f000000) {
+        static const char* names[4] = {"FMADD", "FMSUB", "FNMADD", "FNMSUB"};
+        ras_op(o, names[F(w, 21, 1) << 1 | F(w, 15, 1)], SD(ftype));
+        ras_vreg(o, RD(w));
+        ras_vreg(o, RN(w));
+        ras_vreg(o, RM(w));
+        ras_vreg(o, F(w, 10, 5));
+    } else if ((w & 0x7f20fc00) == 0x1e200000) {
+        u32 sf = SF(w), rmode = F(w, 19, 2), opcode = F(w, 16, 3);
+        char name[16];
+        if (rmode == 0 && (opcode == 6 || opcode == 7)) {
+            if (sf != ftype) return false;
+            ras_op(o, "FMOV", WX(sf));
+            if (opcode == 6) {
+                ras_reg(o, RD(w), 0);
+                ras_vreg(o, RN(w));
+            } else {
+                ras_vreg(o, RD(w));
+                ras_reg(o, RN(w), 0);
+            }
+        } else if (rmode == 0 && (opcode == 2 || opcode == 3)) {
+            snprintf(name, sizeof name, "%sCVTF%s", opcode == 2 ? "S" : "U",
+                     SD(ftype));
+            ras_op(o, name, WX(sf));
+            ras_vreg(o, RD(w));
+            ras_reg(o, RN(w), 0);
+        } else if ((rmode == 3 && opcode < 2) || (rmode == 2 && opcode == 0)) {
+            snprintf(name, sizeof name, "FCVT%s%s%s", rmode == 2 ? "M" : "Z",
+                     opcode ? "U" : "S", SD(ftype));
+            ras_op(o, name, WX(sf));
+            ras_reg(o, RD(w), 0);
+            ras_vreg(o, RN(w));
+        } else {
+            return false;
+        }
+    } else if ((w & 0xff200c00) == 0x1e200c00) {
+        ras_op(o, "FCSEL", SD(ftype));
+        ras_vreg(o, RD(w));
+        ras_vreg(o, RN(w));
+        ras_vreg(o, RM(w));
+        ras_arg(o, "%s", conds[F(w, 12, 4)]);
+    } else {
+        return false;
+    }
+    ras_end(o);
+    return true;
+}
+
+static bool ras_dis_simdcopy(rasDisasmOut* o, u32 w) {
+    u32 q = F(w, 30, 1), op = F(w, 29, 1);
+    u32 imm5 = F(w, 16, 5), imm4 = F(w, 11, 4);
+    if (!imm5) return false;
+    u32 sz = __builtin_ctz(imm5);
+    if (sz > 3) return false;
+    u32 idx = imm5 >> (sz + 1);
+    static const char* elems = "BHSD";
+    char name[16];
+
+    if (op) {
+        snprintf(name, sizeof name, "INS%c", elems[sz]);
+        ras_op(o, name, "");
+        ras_vreg(o, RD(w));
+        ras_arg(o, "%d", idx);
+        ras_vreg(o, RN(w));
+        ras_arg(o, "%d", imm4 >> sz);
+    } else if (imm4 == 0 || imm4 == 1) {
+        if (sz == 3 && !q) return false;
+        ras_op(o, "DUP", arrangements[sz << 1 | q]);
+        ras_vreg(o, RD(w));
+        if (imm4) {
+            ras_reg(o, RN(w), 0);
+        } else {
+            ras_vreg(o, RN(w));
+            ras_arg(o, "%d", idx);
+        }
+    } else if (imm4 == 3) {
+        snprintf(name, sizeof name, "INS%c", elems[sz]);
+        ras_op(o, name, "");
+        ras_vreg(o, RD(w));
+        ras_arg(o, "%d", idx);
+        ras_reg(o, RN(w), 0);
+    } else if (imm4 == 5 || imm4 == 7) {
+        if (sz == 3) {
+            snprintf(name, sizeof name, "%cMOVD", imm4 == 7 ? 'U' : 'S');
+        } else {
+            snprintf(name, sizeof name, "%cMOV%c%s", imm4 == 7 ? 'U' : 'S',
+                     elems[sz], WX(q));
+        }
+        ras_op(o, name, "");
+        ras_reg(o, RD(w), 0);
+        ras_vreg(o, RN(w));
+        ras_arg(o, "%d", idx);
+    } else {
+        return false;
+    }
+    ras_end(o);
+    return true;
+}
+
+// float vector ops use the low size bit for the type and the high bit as
+// part of the opcode
+static const char* ras_farrangement(u32 size, u32 q) {
+    if (size & 1) return q ? "2D" : NULL;
+    return q ? "4S" : "2S";
+}
+
+static bool ras_dis_simd2misc(rasDisasmOut* o, u32 w) {
+    u32 q = F(w, 30, 1), u = F(w, 29, 1), size = F(w, 22, 2);
+    u32 opcode = F(w, 12, 5);
+    const char* name = NULL;
+    if (!u && opcode == 25 && !(size & 2)) name = "FRINTM";
+    if (!u && opcode == 13 && (size & 2)) name = "FCMEQZ";
+    if (!u && opcode == 27 && (size & 2)) name = "FCVTZS";
+    if (u && opcode == 15 && (size & 2)) name = "FNEG";
+    const char* arr = ras_farrangement(size, q);
+    if (!name || !arr) return false;
+    ras_op(o, name, arr);
+    ras_vreg(o, RD(w));
+    ras_vreg(o, RN(w));
+    ras_end(o);
+    return true;
+}
+
+static bool ras_dis_simdscalar(rasDisasmOut* o, u32 w) {
+    u32 u = F(w, 29, 1), size = F(w, 22, 2), opcode = F(w, 12, 5);
+    const char* name;
+    if (F(w, 17, 4) == 8) {
+        // pairwise
+        if (!u || opcode != 13 || size > 1) return false;
+        name = "FADDP";
+    } else {
+        if (opcode != 29 || size < 2) return false;
+        name = u ? "FRSQRTE" : "FRECPE";
+    }
+    ras_op(o, name, SD(size & 1));
+    ras_vreg(o, RD(w));
+    ras_vreg(o, RN(w));
+    ras_end(o);
+    return true;
+}
+
+static bool ras_dis_simd3same(rasDisasmOut* o, u32 w) {
+    static const char* intNames[2][24] = {
+        {"SHADD", "SQADD", "SRHADD", NULL,   "SHSUB", "SQSUB", "CMGT",
+         "CMGE",  "SSHL",  "SQSHL",  "SRSHL", "SQRSHL", "SMAX", "SMIN",
+         "SABD",  "SABA",  "ADD",    "CMTST", "MLA",   "MUL",  "SMAXP",
+         "SMINP", "SQDMULH", "ADDP"},
+        {"UHADD", "UQADD", "URHADD", NULL,   "UHSUB", "UQSUB", "CMHI",
+         "CMHS",  "USHL",  "UQSHL",  "URSHL", "UQRSHL", "UMAX", "UMIN",
+         "UABD",  "UABA",  "SUB",    "CMEQ",  "MLS",   "PMUL", "UMAXP",
+         "UMINP", "SQRDMULH", NULL},
+    };
+    static const char* logNames[2][4] = {{"AND", "BIC", "ORR", "ORN"},
+                                         {"EOR", "BSL", "BIT", "BIF"}};
+    static const char* fpNames[2][8][2] = {
+        {{"FMAXNM", "FMINNM"},
+         {"FMLA", "FMLS"},
+         {"FADD", "FSUB"},
+         {"FMULX", NULL},
+         {"FCMEQ", NULL},
+         {NULL, NULL},
+         {"FMAX", "FMIN"},
+         {"FRECPS", "FRSQRTS"}},
+        {{"FMAXNMP", "FMINNMP"},
+         {NULL, NULL},
+         {"FADDP", "FABD"},
+         {"FMUL", NULL},
+         {"FCMGE", "FCMGT"},
+         {"FACGE", "FACGT"},
+         {"FMAXP", "FMINP"},
+         {"FDIV", NULL}},
+    };
+    u32 q = F(w, 30, 1), u = F(w, 29, 1), size = F(w, 22, 2);
+    u32 opcode = F(w, 11, 5);
+    const char* name;
+    const char* arr;
+    if (opcode == 3) {
+        name = logNames[u][size];
+        arr = arrangements[q];
+        if (!u && size == 2 && RN(w) == RM(w)) {
+            ras_op(o, "MOV", arr);
+            ras_vreg(o, RD(w));
+            ras_vreg(o, RN(w));
+            ras_end(o);
+            return true;
+        }
+    } else if (opcode >= 24) {
+        name = fpNames[u][opcode - 24][size >> 1];
+        arr = ras_farrangement(size, q);
+    } else {
+        name = intNames[u][opcode];
+        arr = size == 3 ? NULL : arrangements[size << 1 | q];
+        if (opcode == 22 && (size == 0 || size == 3)) name = NULL;
+        if (u && opcode == 19 && size) name = NULL;
+    }
+    if (!name || !arr) return false;
+    ras_op(o, name, arr);
+    ras_vreg(o, RD(w));
+    ras_vreg(o, RN(w));
+    ras_vreg(o, RM(w));
+    ras_end(o);
+    return true;
+}
+
+static bool ras_dis_simdmodimm(rasDisasmOut* o, u32 w) {
+    u32 q = F(w, 30, 1), op = F(w, 29, 1);
+    if (op && !q) return false;
+    ras_op(o, "FMOV", op ? "2D" : q ? "4S" : "2S");
+    ras_vreg(o, RD(w));
+    ras_fimm(o, F(w, 16, 3) << 5 | F(w, 5, 5));
+    ras_end(o);
+    return true;
+}
+
+static bool ras_dis(rasDisasmOut* o, u32 w, u64 pc) {
+    if ((w & 0x1f800000) == 0x11000000) return ras_dis_addsubimm(o, w);
+    if ((w & 0x1fe00000) == 0x0b200000) return ras_dis_addsubreg(o, w, 1);
+    if ((w & 0x1f200000) == 0x0b000000) return ras_dis_addsubreg(o, w, 0);
+    if ((w & 0x1fe0fc00) == 0x1a000000) return ras_dis_addsubcarry(o, w);
+    if ((w & 0x1f800000) == 0x12000000) return ras_dis_logicalimm(o, w);
+    if ((w & 0x1f000000) == 0x0a000000) return ras_dis_logicalreg(o, w);
+    if ((w & 0x7fff0000) == 0x5ac00000) return ras_dis_dataproc1(o, w);
+    if ((w & 0x7fe00000) == 0x1ac00000) return ras_dis_dataproc2(o, w);
+    if ((w & 0x7f000000) == 0x1b000000) return ras_dis_dataproc3(o, w);
+    if ((w & 0x3fe00800) == 0x1a800000) return ras_dis_condselect(o, w);
+    if ((w & 0x1f000000) == 0x10000000) return ras_dis_pcreladdr(o, w, pc);
+    if ((w & 0x1f800000) == 0x13000000) return ras_dis_bitfield(o, w);
+    if ((w & 0x7fa00000) == 0x13800000) return ras_dis_extract(o, w);
+    if ((w & 0x1f800000) == 0x12800000) return ras_dis_movewide(o, w);
+    if ((w & 0x3b000000) == 0x39000000) return ras_dis_ldstimm(o, w);
+    if ((w & 0x3b200000) == 0x38000000) return ras_dis_ldstimm(o, w);
+    if ((w & 0x3b200c00) == 0x38200800) return ras_dis_ldstreg(o, w);
+    if ((w & 0x3b000000) == 0x18000000) return ras_dis_ldrliteral(o, w, pc);
+    if ((w & 0x3a000000) == 0x28000000) return ras_dis_ldstpair(o, w);
+    if ((w & 0x3f200c00) == 0x38200000) return ras_dis_atomic(o, w);
+    if ((w & 0xffc00000) == 0xd5000000) return ras_dis_system(o, w);
+    if ((w & 0x1c000000) == 0x14000000) return ras_dis_branch(o, w, pc);
+    if ((w & 0x5e000000) == 0x1e000000) return ras_dis_fp(o, w);
+    if ((w & 0x9fe08400) == 0x0e000400) return ras_dis_simdcopy(o, w);
+    if ((w & 0xdf3c0c00) == 0x5e200800) return ras_dis_simdscalar(o, w);
+    if ((w & 0xdf3e0c00) == 0x5e300800) return ras_dis_simdscalar(o, w);
+    if ((w & 0x9f3e0c00) == 0x0e200800) return ras_dis_simd2misc(o, w);
+    if ((w & 0x9f200400) == 0x0e200400) return ras_dis_simd3same(o, w);
+    if ((w & 0x9ff8fc00) == 0x0f00f400) return ras_dis_simdmodimm(o, w);
+    return false;
+}
+
+bool rasDisasmA64(u32 inst, u64 pc, char* buf, size_t size) {
+    rasDisasmOut o = {buf, size};
+    if (size) buf[0] = '\0';
+    if (ras_dis(&o, inst, pc)) return true;
+    o.len = 0;
+    ras_printf(&o, "WORD(0x%08x)", inst);
+    return false;
+}
+
+void rasDumpA64(rasBlock* ctx, FILE* f) {
+    char buf[128];
+    for (size_t off = 0; off + 4 <= ctx->curr - ctx->code; off += 4) {
+        u32 w = *(u32*) (ctx->code + off);
+        uintptr_t pc = rasGetBaseAddr(ctx) + off;
+        rasDisasmA64(w, pc, buf, sizeof buf);
+        fprintf(f, "%lx: %08x  %s;\n", pc, w, buf);
+    }
+}
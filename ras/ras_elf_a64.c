@@ -0,0 +1,291 @@
+#include "ras_a64.h"
+#include "ras_impl.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// only the parts of elf64 needed for a relocatable object
+
+typedef struct {
+    u8 ident[16];
+    u16 type;
+    u16 machine;
+    u32 version;
+    u64 entry;
+    u64 phoff;
+    u64 shoff;
+    u32 flags;
+    u16 ehsize;
+    u16 phentsize;
+    u16 phnum;
+    u16 shentsize;
+    u16 shnum;
+    u16 shstrndx;
+} rasElfHeader;
+
+typedef struct {
+    u32 name;
+    u32 type;
+    u64 flags;
+    u64 addr;
+    u64 offset;
+    u64 size;
+    u32 link;
+    u32 info;
+    u64 addralign;
+    u64 entsize;
+} rasElfSection;
+
+typedef struct {
+    u32 name;
+    u8 info;
+    u8 other;
+    u16 shndx;
+    u64 value;
+    u64 size;
+} rasElfSymbol;
+
+typedef struct {
+    u64 offset;
+    u64 info;
+    s64 addend;
+} rasElfRela;
+
+#define ET_REL 1
+#define EM_AARCH64 183
+
+#define SHT_PROGBITS 1
+#define SHT_SYMTAB 2
+#define SHT_STRTAB 3
+#define SHT_RELA 4
+#define SHF_ALLOC 2
+#define SHF_EXECINSTR 4
+#define SHF_INFO_LINK 0x40
+
+#define STB_GLOBAL 1
+#define STT_NOTYPE 0
+#define STT_SECTION 3
+
+#define R_AARCH64_ABS64 257
+#define R_AARCH64_PREL32 261
+#define R_AARCH64_LD_PREL_LO19 273
+#define R_AARCH64_ADR_PREL_LO21 274
+#define R_AARCH64_ADR_PREL_PG_HI21 275
+#define R_AARCH64_ADD_ABS_LO12_NC 277
+#define R_AARCH64_TSTBR14 279
+#define R_AARCH64_CONDBR19 280
+#define R_AARCH64_JUMP26 282
+#define R_AARCH64_CALL26 283
+
+enum {
+    SEC_NULL,
+    SEC_TEXT,
+    SEC_RELA,
+    SEC_SYMTAB,
+    SEC_STRTAB,
+    SEC_SHSTRTAB,
+    SEC_NOTE,
+
+    SEC_MAX
+};
+
+static const char shstrtab[] =
+    "\0.text\0.rela.text\0.symtab\0.strtab\0.shstrtab\0.note.GNU-stack";
+static const u32 shnames[SEC_MAX] = {0, 1, 7, 18, 26, 34, 44};
+
+// the block is page aligned so keep that for labels aligned with rasAlign
+#define TEXT_ALIGN 4096
+
+#define ALIGN8(n) (((n) + 7) & ~(size_t) 7)
+
+static bool ras_elf_needs_reloc(rasPatch* p) {
+    if (p->sym->type == SYM_EXTERNAL) return true;
+    return p->type == RAS_PATCH_ABS64 || p->type == RAS_PATCH_PGREL21 ||
+           p->type == RAS_PATCH_PGOFF12;
+}
+
+static u32 ras_elf_reloc_type(rasPatchType type, u32 inst) {
+    switch (type) {
+        case RAS_PATCH_ABS64:
+            return R_AARCH64_ABS64;
+        case RAS_PATCH_REL26:
+            return inst >> 31 ? R_AARCH64_CALL26 : R_AARCH64_JUMP26;
+        case RAS_PATCH_REL19:
+            // ldr literal or b.cond/cbz
+            return (inst & 0x3b000000) == 0x18000000 ? R_AARCH64_LD_PREL_LO19
+                                                     : R_AARCH64_CONDBR19;
+        case RAS_PATCH_REL14:
+            return R_AARCH64_TSTBR14;
+        case RAS_PATCH_REL21:
+            return R_AARCH64_ADR_PREL_LO21;
+        case RAS_PATCH_PGREL21:
+            return R_AARCH64_ADR_PREL_PG_HI21;
+        case RAS_PATCH_PGOFF12:
+            return R_AARCH64_ADD_ABS_LO12_NC;
+        case RAS_PATCH_TBL32:
+            // the addend moves the place back to the start of the table
+            return R_AARCH64_PREL32;
+        default:
+            break;
+    }
+    return 0;
+}
+
+// external labels with the same name share a symbol
+static int ras_elf_find(rasLabel* syms, size_t nsyms, rasLabel l) {
+    for (size_t i = 0; i < nsyms; i++) {
+        if (syms[i] == l) return i;
+        if (l->type == SYM_EXTERNAL && syms[i]->type == SYM_EXTERNAL &&
+            !strcmp(syms[i]->name, l->name))
+            return i;
+    }
+    return -1;
+}
+
+size_t rasWriteElf(rasBlock* ctx, void* buf, size_t size) {
+    rasMergeFragments(ctx);
+    size_t codeSize = ctx->curr - ctx->code;
+
+    size_t nlabels = 0;
+    for (typeof(ctx->symbols) n = ctx->symbols; n; n = n->next) {
+        for (int i = 0; i < n->count; i++) {
+            if (n->d[i].name) nlabels++;
+        }
+    }
+    rasLabel* syms = malloc((nlabels ? nlabels : 1) * sizeof *syms);
+    size_t nsyms = 0;
+    size_t strSize = 1;
+    for (typeof(ctx->symbols) n = ctx->symbols; n; n = n->next) {
+        for (int i = 0; i < n->count; i++) {
+            rasLabel l = &n->d[i];
+            if (!l->name || l->type == SYM_UNDEFINED) continue;
+            if (ras_elf_find(syms, nsyms, l) >= 0) continue;
+            syms[nsyms++] = l;
+            strSize += strlen(l->name) + 1;
+        }
+    }
+
+    size_t nrelas = 0;
+    for (typeof(ctx->patches) n = ctx->patches; n; n = n->next) {
+        for (int i = 0; i < n->count; i++) {
+            rasPatch* p = &n->d[i];
+            rasAssert(p->sym->type != SYM_UNDEFINED, RAS_ERR_UNDEF_LABEL);
+            rasAssert(p->sym->type != SYM_EXTERNAL || p->sym->name,
+                      RAS_ERR_UNNAMED_LABEL);
+            // there are no relocations for scaled 16 and 8 bit offsets
+            rasAssert(p->type < RAS_PATCH_TBL16 || p->sym->type != SYM_EXTERNAL,
+                      RAS_ERR_BAD_LABEL);
+            if (ras_elf_needs_reloc(p)) nrelas++;
+        }
+    }
+
+    // the null symbol and the .text section symbol come first
+    size_t textOff = TEXT_ALIGN;
+    size_t relaOff = ALIGN8(textOff + codeSize);
+    size_t symOff = relaOff + nrelas * sizeof(rasElfRela);
+    size_t strOff = symOff + (nsyms + 2) * sizeof(rasElfSymbol);
+    size_t shstrOff = strOff + strSize;
+    size_t shOff = ALIGN8(shstrOff + sizeof shstrtab);
+    size_t total = shOff + SEC_MAX * sizeof(rasElfSection);
+    if (size < total) {
+        free(syms);
+        return total;
+    }
+
+    u8* out = buf;
+    memset(out, 0, total);
+
+    *(rasElfHeader*) out = (rasElfHeader) {
+        .ident = {0x7f, 'E', 'L', 'F', 2, 1, 1},
+        .type = ET_REL,
+        .machine = EM_AARCH64,
+        .version = 1,
+        .shoff = shOff,
+        .ehsize = sizeof(rasElfHeader),
+        .shentsize = sizeof(rasElfSection),
+        .shnum = SEC_MAX,
+        .shstrndx = SEC_SHSTRTAB,
+    };
+
+    u8* text = out + textOff;
+    memcpy(text, ctx->code, codeSize);
+
+    rasElfSymbol* symtab = (rasElfSymbol*) (out + symOff);
+    char* strtab = (char*) (out + strOff);
+    size_t strPos = 1;
+    symtab[1].info = STT_SECTION;
+    symtab[1].shndx = SEC_TEXT;
+    for (size_t i = 0; i < nsyms; i++) {
+        rasElfSymbol* s = &symtab[i + 2];
+        s->name = strPos;
+        s->info = STB_GLOBAL << 4 | STT_NOTYPE;
+        if (syms[i]->type == SYM_INTERNAL) {
+            s->shndx = SEC_TEXT;
+            s->value = syms[i]->intOffset;
+        }
+        strcpy(strtab + strPos, syms[i]->name);
+        strPos += strlen(syms[i]->name) + 1;
+    }
+
+    rasElfRela* rela = (rasElfRela*) (out + relaOff);
+    for (typeof(ctx->patches) n = ctx->patches; n; n = n->next) {
+        for (int i = 0; i < n->count; i++) {
+            rasPatch* p = &n->d[i];
+            if (p->sym->type == SYM_UNDEFINED) continue;
+            if (!ras_elf_needs_reloc(p)) {
+                // branches within the code are resolved here
+                rasPatchAt(text + p->offset, p->offset - p->tbl,
+                           p->sym->intOffset, p->type);
+                continue;
+            }
+            u32 type = ras_elf_reloc_type(p->type, *(u32*) (text + p->offset));
+            u64 sym = SEC_TEXT;
+            rela->offset = p->offset;
+            if (p->sym->type == SYM_EXTERNAL) {
+                int idx = p->sym->name ? ras_elf_find(syms, nsyms, p->sym) : -1;
+                sym = idx + 2;
+                rela->addend = p->tbl;
+            } else {
+                rela->addend = p->sym->intOffset;
+            }
+            rela->info = sym << 32 | type;
+            rela++;
+            // the linker fills in the field
+            rasPatchAt(text + p->offset, 0, 0, p->type);
+        }
+    }
+
+    memcpy(out + shstrOff, shstrtab, sizeof shstrtab);
+
+    rasElfSection* sh = (rasElfSection*) (out + shOff);
+    sh[SEC_TEXT] = (rasElfSection) {shnames[SEC_TEXT], SHT_PROGBITS,
+                                    SHF_ALLOC | SHF_EXECINSTR, 0, textOff,
+                                    codeSize, 0, 0, TEXT_ALIGN, 0};
+    sh[SEC_RELA] = (rasElfSection) {shnames[SEC_RELA], SHT_RELA, SHF_INFO_LINK,
+                                    0, relaOff, nrelas * sizeof(rasElfRela),
+                                    SEC_SYMTAB, SEC_TEXT, 8, sizeof(rasElfRela)};
+    sh[SEC_SYMTAB] = (rasElfSection) {shnames[SEC_SYMTAB], SHT_SYMTAB, 0, 0,
+                                      symOff,
+                                      (nsyms + 2) * sizeof(rasElfSymbol),
+                                      SEC_STRTAB, 2, 8, sizeof(rasElfSymbol)};
+    sh[SEC_STRTAB] = (rasElfSection) {
+        shnames[SEC_STRTAB], SHT_STRTAB, 0, 0, strOff, strSize, 0, 0, 1, 0};
+    sh[SEC_SHSTRTAB] = (rasElfSection) {shnames[SEC_SHSTRTAB], SHT_STRTAB, 0, 0,
+                                        shstrOff, sizeof shstrtab, 0, 0, 1, 0};
+    sh[SEC_NOTE] = (rasElfSection) {
+        shnames[SEC_NOTE], SHT_PROGBITS, 0, 0, shstrOff, 0, 0, 0, 1, 0};
+
+    free(syms);
+    return total;
+}
+
+bool rasSaveElf(rasBlock* ctx, const char* path) {
+    size_t size = rasWriteElf(ctx, NULL, 0);
+    void* buf = malloc(size);
+    rasWriteElf(ctx, buf, size);
+    FILE* f = fopen(path, "wb");
+    bool ok = f && fwrite(buf, 1, size, f) == size;
+    if (f) ok &= fclose(f) == 0;
+    free(buf);
+    return ok;
+}
@@ -0,0 +1,203 @@
+#ifndef __RAS_IMPL_H
+#define __RAS_IMPL_H
+
+#include "ras.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+typedef int8_t s8;
+typedef uint8_t u8;
+typedef int16_t s16;
+typedef uint16_t u16;
+typedef int32_t s32;
+typedef uint32_t u32;
+typedef int64_t s64;
+typedef uint64_t u64;
+
+#define BIT(B) (1ull << (B))
+#define MASK(B) (BIT(B) - 1)
+#define ISNBITSU64(n, B) ((u64) (n) >> (B) == 0)
+#define ISNBITSS64(n, B)                                                       \
+    ((s64) (n) >> ((B) - 1) == 0 || (s64) (n) >> ((B) - 1) == -1)
+#define ISLOWBITS0(n, B) (((n) & MASK(B)) == 0)
+
+typedef enum {
+    SYM_UNDEFINED,
+    SYM_INTERNAL,
+    SYM_EXTERNAL,
+} rasSymbolType;
+
+typedef struct _rasSymbol {
+    rasSymbolType type;
+    union {
+        size_t intOffset;
+        void* extAddr;
+    };
+    // internal offsets are relative to this fragment until they are merged
+    u32 frag;
+    char* name;
+} rasSymbol;
+
+typedef struct _rasPatch {
+    rasPatchType type;
+    u32 frag;
+    size_t offset;
+    // distance from the start of the table for jump table entries
+    u32 tbl;
+    // a call to a label that wasn't defined yet, sent through a veneer if
+    // the label turns out to be external
+    bool veneer;
+    rasLabel sym;
+} rasPatch;
+
+typedef struct {
+    u8* code;
+    u8* curr;
+    size_t size;
+    size_t align;
+    bool cold;
+} rasFragmentBuf;
+
+#define LISTNODELEN 64
+
+#define LISTNODE(T)                                                            \
+    struct ListNode_##T {                                                      \
+        T d[LISTNODELEN];                                                      \
+        size_t count;                                                          \
+        struct ListNode_##T* next;                                             \
+    }*
+
+#define LISTNEXT(l)                                                            \
+    ({                                                                         \
+        if (!(l) || (l)->count == LISTNODELEN) {                               \
+            typeof(l) n = malloc(sizeof *n);                                   \
+            n->count = 0;                                                      \
+            n->next = (l);                                                     \
+            (l) = n;                                                           \
+        }                                                                      \
+        &(l)->d[(l)->count++];                                                 \
+    })
+
+#define LISTPOP(l)                                                             \
+    ({                                                                         \
+        typeof(l) tmp = (l)->next;                                             \
+        free(l);                                                               \
+        (l) = tmp;                                                             \
+    })
+
+typedef struct _rasProfile {
+    // page aligned so the low 12 bits of a counter address are known
+    u64* counters;
+    size_t maxCounters;
+    size_t count;
+    rasLabel* labels;
+    // external labels for each page of counters, created on first use
+    rasLabel* pages;
+    u8 tmp1;
+    u8 tmp2;
+    u32 flags;
+} rasProfile;
+
+typedef struct {
+    rasLabel ext;
+    // the table entry holding the address of ext
+    rasLabel slot;
+    // branches to ext go here in pic blocks
+    rasLabel veneer;
+} rasGotEntry;
+
+typedef struct _rasGot {
+    rasGotEntry* entries;
+    size_t count;
+    size_t capacity;
+    // patches before this have been checked for pic
+    size_t checkedPatches;
+} rasGot;
+
+typedef struct _rasBlock {
+
+    u8* code;
+    u8* curr;
+    size_t size;
+
+    rasAllocator alloc;
+    // memory from the caller that is never freed or grown
+    void* userBuf;
+    bool noExec;
+    // address the code runs at if it is not where it is written, or 0
+    uintptr_t vbase;
+
+    size_t initialSize;
+
+    LISTNODE(rasSymbol) symbols;
+    LISTNODE(rasPatch) patches;
+    size_t npatches;
+    size_t appliedPatches;
+
+    // called after every instruction written by rasEmit32
+    void (*emitHook)(rasBlock* ctx);
+    // instructions before this offset can no longer be rewritten
+    size_t barrier;
+    struct _rasPeephole* peephole;
+    rasProfile* profile;
+
+    bool pic;
+    rasGot* got;
+
+    // largest alignment passed to rasAlign, copies of the code have to start
+    // at a multiple of it
+    size_t maxAlign;
+
+    // the template being recorded, see rasBeginTemplate
+    struct _rasTemplate* tmpl;
+
+    rasStats stats;
+
+    // code is emitted into the active fragment through code/curr/size, the
+    // entry for it in frags is only updated when switching away
+    rasFragmentBuf* frags;
+    u32 nfrags;
+    u32 frag;
+    u32* fragOrder;
+    u32 nfragOrder;
+
+} rasBlock;
+
+#ifdef RAS_STATS
+#define RAS_COUNT(ctx, field, n) ((ctx)->stats.field += (n))
+#else
+#define RAS_COUNT(ctx, field, n) ((void) 0)
+#endif
+
+// sets up a block in memory the caller owns, and frees everything it uses
+// except the rasBlock itself
+void rasInitBlock(rasBlock* ctx, size_t initialSize,
+                  const rasAllocator* alloc);
+void rasReleaseBlock(rasBlock* ctx);
+
+// makes sure n more bytes fit, growing the code with RAS_AUTOGROW
+bool rasReserve(rasBlock* ctx, size_t n);
+
+// copies of the template being recorded are aligned to the largest alignment
+// used in it
+void rasTemplateAlign(rasBlock* ctx, size_t alignment);
+
+void rasPatchAt(void* patchaddr, uintptr_t pc, uintptr_t symaddr,
+                rasPatchType type);
+void rasApplyPatch(rasBlock* ctx, rasPatch p);
+uintptr_t rasGetLabelRunAddr(rasBlock* ctx, rasLabel l);
+void rasApplyAllPatches(rasBlock* ctx);
+// moves the code of a merged block to the heap and makes it a no-exec
+// block, for blocks that are only kept for their labels and patches
+void rasDetachCode(rasBlock* ctx);
+// changes the protection of the pages holding size bytes at offset, for
+// blocks other code keeps running from while part of them is written
+void rasProtectRange(rasBlock* ctx, size_t offset, size_t size, bool exec);
+// places the table entries and veneers that don't have a place yet
+void rasEmitGot(rasBlock* ctx);
+// from ras_verify_a64.c, rasReady checks every block with it when built
+// with RAS_VERIFY
+size_t rasVerifyA64(rasBlock* ctx, FILE* f);
+
+#endif
@@ -3,7 +3,7 @@
 
 #include "ras_macros_common.h"
 
-#define WORD(w) __EMIT(32, w)
+#define WORD(w) __EMIT(Word, w)
 #define DWORD(d)                                                               \
     _Generic(d,                                                                \
         rasLabel: __EMIT(AbsAddr, __FORCE(rasLabel, d)),                       \
@@ -342,6 +342,8 @@
 #define LDPX(rt, rt2, amod) LOADSTOREPAIR(0, 2, 1, rt, rt2, amod)
 #define PUSH(rt, rt2) STPX(rt, rt2, (SP, -0x10, PRE))
 #define POP(rt, rt2) LDPX(rt, rt2, (SP, 0x10, POST))
+#define PROLOGUE(f) __EMIT(PseudoPrologue, f)
+#define EPILOGUE(f) __EMIT(PseudoEpilogue, f)
 
 #define STPS(vt, vt2, amod) LOADSTOREPAIR(1, 0, 0, __V2R(vt), __V2R(vt2), amod)
 #define LDPS(vt, vt2, amod) LOADSTOREPAIR(1, 0, 1, __V2R(vt), __V2R(vt2), amod)
@@ -350,6 +352,45 @@
 #define STPQ(vt, vt2, amod) LOADSTOREPAIR(1, 2, 0, __V2R(vt), __V2R(vt2), amod)
 #define LDPQ(vt, vt2, amod) LOADSTOREPAIR(1, 2, 1, __V2R(vt), __V2R(vt2), amod)
 
+#define ATOMICMEMOP(size, a, r, o3, opc, rs, rt, amod)                         \
+    _ATOMICMEMOP(size, a, r, o3, opc, rs, rt, __EXPAND_AMOD(amod))
+#define _ATOMICMEMOP(size, a, r, o3, opc, rs, rt, amod)                        \
+    __ATOMICMEMOP(size, a, r, o3, opc, rs, rt, amod)
+#define __ATOMICMEMOP(size, a, r, o3, opc, rs, rt, rn, off, ...)               \
+    __EMIT(AtomicMemOp, size, a, r, rs, o3, opc, off, rn, rt)
+
+#define LDADDW(rs, rt, amod) ATOMICMEMOP(2, 0, 0, 0, 0, rs, rt, amod)
+#define LDADDALW(rs, rt, amod) ATOMICMEMOP(2, 1, 1, 0, 0, rs, rt, amod)
+#define LDCLRW(rs, rt, amod) ATOMICMEMOP(2, 0, 0, 0, 1, rs, rt, amod)
+#define LDCLRALW(rs, rt, amod) ATOMICMEMOP(2, 1, 1, 0, 1, rs, rt, amod)
+#define LDEORW(rs, rt, amod) ATOMICMEMOP(2, 0, 0, 0, 2, rs, rt, amod)
+#define LDEORALW(rs, rt, amod) ATOMICMEMOP(2, 1, 1, 0, 2, rs, rt, amod)
+#define LDSETW(rs, rt, amod) ATOMICMEMOP(2, 0, 0, 0, 3, rs, rt, amod)
+#define LDSETALW(rs, rt, amod) ATOMICMEMOP(2, 1, 1, 0, 3, rs, rt, amod)
+#define SWPW(rs, rt, amod) ATOMICMEMOP(2, 0, 0, 1, 0, rs, rt, amod)
+#define SWPALW(rs, rt, amod) ATOMICMEMOP(2, 1, 1, 1, 0, rs, rt, amod)
+#define LDADDX(rs, rt, amod) ATOMICMEMOP(3, 0, 0, 0, 0, rs, rt, amod)
+#define LDADDALX(rs, rt, amod) ATOMICMEMOP(3, 1, 1, 0, 0, rs, rt, amod)
+#define LDCLRX(rs, rt, amod) ATOMICMEMOP(3, 0, 0, 0, 1, rs, rt, amod)
+#define LDCLRALX(rs, rt, amod) ATOMICMEMOP(3, 1, 1, 0, 1, rs, rt, amod)
+#define LDEORX(rs, rt, amod) ATOMICMEMOP(3, 0, 0, 0, 2, rs, rt, amod)
+#define LDEORALX(rs, rt, amod) ATOMICMEMOP(3, 1, 1, 0, 2, rs, rt, amod)
+#define LDSETX(rs, rt, amod) ATOMICMEMOP(3, 0, 0, 0, 3, rs, rt, amod)
+#define LDSETALX(rs, rt, amod) ATOMICMEMOP(3, 1, 1, 0, 3, rs, rt, amod)
+#define SWPX(rs, rt, amod) ATOMICMEMOP(3, 0, 0, 1, 0, rs, rt, amod)
+#define SWPALX(rs, rt, amod) ATOMICMEMOP(3, 1, 1, 1, 0, rs, rt, amod)
+
+#define STADDW(rs, amod) ATOMICMEMOP(2, 0, 0, 0, 0, rs, ZR, amod)
+#define STADDLW(rs, amod) ATOMICMEMOP(2, 0, 1, 0, 0, rs, ZR, amod)
+#define STCLRW(rs, amod) ATOMICMEMOP(2, 0, 0, 0, 1, rs, ZR, amod)
+#define STEORW(rs, amod) ATOMICMEMOP(2, 0, 0, 0, 2, rs, ZR, amod)
+#define STSETW(rs, amod) ATOMICMEMOP(2, 0, 0, 0, 3, rs, ZR, amod)
+#define STADDX(rs, amod) ATOMICMEMOP(3, 0, 0, 0, 0, rs, ZR, amod)
+#define STADDLX(rs, amod) ATOMICMEMOP(3, 0, 1, 0, 0, rs, ZR, amod)
+#define STCLRX(rs, amod) ATOMICMEMOP(3, 0, 0, 0, 1, rs, ZR, amod)
+#define STEORX(rs, amod) ATOMICMEMOP(3, 0, 0, 0, 2, rs, ZR, amod)
+#define STSETX(rs, amod) ATOMICMEMOP(3, 0, 0, 0, 3, rs, ZR, amod)
+
 #define POST 1
 #define PRE 3
 
@@ -373,6 +414,32 @@
 #define TBZ(rt, B, l) BRANCHTESTIMM(0, rt, B, l)
 #define TBNZ(rt, B, l) BRANCHTESTIMM(1, rt, B, l)
 
+#define ARG(x)                                                                 \
+    _Generic(x,                                                                \
+        rasA64Reg: ((rasA64Arg) {RAS_ARG_REG, .reg = __FORCE(rasA64Reg, x)}),  \
+        rasLabel: ((rasA64Arg) {RAS_ARG_LABEL, .label = __FORCE(rasLabel, x)}), \
+        default: ((rasA64Arg) {RAS_ARG_IMM, .imm = __FORCE_IMM(x)}))
+#define ARGSP(off) ((rasA64Arg) {RAS_ARG_STACK, .spOffset = (off)})
+
+#define __ARGS(...) ((rasA64Arg[]) {__VA_ARGS__})
+#define __NARGS(...) (sizeof(__ARGS(__VA_ARGS__)) / sizeof(rasA64Arg))
+#define CALL(l, ...)                                                           \
+    __EMIT(PseudoCall, l, __NARGS(__VA_ARGS__), __ARGS(__VA_ARGS__), 0, NULL)
+#define TAILCALL(f, l, ...)                                                    \
+    __EMIT(PseudoCall, l, __NARGS(__VA_ARGS__), __ARGS(__VA_ARGS__), 1, f)
+
+#define __LABELS(...) ((rasLabel[]) {__VA_ARGS__})
+#define __NLABELS(...) (sizeof(__LABELS(__VA_ARGS__)) / sizeof(rasLabel))
+#define _SWITCH(type, idx, ldefault, ...)                                      \
+    __EMIT(PseudoSwitch, type, idx, ldefault, __NLABELS(__VA_ARGS__),          \
+           __LABELS(__VA_ARGS__))
+#define SWITCH(idx, ldefault, ...)                                             \
+    _SWITCH(RAS_PATCH_TBL32, idx, ldefault, __VA_ARGS__)
+#define SWITCH16(idx, ldefault, ...)                                           \
+    _SWITCH(RAS_PATCH_TBL16, idx, ldefault, __VA_ARGS__)
+#define SWITCH8(idx, ldefault, ...)                                            \
+    _SWITCH(RAS_PATCH_TBL8, idx, ldefault, __VA_ARGS__)
+
 #define BRANCHREG(opc, op2, op3, op4, rn)                                      \
     __EMIT(BranchReg, opc, op2, op3, rn, op4)
 
@@ -431,6 +498,8 @@
 #define _LNEW() rasDeclareLabel(RAS_CTX_VAR)
 #define _LNEWEXT(addr) rasDefineLabelExternal(_LNEW(), addr)
 #define L(l) rasDefineLabel(RAS_CTX_VAR, l)
+#define LPROF(l) rasDefineLabelProfiled(RAS_CTX_VAR, l)
+#define LDRGOT(rt, l) LDRLX(rt, rasGotLabel(RAS_CTX_VAR, l))
 #define LEXT(l, addr) rasDefineLabelExternal(l, addr)
 
 #define FPMOVEIMM(ftype, m, s, rd, fimm, imm5)                                 \
@@ -1160,6 +1229,21 @@
 #define LDRL _(LDRL)
 #define STP _(STP)
 #define LDP _(LDP)
+#define LDADD _(LDADD)
+#define LDADDAL _(LDADDAL)
+#define LDCLR _(LDCLR)
+#define LDCLRAL _(LDCLRAL)
+#define LDEOR _(LDEOR)
+#define LDEORAL _(LDEORAL)
+#define LDSET _(LDSET)
+#define LDSETAL _(LDSETAL)
+#define SWP _(SWP)
+#define SWPAL _(SWPAL)
+#define STADD _(STADD)
+#define STADDL _(STADDL)
+#define STCLR _(STCLR)
+#define STEOR _(STEOR)
+#define STSET _(STSET)
 #define CBZ _(CBZ)
 #define CBNZ _(CBNZ)
 
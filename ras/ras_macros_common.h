@@ -39,5 +39,16 @@ extern void* _ras_invalid_argument_type;
         default: *(int*) _ras_invalid_argument_type)
 
 #define ALIGN(a) rasAlign(RAS_CTX_VAR, a)
+#define FRAGMENT(f) rasSwitchFragment(RAS_CTX_VAR, f)
+
+#define TABLE32(base, l)                                                       \
+    rasEmitTableEntry(RAS_CTX_VAR, RAS_PATCH_TBL32, base, l)
+#define TABLE16(base, l)                                                       \
+    rasEmitTableEntry(RAS_CTX_VAR, RAS_PATCH_TBL16, base, l)
+#define TABLE8(base, l) rasEmitTableEntry(RAS_CTX_VAR, RAS_PATCH_TBL8, base, l)
+
+#define HOLE(type, arg) rasTemplateHole(RAS_CTX_VAR, RAS_HOLE_##type, arg)
+#define HOLELABEL(l, arg) rasTemplateLabel(RAS_CTX_VAR, l, arg)
+#define TEMPLATE(t, args, labels) rasEmitTemplate(RAS_CTX_VAR, t, args, labels)
 
 #endif
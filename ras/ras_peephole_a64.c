@@ -0,0 +1,296 @@
+#include "ras_a64.h"
+#include "ras_impl.h"
+
+#include <string.h>
+
+typedef struct _rasPeephole {
+    u32 flags;
+    rasPeepholeStats stats;
+} rasPeephole;
+
+#define INST(o) (*(u32*) (ctx->code + (o)))
+
+#define RT(w) ((w) & 0x1f)
+#define RN(w) (((w) >> 5) & 0x1f)
+#define RM(w) (((w) >> 16) & 0x1f)
+
+static bool ras_patched(rasBlock* ctx, size_t off) {
+    for (typeof(ctx->patches) n = ctx->patches; n; n = n->next) {
+        for (int i = n->count - 1; i >= 0; i--) {
+            // patches in other fragments are older than the window
+            if (n->d[i].frag != ctx->frag) return false;
+            if (n->d[i].offset == off) return true;
+            if (n->d[i].offset < off) return false;
+        }
+    }
+    return false;
+}
+
+static rasPatch* ras_last_patch(rasBlock* ctx, size_t off) {
+    if (!ctx->patches || !ctx->patches->count) return NULL;
+    rasPatch* p = &ctx->patches->d[ctx->patches->count - 1];
+    return p->frag == ctx->frag && p->offset == off ? p : NULL;
+}
+
+static void ras_delete(rasBlock* ctx, size_t off) {
+    size_t end = ctx->curr - ctx->code;
+    memmove(ctx->code + off, ctx->code + off + 4, end - off - 4);
+    ctx->curr -= 4;
+    for (typeof(ctx->patches) n = ctx->patches; n; n = n->next) {
+        for (int i = n->count - 1; i >= 0; i--) {
+            if (n->d[i].frag != ctx->frag || n->d[i].offset <= off) return;
+            n->d[i].offset -= 4;
+        }
+    }
+}
+
+// load/store of a gpr without writeback: unsigned offset, unscaled or
+// register offset
+static bool ras_is_ldst(u32 w) {
+    if (w & BIT(26)) return false;
+    return (w & 0x3b000000) == 0x39000000 ||
+           (w & 0x3b200c00) == 0x38200800 || (w & 0x3b200c00) == 0x38000000;
+}
+
+static bool ras_ldst_same_addr(u32 a, u32 b) {
+    return (a & ~0x00c0001f) == (b & ~0x00c0001f);
+}
+
+static bool ras_ldst_uses(u32 w, u32 r) {
+    if (RN(w) == r) return true;
+    return (w & 0x3b200c00) == 0x38200800 && RM(w) == r;
+}
+
+#define LDST_SIZE(w) ((w) >> 30)
+#define LDST_OPC(w) (((w) >> 22) & 3)
+#define IS_PRFM(w) (LDST_SIZE(w) == 3 && LDST_OPC(w) == 2)
+
+static bool ras_peep_mem(rasBlock* ctx, size_t o0, size_t o1) {
+    u32 i0 = INST(o0);
+    u32 i1 = INST(o1);
+    if (!ras_is_ldst(i0) || !ras_is_ldst(i1)) return false;
+    if (!ras_ldst_same_addr(i0, i1)) return false;
+    u32 t0 = RT(i0);
+    u32 t1 = RT(i1);
+    u32 op0 = LDST_OPC(i0);
+    u32 op1 = LDST_OPC(i1);
+
+    if (op0 == 0 && op1 == 0) {
+        // the second store overwrites the first
+        ras_delete(ctx, o0);
+        return true;
+    }
+    if (t0 != t1 || t0 == 31 || ras_ldst_uses(i0, t0)) return false;
+    if (op0 == 0 && op1 == 1) {
+        // reload of a stored value only needs the truncation
+        switch (LDST_SIZE(i0)) {
+            case 0:
+                INST(o1) = 0x53001c00 | t0 << 5 | t0;
+                break;
+            case 1:
+                INST(o1) = 0x53003c00 | t0 << 5 | t0;
+                break;
+            case 2:
+                INST(o1) = 0x2a0003e0 | t0 << 16 | t0;
+                break;
+            case 3:
+                ras_delete(ctx, o1);
+                break;
+        }
+        return true;
+    }
+    if (op0 == 1 && op1 == 0) {
+        // storing back a value that was just loaded
+        ras_delete(ctx, o1);
+        return true;
+    }
+    if (i0 == i1 && op0 != 0 && !IS_PRFM(i0)) {
+        ras_delete(ctx, o1);
+        return true;
+    }
+    return false;
+}
+
+// mov forms: orr rd, zr, rm (0), add rd, rn, #0 (1)
+static int ras_mov_form(u32 w) {
+    if ((w & 0x7fe0ffe0) == 0x2a0003e0) return 0;
+    if ((w & 0x7ffffc00) == 0x11000000) return 1;
+    return -1;
+}
+
+// instructions that only write rd without reading any register
+static bool ras_is_movimm(u32 w) {
+    return (w & 0x7f800000) == 0x52800000 || (w & 0x7f800000) == 0x12800000 ||
+           (w & 0x7f8003e0) == 0x320003e0;
+}
+
+static bool ras_peep_mov(rasBlock* ctx, size_t o0, size_t o1) {
+    u32 i0 = INST(o0);
+    u32 i1 = INST(o1);
+    int f0 = ras_mov_form(i0);
+    int f1 = ras_mov_form(i1);
+    u32 src1 = f1 == 0 ? RM(i1) : RN(i1);
+    if (ras_patched(ctx, o0) || ras_patched(ctx, o1)) return false;
+
+    if (f1 >= 0 && (i1 >> 31) && RT(i1) == src1) {
+        // 64 bit mov to itself
+        ras_delete(ctx, o1);
+        return true;
+    }
+    if (f0 < 0 && !ras_is_movimm(i0)) return false;
+    u32 d0 = RT(i0);
+    if (d0 == 31) return false;
+    if ((f1 >= 0 && RT(i1) == d0 && src1 != d0) ||
+        (ras_is_movimm(i1) && RT(i1) == d0)) {
+        // first mov is overwritten before being read
+        ras_delete(ctx, o0);
+        return true;
+    }
+    if (f0 >= 0 && f0 == f1 && (i0 >> 31) && (i1 >> 31)) {
+        u32 src0 = f0 == 0 ? RM(i0) : RN(i0);
+        if (RT(i1) == src0 && src1 == d0) {
+            // mov a, b; mov b, a
+            ras_delete(ctx, o1);
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool ras_is_uxt(u32 w, u32 r) {
+    return (w == (0x53001c00 | r << 5 | r)) || (w == (0x53003c00 | r << 5 | r));
+}
+
+static bool ras_peep_ext(rasBlock* ctx, size_t om1, size_t o0, size_t o1) {
+    u32 im1 = INST(om1);
+    u32 i0 = INST(o0);
+    u32 r = RT(im1);
+    // uxt r; add/sub r, r, #imm; uxt r -> the first truncation is redundant
+    if (im1 != INST(o1) || !ras_is_uxt(im1, r) || r == 31) return false;
+    if ((i0 & 0x3f800000) != 0x11000000) return false;
+    if (RT(i0) != r || RN(i0) != r) return false;
+    ras_delete(ctx, om1);
+    return true;
+}
+
+static bool ras_peep_branch(rasBlock* ctx, size_t o0, size_t o1) {
+    u32 i0 = INST(o0);
+    u32 i1 = INST(o1);
+    if ((i1 & 0xff000010) != 0x54000000) return false;
+    rasPatch* p = ras_last_patch(ctx, o1);
+    if (!p || ras_patched(ctx, o0)) return false;
+    u32 cond = i1 & 0xf;
+    u32 sf = i0 >> 31;
+    u32 rn = RN(i0);
+    if (rn == 31) return false;
+
+    u32 bit;
+    if ((i0 & 0x7ffffc1f) == 0x7100001f) {
+        // cmp rn, #0
+        if (cond == EQ || cond == NE) {
+            INST(o0) = (cond == NE) << 24 | sf << 31 | 0x34000000 | rn;
+            ras_delete(ctx, o1);
+            p->offset = o0;
+            return true;
+        }
+        if (cond != LT && cond != GE) return false;
+        bit = sf ? 63 : 31;
+        cond = cond == LT ? NE : EQ;
+    } else if ((i0 & 0x7f80fc1f) == 0x7200001f && ((i0 >> 22) & 1) == sf) {
+        // tst rn, #(1 << bit)
+        u32 immr = (i0 >> 16) & 0x3f;
+        bit = sf ? (64 - immr) & 63 : (32 - immr) & 31;
+        if (cond != EQ && cond != NE) return false;
+    } else {
+        return false;
+    }
+
+    // tbz only reaches 32KB so only fold backwards branches known to fit
+    if (p->sym->type != SYM_INTERNAL || p->sym->frag != ctx->frag) return false;
+    s64 rel = (s64) p->sym->intOffset - (s64) o0;
+    if (!ISNBITSS64(rel >> 2, 14)) return false;
+    INST(o0) = (bit >> 5) << 31 | (cond == NE) << 24 | (bit & 0x1f) << 19 |
+               0x36000000 | rn;
+    ras_delete(ctx, o1);
+    p->offset = o0;
+    p->type = RAS_PATCH_REL14;
+    return true;
+}
+
+static bool ras_peep_addr(rasBlock* ctx, size_t o0, size_t o1) {
+    u32 i0 = INST(o0);
+    u32 i1 = INST(o1);
+    // integer load with unsigned offset through the register just computed
+    if ((i1 & 0x3f000000) != 0x39000000 || LDST_OPC(i1) == 0 || IS_PRFM(i1))
+        return false;
+    u32 d = RT(i0);
+    if (d == 31 || RT(i1) != d || RN(i1) != d) return false;
+    if (ras_patched(ctx, o0)) return false;
+    u32 size = LDST_SIZE(i1);
+    u32 off = ((i1 >> 10) & 0xfff) << size;
+
+    if ((i0 & 0xff800000) == 0x91000000) {
+        // add xd, xn, #imm
+        u32 imm = ((i0 >> 10) & 0xfff) << ((i0 >> 22) & 1 ? 12 : 0);
+        off += imm;
+        if (!ISLOWBITS0(off, size) || !ISNBITSU64(off >> size, 12))
+            return false;
+        INST(o0) = (i1 & ~0x003fffe0) | (off >> size) << 10 | RN(i0) << 5;
+    } else if ((i0 & 0xffe00000) == 0x8b000000) {
+        // add xd, xn, xm, lsl #0 or lsl #size
+        u32 amt = (i0 >> 10) & 0x3f;
+        if (off || RN(i0) == 31 || (amt != 0 && amt != size)) return false;
+        INST(o0) = LDST_SIZE(i1) << 30 | LDST_OPC(i1) << 22 | RM(i0) << 16 |
+                   (amt != 0) << 12 | RN(i0) << 5 | RT(i1) | 0x38206800;
+    } else {
+        return false;
+    }
+    ras_delete(ctx, o1);
+    return true;
+}
+
+static void ras_peephole(rasBlock* ctx) {
+    rasPeephole* peep = ctx->peephole;
+    for (;;) {
+        size_t end = ctx->curr - ctx->code;
+        if (end < ctx->barrier + 8) return;
+        size_t o1 = end - 4;
+        size_t o0 = end - 8;
+        size_t om1 = end - 12;
+
+        size_t* stat;
+        if ((peep->flags & RAS_PEEPHOLE_MEM) && ras_peep_mem(ctx, o0, o1)) {
+            stat = &peep->stats.mem;
+        } else if ((peep->flags & RAS_PEEPHOLE_MOV) &&
+                   (ras_peep_mov(ctx, o0, o1) ||
+                    (o0 >= ctx->barrier + 4 &&
+                     ras_peep_ext(ctx, om1, o0, o1)))) {
+            stat = &peep->stats.mov;
+        } else if ((peep->flags & RAS_PEEPHOLE_BRANCH) &&
+                   ras_peep_branch(ctx, o0, o1)) {
+            stat = &peep->stats.branch;
+        } else if ((peep->flags & RAS_PEEPHOLE_ADDR) &&
+                   ras_peep_addr(ctx, o0, o1)) {
+            stat = &peep->stats.addr;
+        } else {
+            return;
+        }
+        size_t removed = (end - (ctx->curr - ctx->code)) / 4;
+        *stat += removed;
+        peep->stats.removed += removed;
+        // a rewrite that removes nothing cannot enable further rewrites
+        if (!removed) return;
+    }
+}
+
+void rasEnablePeephole(rasBlock* ctx, u32 flags) {
+    if (!ctx->peephole) ctx->peephole = calloc(1, sizeof(rasPeephole));
+    ctx->peephole->flags = flags;
+    ctx->emitHook = flags ? ras_peephole : NULL;
+    ctx->barrier = ctx->curr - ctx->code;
+}
+
+rasPeepholeStats rasGetPeepholeStats(rasBlock* ctx) {
+    if (!ctx->peephole) return (rasPeepholeStats) {};
+    return ctx->peephole->stats;
+}
@@ -0,0 +1,133 @@
+#include "ras_a64.h"
+#include "ras_impl.h"
+
+#include <string.h>
+
+void rasEnablePIC(rasBlock* ctx) {
+    ctx->pic = true;
+}
+
+static rasGotEntry* ras_got_entry(rasBlock* ctx, rasLabel ext) {
+    rasGot* got = ctx->got;
+    if (!got) got = ctx->got = calloc(1, sizeof *got);
+    for (size_t i = 0; i < got->count; i++) {
+        if (got->entries[i].ext == ext) return &got->entries[i];
+    }
+    if (got->count == got->capacity) {
+        got->capacity = got->capacity ? got->capacity * 2 : 16;
+        got->entries =
+            realloc(got->entries, got->capacity * sizeof *got->entries);
+    }
+    rasGotEntry* e = &got->entries[got->count++];
+    e->ext = ext;
+    e->slot = rasDeclareLabel(ctx);
+    e->veneer = NULL;
+    return e;
+}
+
+rasLabel rasGotLabel(rasBlock* ctx, rasLabel ext) {
+    return ras_got_entry(ctx, ext)->slot;
+}
+
+// ldr literal shares REL19 with b.cond/cbz
+static bool ras_is_literal_load(rasBlock* ctx, rasPatch* p) {
+    u8* code = p->frag == ctx->frag ? ctx->code : ctx->frags[p->frag].code;
+    return (*(u32*) (code + p->offset) & 0x3b000000) == 0x18000000;
+}
+
+static void ras_got_veneer(rasBlock* ctx, rasPatch* p) {
+    rasGotEntry* e = ras_got_entry(ctx, p->sym);
+    if (!e->veneer) e->veneer = rasDeclareLabel(ctx);
+    p->sym = e->veneer;
+}
+
+// checks the patches added since the last call and sends branches to
+// external labels through a veneer that loads the address from the table.
+// outside pic blocks only calls emitted before their target was defined are
+// checked
+static void ras_got_check(rasBlock* ctx) {
+    rasGot* got = ctx->got;
+    size_t todo = ctx->npatches - (got ? got->checkedPatches : 0);
+    for (typeof(ctx->patches) n = ctx->patches; n && todo; n = n->next) {
+        for (int i = n->count - 1; i >= 0 && todo; i--, todo--) {
+            rasPatch* p = &n->d[i];
+            if (!ctx->pic) {
+                if (p->veneer && p->sym->type == SYM_EXTERNAL)
+                    ras_got_veneer(ctx, p);
+                continue;
+            }
+            if (p->sym->type == SYM_INTERNAL) {
+                rasAssert(p->type != RAS_PATCH_ABS64, RAS_ERR_NOT_PIC);
+                continue;
+            }
+            if (p->sym->type != SYM_EXTERNAL) continue;
+            switch (p->type) {
+                case RAS_PATCH_ABS64:
+                    break;
+                case RAS_PATCH_REL19:
+                    // a veneer would load its own instructions, the
+                    // address has to come from LDRGOT
+                    if (ras_is_literal_load(ctx, p)) {
+                        rasAssert(false, RAS_ERR_NOT_PIC);
+                        break;
+                    }
+                    // fallthrough
+                case RAS_PATCH_REL26:
+                case RAS_PATCH_REL14:
+                    ras_got_veneer(ctx, p);
+                    break;
+                default:
+                    rasAssert(false, RAS_ERR_NOT_PIC);
+                    break;
+            }
+        }
+    }
+}
+
+void rasEmitGot(rasBlock* ctx) {
+    ras_got_check(ctx);
+    rasGot* got = ctx->got;
+    if (!got) return;
+
+    bool pending = false;
+    for (size_t i = 0; i < got->count; i++) {
+        pending |= got->entries[i].slot->type == SYM_UNDEFINED;
+    }
+    if (pending) {
+        // the table goes at the end of the hot code
+        if (ctx->frags) rasSwitchFragment(ctx, 0);
+        for (size_t i = 0; i < got->count; i++) {
+            rasGotEntry* e = &got->entries[i];
+            if (!e->veneer || e->veneer->type != SYM_UNDEFINED) continue;
+            L(e->veneer);
+            LDRLX(IP1, e->slot);
+            BR(IP1);
+        }
+        ALIGN(8);
+        for (size_t i = 0; i < got->count; i++) {
+            rasGotEntry* e = &got->entries[i];
+            if (e->slot->type != SYM_UNDEFINED) continue;
+            L(e->slot);
+            DWORD(e->ext);
+        }
+    }
+    got->checkedPatches = ctx->npatches;
+}
+
+void rasWriteGot(rasBlock* ctx, void* code, rasResolver resolve,
+                 void* userdata) {
+    rasGot* got = ctx->got;
+    if (!got) return;
+    for (size_t i = 0; i < got->count; i++) {
+        rasGotEntry* e = &got->entries[i];
+        if (e->slot->type != SYM_INTERNAL) continue;
+        void* addr = e->ext->extAddr;
+        if (resolve) {
+            rasAssert(e->ext->name != NULL, RAS_ERR_UNNAMED_LABEL);
+            if (!e->ext->name) continue;
+            addr = resolve(e->ext->name, userdata);
+            rasAssert(addr != NULL, RAS_ERR_UNDEF_LABEL);
+        }
+        memcpy((u8*) code + e->slot->intOffset, &addr, sizeof addr);
+    }
+}
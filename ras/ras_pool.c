@@ -0,0 +1,195 @@
+#include "ras_impl.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#define SLAB_SIZE (256 << 10)
+#define CHUNK_ALIGN 16
+
+enum {
+    CHUNK_FREE,
+    // between rasPoolGet or rasUnready and rasReady
+    CHUNK_WRITABLE,
+    CHUNK_EXEC,
+};
+
+typedef struct {
+    u8* mem;
+    size_t size;
+    // bytes handed out as chunks so far
+    size_t used;
+    // writable and executable chunks on each page, a page is only made
+    // executable when it has no writable chunks
+    u16* writers;
+    u16* execs;
+    bool* pageExec;
+    u8* chunkState;
+} rasSlab;
+
+struct _rasBlockPool {
+    size_t chunkSize;
+    size_t slabSize;
+    size_t pageSize;
+    rasSlab* slabs;
+    size_t nslabs;
+    u8** freeChunks;
+    size_t nfreeChunks;
+    size_t freeChunksCap;
+    rasBlock** freeBlocks;
+    size_t nfreeBlocks;
+    size_t freeBlocksCap;
+    rasAllocator alloc;
+};
+
+static rasSlab* ras_pool_slab(rasBlockPool* pool, u8* code) {
+    for (size_t i = 0; i < pool->nslabs; i++) {
+        rasSlab* s = &pool->slabs[i];
+        if (code >= s->mem && code < s->mem + s->size) return s;
+    }
+    return NULL;
+}
+
+static void ras_pool_mprotect(rasBlockPool* pool, rasSlab* s, size_t page,
+                              bool exec) {
+    s->pageExec[page] = exec;
+#ifndef RAS_USE_RWX
+    mprotect(s->mem + page * pool->pageSize, pool->pageSize,
+             exec ? PROT_READ | PROT_EXEC : PROT_READ | PROT_WRITE);
+#endif
+}
+
+// moves a chunk between states and fixes the protection of its pages
+static void ras_pool_set_state(rasBlockPool* pool, rasSlab* s, u8* code,
+                               u8 state) {
+    size_t idx = (code - s->mem) / pool->chunkSize;
+    u8 old = s->chunkState[idx];
+    if (old == state) return;
+    s->chunkState[idx] = state;
+    int writers = (state == CHUNK_WRITABLE) - (old == CHUNK_WRITABLE);
+    int execs = (state == CHUNK_EXEC) - (old == CHUNK_EXEC);
+    size_t first = (code - s->mem) / pool->pageSize;
+    size_t last = (code - s->mem + pool->chunkSize - 1) / pool->pageSize;
+    for (size_t p = first; p <= last; p++) {
+        s->writers[p] += writers;
+        s->execs[p] += execs;
+        // pages with only free chunks are left as they are
+        if (s->writers[p] && s->pageExec[p]) {
+            ras_pool_mprotect(pool, s, p, false);
+        } else if (!s->writers[p] && s->execs[p] && !s->pageExec[p]) {
+            ras_pool_mprotect(pool, s, p, true);
+        }
+    }
+}
+
+static rasSlab* ras_pool_new_slab(rasBlockPool* pool) {
+    pool->slabs = realloc(pool->slabs, (pool->nslabs + 1) * sizeof(rasSlab));
+    rasSlab* s = &pool->slabs[pool->nslabs++];
+    s->size = pool->slabSize;
+    s->mem = rasMmapAllocator.alloc(&s->size, NULL);
+    s->used = 0;
+    size_t pages = s->size / pool->pageSize;
+    s->writers = calloc(pages, sizeof *s->writers);
+    s->execs = calloc(pages, sizeof *s->execs);
+    s->pageExec = calloc(pages, sizeof *s->pageExec);
+    s->chunkState = calloc(s->size / pool->chunkSize, 1);
+    return s;
+}
+
+static void* ras_pool_alloc(size_t* size, void* userdata) {
+    rasBlockPool* pool = userdata;
+    // blocks that grow get pages of their own
+    if (*size > pool->chunkSize) return rasMmapAllocator.alloc(size, NULL);
+    *size = pool->chunkSize;
+
+    u8* code;
+    if (pool->nfreeChunks) {
+        code = pool->freeChunks[--pool->nfreeChunks];
+    } else {
+        rasSlab* s = pool->nslabs ? &pool->slabs[pool->nslabs - 1] : NULL;
+        if (!s || s->used + pool->chunkSize > s->size)
+            s = ras_pool_new_slab(pool);
+        code = s->mem + s->used;
+        s->used += pool->chunkSize;
+    }
+    rasSlab* s = ras_pool_slab(pool, code);
+    ras_pool_set_state(pool, s, code, CHUNK_WRITABLE);
+    return code;
+}
+
+static void ras_pool_free(void* code, size_t size, void* userdata) {
+    rasBlockPool* pool = userdata;
+    rasSlab* s = ras_pool_slab(pool, code);
+    if (!s) {
+        rasMmapAllocator.free(code, size, NULL);
+        return;
+    }
+    ras_pool_set_state(pool, s, code, CHUNK_FREE);
+    if (pool->nfreeChunks == pool->freeChunksCap) {
+        pool->freeChunksCap =
+            pool->freeChunksCap ? pool->freeChunksCap * 2 : 64;
+        pool->freeChunks =
+            realloc(pool->freeChunks, pool->freeChunksCap * sizeof(u8*));
+    }
+    pool->freeChunks[pool->nfreeChunks++] = code;
+}
+
+static void ras_pool_protect(void* code, size_t size, bool exec,
+                             void* userdata) {
+    rasBlockPool* pool = userdata;
+    rasSlab* s = ras_pool_slab(pool, code);
+    if (!s) {
+        rasMmapAllocator.protect(code, size, exec, NULL);
+        return;
+    }
+    ras_pool_set_state(pool, s, code, exec ? CHUNK_EXEC : CHUNK_WRITABLE);
+}
+
+rasBlockPool* rasCreateBlockPool(size_t blockSize) {
+    rasBlockPool* pool = calloc(1, sizeof *pool);
+    pool->pageSize = sysconf(_SC_PAGESIZE);
+    pool->chunkSize =
+        (blockSize + CHUNK_ALIGN - 1) & ~(size_t) (CHUNK_ALIGN - 1);
+    // at least 16 blocks per slab
+    size_t slabSize = (pool->chunkSize * 16 + pool->pageSize - 1) &
+                      ~(pool->pageSize - 1);
+    pool->slabSize = slabSize > SLAB_SIZE ? slabSize : SLAB_SIZE;
+    pool->alloc = (rasAllocator) {ras_pool_alloc, ras_pool_free,
+                                  ras_pool_protect, pool};
+    return pool;
+}
+
+void rasDestroyBlockPool(rasBlockPool* pool) {
+    for (size_t i = 0; i < pool->nfreeBlocks; i++) free(pool->freeBlocks[i]);
+    for (size_t i = 0; i < pool->nslabs; i++) {
+        rasSlab* s = &pool->slabs[i];
+        rasMmapAllocator.free(s->mem, s->size, NULL);
+        free(s->writers);
+        free(s->execs);
+        free(s->pageExec);
+        free(s->chunkState);
+    }
+    free(pool->slabs);
+    free(pool->freeChunks);
+    free(pool->freeBlocks);
+    free(pool);
+}
+
+rasBlock* rasPoolGet(rasBlockPool* pool) {
+    rasBlock* ctx = pool->nfreeBlocks ? pool->freeBlocks[--pool->nfreeBlocks]
+                                      : malloc(sizeof *ctx);
+    rasInitBlock(ctx, pool->chunkSize, &pool->alloc);
+    return ctx;
+}
+
+void rasPoolPut(rasBlockPool* pool, rasBlock* ctx) {
+    rasReleaseBlock(ctx);
+    if (pool->nfreeBlocks == pool->freeBlocksCap) {
+        pool->freeBlocksCap =
+            pool->freeBlocksCap ? pool->freeBlocksCap * 2 : 64;
+        pool->freeBlocks =
+            realloc(pool->freeBlocks, pool->freeBlocksCap * sizeof(rasBlock*));
+    }
+    pool->freeBlocks[pool->nfreeBlocks++] = ctx;
+}
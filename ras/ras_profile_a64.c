@@ -0,0 +1,123 @@
+#include "ras_a64.h"
+#include "ras_impl.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#define COUNTERS_PER_PAGE 512
+
+void rasEnableProfiling(rasBlock* ctx, size_t maxCounters, rasA64Reg tmp1,
+                        rasA64Reg tmp2, u32 flags) {
+    rasProfile* prof = ctx->profile;
+    if (!prof) {
+        prof = ctx->profile = calloc(1, sizeof *prof);
+        // mmap can't map 0 bytes
+        if (!maxCounters) maxCounters = 1;
+        maxCounters = (maxCounters + COUNTERS_PER_PAGE - 1) &
+                      ~(size_t) (COUNTERS_PER_PAGE - 1);
+        // the counters are reached with adrp so they have to be near the code
+        prof->counters =
+            mmap(ctx->code, maxCounters * sizeof(u64), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANON, -1, 0);
+        if (prof->counters == MAP_FAILED) {
+            perror("mmap");
+            abort();
+        }
+        prof->maxCounters = maxCounters;
+        prof->labels = calloc(maxCounters, sizeof *prof->labels);
+        prof->pages =
+            calloc(maxCounters / COUNTERS_PER_PAGE, sizeof *prof->pages);
+    }
+    prof->tmp1 = tmp1.idx;
+    prof->tmp2 = tmp2.idx;
+    prof->flags = flags;
+}
+
+rasLabel rasDefineLabelProfiled(rasBlock* ctx, rasLabel l) {
+    rasDefineLabel(ctx, l);
+    rasProfile* prof = ctx->profile;
+    if (!prof) return l;
+    rasAssert(prof->count < prof->maxCounters, RAS_ERR_PROFILE_FULL);
+    if (prof->count == prof->maxCounters) return l;
+
+    size_t idx = prof->count++;
+    prof->labels[idx] = l;
+    rasLabel* page = &prof->pages[idx / COUNTERS_PER_PAGE];
+    if (!*page) {
+        *page = rasDefineLabelExternal(
+            rasDeclareLabel(ctx),
+            prof->counters + (idx & ~(size_t) (COUNTERS_PER_PAGE - 1)));
+    }
+    u32 off = (idx % COUNTERS_PER_PAGE) * sizeof(u64);
+
+    rasA64Reg tmp1 = R(prof->tmp1), tmp2 = R(prof->tmp2);
+    ADRP(tmp1, *page);
+    if (prof->flags & RAS_PROFILE_ATOMIC) {
+        if (off) ADDX(tmp1, tmp1, off);
+        MOVX(tmp2, 1);
+        STADDX(tmp2, (tmp1));
+    } else {
+        LDRX(tmp2, (tmp1, off));
+        ADDX(tmp2, tmp2, 1);
+        STRX(tmp2, (tmp1, off));
+    }
+    // the peephole pass must not merge the counter code with what follows
+    ctx->barrier = ctx->curr - ctx->code;
+    return l;
+}
+
+u64 rasGetProfileCount(rasBlock* ctx, rasLabel l) {
+    rasProfile* prof = ctx->profile;
+    if (!prof) return 0;
+    for (size_t i = 0; i < prof->count; i++) {
+        if (prof->labels[i] == l) return prof->counters[i];
+    }
+    return 0;
+}
+
+static int ras_entry_cmp(const void* a, const void* b) {
+    u64 ca = ((rasProfileEntry*) a)->count;
+    u64 cb = ((rasProfileEntry*) b)->count;
+    return (ca < cb) - (ca > cb);
+}
+
+size_t rasGetProfile(rasBlock* ctx, rasProfileEntry* entries, size_t max) {
+    rasProfile* prof = ctx->profile;
+    if (!prof) return 0;
+    rasProfileEntry* all =
+        malloc((prof->count ? prof->count : 1) * sizeof *all);
+    for (size_t i = 0; i < prof->count; i++) {
+        all[i] = (rasProfileEntry) {prof->labels[i], prof->counters[i]};
+    }
+    qsort(all, prof->count, sizeof *all, ras_entry_cmp);
+    memcpy(entries, all, (max < prof->count ? max : prof->count) * sizeof *all);
+    free(all);
+    return prof->count;
+}
+
+void rasResetProfile(rasBlock* ctx) {
+    rasProfile* prof = ctx->profile;
+    if (!prof) return;
+    memset(prof->counters, 0, prof->count * sizeof(u64));
+}
+
+void rasDumpProfile(rasBlock* ctx, FILE* f) {
+    rasProfile* prof = ctx->profile;
+    if (!prof) return;
+    rasProfileEntry* entries =
+        malloc((prof->count ? prof->count : 1) * sizeof *entries);
+    size_t n = rasGetProfile(ctx, entries, prof->count);
+    for (size_t i = 0; i < n; i++) {
+        rasLabel l = entries[i].label;
+        if (l->name) {
+            fprintf(f, "%12llu  %s\n", (unsigned long long) entries[i].count,
+                    l->name);
+        } else {
+            fprintf(f, "%12llu  +%zx\n", (unsigned long long) entries[i].count,
+                    l->intOffset);
+        }
+    }
+    free(entries);
+}
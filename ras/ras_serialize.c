@@ -0,0 +1,219 @@
+#define _GNU_SOURCE
+#include "ras_impl.h"
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// file layout: header, code padded to 8 bytes, relocations, names
+#define RAS_MAGIC 0x31534152 // "RAS1"
+
+typedef struct {
+    u32 magic;
+    u32 nrelocs;
+    u64 codeSize;
+    u64 namesSize;
+} rasFileHeader;
+
+typedef struct {
+    u32 type;
+    u32 external;
+    u64 offset;
+    // offset of the target in the code or of the name of an external label
+    u64 target;
+} rasFileReloc;
+
+#define ALIGN8(n) (((n) + 7) & ~(size_t) 7)
+
+static bool ras_needs_reloc(rasPatch* p) {
+    if (p->sym->type == SYM_EXTERNAL) return true;
+    return p->type == RAS_PATCH_ABS64 || p->type == RAS_PATCH_PGREL21 ||
+           p->type == RAS_PATCH_PGOFF12;
+}
+
+size_t rasSerialize(rasBlock* ctx, void* buf, size_t size) {
+    rasMergeFragments(ctx);
+    size_t codeSize = ctx->curr - ctx->code;
+    u32 nrelocs = 0;
+    size_t namesSize = 0;
+    for (typeof(ctx->patches) n = ctx->patches; n; n = n->next) {
+        for (int i = 0; i < n->count; i++) {
+            rasPatch* p = &n->d[i];
+            rasAssert(p->sym->type != SYM_UNDEFINED, RAS_ERR_UNDEF_LABEL);
+            // jump tables can only point into the block
+            rasAssert(p->type < RAS_PATCH_TBL32 ||
+                          p->sym->type != SYM_EXTERNAL,
+                      RAS_ERR_BAD_LABEL);
+            if (!ras_needs_reloc(p)) continue;
+            nrelocs++;
+            if (p->sym->type == SYM_EXTERNAL) {
+                rasAssert(p->sym->name != NULL, RAS_ERR_UNNAMED_LABEL);
+                if (p->sym->name) namesSize += strlen(p->sym->name) + 1;
+            }
+        }
+    }
+
+    size_t total = sizeof(rasFileHeader) + ALIGN8(codeSize) +
+                   nrelocs * sizeof(rasFileReloc) + namesSize;
+    if (size < total) return total;
+
+    u8* out = buf;
+    *(rasFileHeader*) out = (rasFileHeader) {
+        RAS_MAGIC, nrelocs, codeSize, namesSize};
+    u8* code = out + sizeof(rasFileHeader);
+    memcpy(code, ctx->code, codeSize);
+    memset(code + codeSize, 0, ALIGN8(codeSize) - codeSize);
+    rasFileReloc* relocs = (rasFileReloc*) (code + ALIGN8(codeSize));
+    char* names = (char*) (relocs + nrelocs);
+    size_t nameOff = 0;
+
+    for (typeof(ctx->patches) n = ctx->patches; n; n = n->next) {
+        for (int i = 0; i < n->count; i++) {
+            rasPatch* p = &n->d[i];
+            // the copy gets every patch so it is complete even if the block
+            // was never made ready
+            if (p->sym->type != SYM_UNDEFINED) {
+                rasPatchAt(code + p->offset,
+                           rasGetBaseAddr(ctx) + p->offset - p->tbl,
+                           rasGetLabelRunAddr(ctx, p->sym), p->type);
+            }
+            if (!ras_needs_reloc(p)) continue;
+            rasFileReloc* r = relocs++;
+            r->type = p->type;
+            r->offset = p->offset;
+            if (p->sym->type == SYM_EXTERNAL) {
+                r->external = 1;
+                r->target = nameOff;
+                if (p->sym->name) {
+                    strcpy(names + nameOff, p->sym->name);
+                    nameOff += strlen(p->sym->name) + 1;
+                }
+            } else {
+                r->external = 0;
+                r->target = p->sym->intOffset;
+            }
+        }
+    }
+
+    return total;
+}
+
+static void* ras_dlsym(const char* name, void* userdata) {
+    return dlsym(RTLD_DEFAULT, name);
+}
+
+// bytes a patch of each type writes
+static size_t ras_patch_width(u32 type) {
+    switch (type) {
+        case RAS_PATCH_ABS64:
+            return 8;
+        case RAS_PATCH_TBL16:
+            return 2;
+        case RAS_PATCH_TBL8:
+            return 1;
+        default:
+            return 4;
+    }
+}
+
+// checks the sizes in the header against the buffer without overflowing
+static bool ras_valid_header(const rasFileHeader* hdr, size_t size) {
+    if (size < sizeof *hdr || hdr->magic != RAS_MAGIC) return false;
+    size_t rest = size - sizeof *hdr;
+    if (hdr->codeSize > rest || ALIGN8(hdr->codeSize) > rest) return false;
+    rest -= ALIGN8(hdr->codeSize);
+    if (hdr->nrelocs > rest / sizeof(rasFileReloc)) return false;
+    rest -= hdr->nrelocs * sizeof(rasFileReloc);
+    if (hdr->namesSize > rest) return false;
+    // names are only read as strings if the last one is terminated
+    const char* names = (const char*) hdr + size - rest;
+    return !hdr->namesSize || names[hdr->namesSize - 1] == '\0';
+}
+
+rasBlock* rasDeserialize(const void* buf, size_t size, rasResolver resolve,
+                         void* userdata) {
+    const u8* in = buf;
+    const rasFileHeader* hdr = buf;
+    bool valid = ras_valid_header(hdr, size);
+    rasAssert(valid, RAS_ERR_BAD_FORMAT);
+    if (!valid) return NULL;
+    if (!resolve) resolve = ras_dlsym;
+
+    const u8* code = in + sizeof *hdr;
+    const rasFileReloc* relocs =
+        (const rasFileReloc*) (code + ALIGN8(hdr->codeSize));
+    const char* names = (const char*) (relocs + hdr->nrelocs);
+
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    rasBlock* ctx =
+        rasCreate((hdr->codeSize + pagesize) & ~(pagesize - 1));
+    memcpy(ctx->code, code, hdr->codeSize);
+    ctx->curr = ctx->code + hdr->codeSize;
+
+    for (u32 i = 0; i < hdr->nrelocs; i++) {
+        const rasFileReloc* r = &relocs[i];
+        valid = r->type < RAS_PATCH_MAX && r->offset < hdr->codeSize &&
+                !(r->external && r->type >= RAS_PATCH_TBL32) &&
+                hdr->codeSize - r->offset >= ras_patch_width(r->type) &&
+                (r->external ? r->target < hdr->namesSize
+                             : r->target <= hdr->codeSize);
+        rasAssert(valid, RAS_ERR_BAD_FORMAT);
+        void* addr = NULL;
+        if (valid && r->external) {
+            addr = resolve(names + r->target, userdata);
+            rasAssert(addr != NULL, RAS_ERR_UNDEF_LABEL);
+            valid = addr != NULL;
+        }
+        // a partly relocated block is never handed out
+        if (!valid) {
+            rasDestroy(ctx);
+            return NULL;
+        }
+
+        rasLabel l = rasDeclareLabel(ctx);
+        if (r->external) {
+            rasNameLabel(rasDefineLabelExternal(l, addr), names + r->target);
+        } else {
+            l->type = SYM_INTERNAL;
+            l->intOffset = r->target;
+        }
+        ctx->curr = ctx->code + r->offset;
+        rasAddPatch(ctx, r->type, l);
+    }
+    ctx->curr = ctx->code + hdr->codeSize;
+    ctx->barrier = hdr->codeSize;
+
+    return ctx;
+}
+
+bool rasSaveFile(rasBlock* ctx, const char* path) {
+    size_t size = rasSerialize(ctx, NULL, 0);
+    void* buf = malloc(size);
+    rasSerialize(ctx, buf, size);
+    FILE* f = fopen(path, "wb");
+    bool ok = f && fwrite(buf, 1, size, f) == size;
+    if (f) ok &= fclose(f) == 0;
+    free(buf);
+    return ok;
+}
+
+rasBlock* rasLoadFile(const char* path, rasResolver resolve, void* userdata) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+    rasBlock* ctx = rasDeserialize(data, st.st_size, resolve, userdata);
+    munmap(data, st.st_size);
+    return ctx;
+}
@@ -0,0 +1,195 @@
+#include "ras_impl.h"
+
+#include <string.h>
+
+// stubs are keyed on their code with the patched fields cleared and their
+// patches, so two stubs with the same key do the same thing wherever they
+// are placed
+
+typedef struct {
+    u32 type;
+    u32 external;
+    u32 tbl;
+    u64 offset;
+    // offset in the stub or the address of an external label
+    u64 target;
+} rasStubPatch;
+
+typedef struct {
+    u64 hash;
+    size_t offset;
+    size_t size;
+    size_t align;
+    size_t npatches;
+    // code followed by the patches
+    u8* key;
+} rasStubEntry;
+
+struct _rasStubCache {
+    rasBlock* block;
+    rasStubEntry* entries;
+    size_t nentries;
+    size_t capacity;
+    rasStubCacheStats stats;
+};
+
+#define STUB_ALIGN 16
+
+static u64 ras_hash(const u8* data, size_t size) {
+    // fnv-1a
+    u64 h = 0xcbf29ce484222325;
+    for (size_t i = 0; i < size; i++) {
+        h ^= data[i];
+        h *= 0x100000001b3;
+    }
+    return h ? h : 1;
+}
+
+rasStubCache* rasCreateStubCache(size_t size) {
+    rasStubCache* cache = calloc(1, sizeof *cache);
+    cache->block = rasCreate(size);
+    cache->capacity = 64;
+    cache->entries = calloc(cache->capacity, sizeof *cache->entries);
+    return cache;
+}
+
+void rasDestroyStubCache(rasStubCache* cache) {
+    for (size_t i = 0; i < cache->capacity; i++) {
+        free(cache->entries[i].key);
+    }
+    free(cache->entries);
+    rasDestroy(cache->block);
+    free(cache);
+}
+
+static void ras_stub_rehash(rasStubCache* cache) {
+    rasStubEntry* old = cache->entries;
+    size_t oldCapacity = cache->capacity;
+    cache->capacity *= 2;
+    cache->entries = calloc(cache->capacity, sizeof *cache->entries);
+    for (size_t i = 0; i < oldCapacity; i++) {
+        if (!old[i].hash) continue;
+        size_t mask = cache->capacity - 1;
+        size_t j = old[i].hash & mask;
+        while (cache->entries[j].hash) j = (j + 1) & mask;
+        cache->entries[j] = old[i];
+    }
+    free(old);
+}
+
+// builds the key for the stub, returns its size
+static size_t ras_stub_key(rasBlock* stub, u8** key, size_t* npatches) {
+    size_t codeSize = stub->curr - stub->code;
+    size_t n = 0;
+    for (typeof(stub->patches) l = stub->patches; l; l = l->next) {
+        n += l->count;
+    }
+    size_t keySize = codeSize + n * sizeof(rasStubPatch);
+    u8* k = malloc(keySize ? keySize : 1);
+    memcpy(k, stub->code, codeSize);
+
+    // the list is newest first so fill the patches from the back to keep
+    // them in emission order
+    rasStubPatch* p = (rasStubPatch*) (k + codeSize) + n;
+    for (typeof(stub->patches) l = stub->patches; l; l = l->next) {
+        for (int i = l->count - 1; i >= 0; i--) {
+            rasPatch* sp = &l->d[i];
+            p--;
+            memset(p, 0, sizeof *p);
+            p->type = sp->type;
+            p->offset = sp->offset;
+            p->tbl = sp->tbl;
+            if (sp->sym->type == SYM_EXTERNAL) {
+                p->external = 1;
+                p->target = (uintptr_t) sp->sym->extAddr;
+            } else {
+                p->target = sp->sym->intOffset;
+            }
+            rasPatchAt(k + sp->offset, 0, 0, sp->type);
+        }
+    }
+
+    *key = k;
+    *npatches = n;
+    return keySize;
+}
+
+void* rasInternStub(rasStubCache* cache, rasBlock* stub) {
+    rasMergeFragments(stub);
+    for (typeof(stub->patches) l = stub->patches; l; l = l->next) {
+        for (int i = 0; i < l->count; i++) {
+            bool defined = l->d[i].sym->type != SYM_UNDEFINED;
+            rasAssert(defined, RAS_ERR_UNDEF_LABEL);
+            if (!defined) return NULL;
+        }
+    }
+
+    u8* key;
+    size_t npatches;
+    size_t keySize = ras_stub_key(stub, &key, &npatches);
+    size_t codeSize = stub->curr - stub->code;
+    // stubs start at STUB_ALIGN or the largest alignment they asked for
+    size_t align = stub->maxAlign > STUB_ALIGN ? stub->maxAlign : STUB_ALIGN;
+    u64 hash = ras_hash(key, keySize);
+    cache->stats.lookups++;
+
+    // entries with the same hash are next to each other
+    size_t mask = cache->capacity - 1;
+    for (size_t i = hash & mask; cache->entries[i].hash; i = (i + 1) & mask) {
+        rasStubEntry* e = &cache->entries[i];
+        if (e->hash == hash && e->size == codeSize &&
+            e->npatches == npatches && e->align >= align &&
+            !memcmp(e->key, key, keySize)) {
+            free(key);
+            cache->stats.hits++;
+            cache->stats.bytesSaved += codeSize;
+            return cache->block->code + e->offset;
+        }
+    }
+
+    // copy the stub into the cache with its patches
+    rasBlock* ctx = cache->block;
+    uintptr_t start = (uintptr_t) ctx->curr;
+    size_t base = ((start + align - 1) & ~(uintptr_t) (align - 1)) -
+                  (uintptr_t) ctx->code;
+    if (base + codeSize > ctx->size) {
+        free(key);
+        return NULL;
+    }
+    // only the pages the stub goes on stop being executable, the stub cache
+    // isn't thread safe but stubs on other pages can keep running
+    rasProtectRange(ctx, base, codeSize, false);
+    ctx->curr = ctx->code + base;
+    memcpy(ctx->curr, key, codeSize);
+    rasStubPatch* p = (rasStubPatch*) (key + codeSize);
+    for (size_t i = 0; i < npatches; i++) {
+        rasLabel l = rasDeclareLabel(ctx);
+        if (p[i].external) {
+            rasDefineLabelExternal(l, (void*) (uintptr_t) p[i].target);
+        } else {
+            l->type = SYM_INTERNAL;
+            l->intOffset = base + p[i].target;
+        }
+        ctx->curr = ctx->code + base + p[i].offset;
+        rasAddPatch(ctx, p[i].type, l);
+        ctx->patches->d[ctx->patches->count - 1].tbl = p[i].tbl;
+    }
+    ctx->curr = ctx->code + base + codeSize;
+    ctx->barrier = base + codeSize;
+    rasApplyAllPatches(ctx);
+    rasProtectRange(ctx, base, codeSize, true);
+
+    if (cache->nentries * 2 >= cache->capacity) ras_stub_rehash(cache);
+    mask = cache->capacity - 1;
+    size_t i = hash & mask;
+    while (cache->entries[i].hash) i = (i + 1) & mask;
+    cache->entries[i] =
+        (rasStubEntry) {hash, base, codeSize, align, npatches, key};
+    cache->nentries++;
+
+    return ctx->code + base;
+}
+
+rasStubCacheStats rasGetStubCacheStats(rasStubCache* cache) {
+    return cache->stats;
+}
@@ -0,0 +1,238 @@
+#include "ras_impl.h"
+
+#include <string.h>
+
+typedef struct {
+    u32 offset;
+    u32 arg;
+    u8 type;
+} rasHole;
+
+enum {
+    // labels[target]
+    TPATCH_ARG,
+    // an external address
+    TPATCH_EXTERNAL,
+    // an offset in the template, for patches that depend on its address
+    TPATCH_SELF,
+};
+
+typedef struct {
+    u8 kind;
+    u8 type;
+    u32 tbl;
+    u32 offset;
+    u64 target;
+} rasTemplatePatch;
+
+typedef struct {
+    rasLabel l;
+    u32 arg;
+} rasLabelArg;
+
+struct _rasTemplate {
+    u8* code;
+    size_t size;
+    size_t align;
+    rasHole* holes;
+    size_t nholes;
+    rasTemplatePatch* patches;
+    size_t npatches;
+
+    // only used while recording
+    size_t start;
+    u32 frag;
+    size_t startPatches;
+    size_t holesCap;
+    rasLabelArg* labelArgs;
+    size_t nlabelArgs;
+};
+
+// shift and width of each hole in a 32 bit word
+static const u8 holeFields[RAS_HOLE_MAX][2] = {
+    [RAS_HOLE_RD] = {0, 5},      [RAS_HOLE_RN] = {5, 5},
+    [RAS_HOLE_RA] = {10, 5},     [RAS_HOLE_RM] = {16, 5},
+    [RAS_HOLE_IMM12] = {10, 12}, [RAS_HOLE_IMM16] = {5, 16},
+    [RAS_HOLE_DATA32] = {0, 32},
+};
+
+void rasBeginTemplate(rasBlock* ctx) {
+    if (ctx->tmpl) rasDestroyTemplate(ctx->tmpl);
+    rasTemplate* t = calloc(1, sizeof *t);
+    t->start = ctx->curr - ctx->code;
+    t->frag = ctx->frag;
+    t->startPatches = ctx->npatches;
+    t->align = 1;
+    ctx->tmpl = t;
+    // nothing before the template can be merged into it
+    ctx->barrier = t->start;
+}
+
+void rasTemplateHole(rasBlock* ctx, rasHoleType type, u32 arg) {
+    rasTemplate* t = ctx->tmpl;
+    size_t size = type == RAS_HOLE_DATA64 ? 8 : 4;
+    bool valid = t && type < RAS_HOLE_MAX &&
+                 (size_t) (ctx->curr - ctx->code) >= t->start + size;
+    rasAssert(valid, RAS_ERR_BAD_CONST);
+    if (!valid) return;
+    if (t->nholes == t->holesCap) {
+        t->holesCap = t->holesCap ? t->holesCap * 2 : 8;
+        t->holes = realloc(t->holes, t->holesCap * sizeof *t->holes);
+    }
+    u32 offset = ctx->curr - ctx->code - size;
+    t->holes[t->nholes++] = (rasHole) {offset - t->start, arg, type};
+
+    // clear the field so it can be filled by or-ing in the argument
+    if (type == RAS_HOLE_DATA64) {
+        memset(ctx->code + offset, 0, 8);
+    } else {
+        u32 w;
+        memcpy(&w, ctx->code + offset, 4);
+        w &= ~(u32) (MASK(holeFields[type][1]) << holeFields[type][0]);
+        memcpy(ctx->code + offset, &w, 4);
+    }
+}
+
+void rasTemplateLabel(rasBlock* ctx, rasLabel l, u32 arg) {
+    rasTemplate* t = ctx->tmpl;
+    rasAssert(t != NULL, RAS_ERR_BAD_LABEL);
+    if (!t) return;
+    t->labelArgs =
+        realloc(t->labelArgs, (t->nlabelArgs + 1) * sizeof *t->labelArgs);
+    t->labelArgs[t->nlabelArgs++] = (rasLabelArg) {l, arg};
+}
+
+// patches that only depend on the distance between two places in the
+// template are applied once when it is recorded
+static bool ras_template_relative(rasPatchType type) {
+    return type != RAS_PATCH_ABS64 && type != RAS_PATCH_PGREL21 &&
+           type != RAS_PATCH_PGOFF12;
+}
+
+void rasTemplateAlign(rasBlock* ctx, size_t alignment) {
+    if (ctx->tmpl->align < alignment) ctx->tmpl->align = alignment;
+}
+
+rasTemplate* rasEndTemplate(rasBlock* ctx) {
+    rasTemplate* t = ctx->tmpl;
+    bool valid = t && t->frag == ctx->frag;
+    rasAssert(valid, RAS_ERR_BAD_FRAGMENT);
+    if (!valid) return NULL;
+    // padding from rasAlign is only right if the copies start at the same
+    // alignment as the template
+    rasAssert(ISLOWBITS0(t->start, __builtin_ctzll(t->align)),
+              RAS_ERR_BAD_CONST);
+    ctx->tmpl = NULL;
+    size_t end = ctx->curr - ctx->code;
+    t->size = end - t->start;
+    t->code = malloc(t->size ? t->size : 1);
+    memcpy(t->code, ctx->code + t->start, t->size);
+
+    size_t n = ctx->npatches - t->startPatches;
+    t->patches = malloc((n ? n : 1) * sizeof *t->patches);
+    // the list is newest first so fill the patches from the back, and remove
+    // them from ctx on the way
+    rasTemplatePatch* p = t->patches + n;
+    for (size_t todo = n; todo; todo--) {
+        rasPatch* sp = &ctx->patches->d[--ctx->patches->count];
+        rasSymbol* sym = sp->sym;
+        u32 offset = sp->offset - t->start;
+        // jump tables have to start in the template too
+        rasAssert(sp->offset - sp->tbl >= t->start, RAS_ERR_BAD_LABEL);
+        bool inside = sym->type == SYM_INTERNAL && sym->frag == t->frag &&
+                      sym->intOffset >= t->start && sym->intOffset <= end;
+        if (inside && ras_template_relative(sp->type)) {
+            rasPatchAt(t->code + offset, offset - sp->tbl,
+                       sym->intOffset - t->start, sp->type);
+        } else {
+            p--;
+            *p = (rasTemplatePatch) {TPATCH_SELF, sp->type, sp->tbl, offset};
+            if (inside) {
+                p->target = sym->intOffset - t->start;
+            } else if (sym->type == SYM_EXTERNAL) {
+                p->kind = TPATCH_EXTERNAL;
+                p->target = (uintptr_t) sym->extAddr;
+            } else {
+                bool found = false;
+                for (size_t i = 0; i < t->nlabelArgs && !found; i++) {
+                    if (t->labelArgs[i].l != sym) continue;
+                    found = true;
+                    p->kind = TPATCH_ARG;
+                    p->target = t->labelArgs[i].arg;
+                }
+                // internal labels outside the template can't be reached
+                // from copies of it
+                rasAssert(found && sym->type == SYM_UNDEFINED,
+                          RAS_ERR_BAD_LABEL);
+            }
+        }
+        if (!ctx->patches->count) LISTPOP(ctx->patches);
+    }
+    t->npatches = t->patches + n - p;
+    memmove(t->patches, p, t->npatches * sizeof *p);
+
+    ctx->npatches -= n;
+    if (ctx->appliedPatches > ctx->npatches)
+        ctx->appliedPatches = ctx->npatches;
+    ctx->curr = ctx->code + t->start;
+    ctx->barrier = t->start;
+
+    free(t->labelArgs);
+    t->labelArgs = NULL;
+    return t;
+}
+
+void rasDestroyTemplate(rasTemplate* t) {
+    free(t->code);
+    free(t->holes);
+    free(t->patches);
+    free(t->labelArgs);
+    free(t);
+}
+
+void rasEmitTemplate(rasBlock* ctx, const rasTemplate* t, const u64* args,
+                     const rasLabel* labels) {
+    if (t->align > 1) rasAlign(ctx, t->align);
+    if (!rasReserve(ctx, t->size)) return;
+    u8* code = ctx->curr;
+    memcpy(code, t->code, t->size);
+
+    for (size_t i = 0; i < t->nholes; i++) {
+        const rasHole* h = &t->holes[i];
+        u64 v = args[h->arg];
+        if (h->type == RAS_HOLE_DATA64) {
+            memcpy(code + h->offset, &v, 8);
+            continue;
+        }
+        u32 shift = holeFields[h->type][0];
+        u32 width = holeFields[h->type][1];
+        rasAssert(ISNBITSU64(v, width), RAS_ERR_BAD_IMM);
+        u32 w;
+        memcpy(&w, code + h->offset, 4);
+        w |= (v & MASK(width)) << shift;
+        memcpy(code + h->offset, &w, 4);
+    }
+
+    size_t base = code - ctx->code;
+    for (size_t i = 0; i < t->npatches; i++) {
+        const rasTemplatePatch* p = &t->patches[i];
+        rasLabel l;
+        if (p->kind == TPATCH_ARG) {
+            l = labels[p->target];
+        } else if (p->kind == TPATCH_EXTERNAL) {
+            l = rasDefineLabelExternal(rasDeclareLabel(ctx),
+                                       (void*) (uintptr_t) p->target);
+        } else {
+            l = rasDeclareLabel(ctx);
+            l->type = SYM_INTERNAL;
+            l->intOffset = base + p->target;
+            l->frag = ctx->frag;
+        }
+        ctx->curr = code + p->offset;
+        rasAddPatch(ctx, p->type, l);
+        ctx->patches->d[ctx->patches->count - 1].tbl = p->tbl;
+    }
+
+    ctx->curr = code + t->size;
+    ctx->barrier = ctx->curr - ctx->code;
+}
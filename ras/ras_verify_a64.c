@@ -0,0 +1,187 @@
+#include "ras_a64.h"
+#include "ras_impl.h"
+
+#include <string.h>
+
+// checks finished code without trusting the encoders, so generators built
+// with RAS_NO_CHECKS can still have their output validated in debug builds
+// or on a sample of blocks
+
+typedef struct {
+    rasBlock* ctx;
+    FILE* f;
+    uintptr_t base;
+    size_t size;
+    // one per word, set once the word is known to be code
+    u8* seen;
+    size_t* work;
+    size_t nwork;
+    uintptr_t* ext;
+    size_t next;
+    size_t problems;
+    // code is found in a first pass and checked in order in a second one
+    bool report;
+} rasVerifier;
+
+#define F(w, lo, n) (((w) >> (lo)) & MASK(n))
+#define RD(w) F(w, 0, 5)
+#define RN(w) F(w, 5, 5)
+
+static s64 ras_sext(u64 v, u32 bits) {
+    return (s64) (v << (64 - bits)) >> (64 - bits);
+}
+
+static int ras_cmp_addr(const void* a, const void* b) {
+    uintptr_t x = *(const uintptr_t*) a, y = *(const uintptr_t*) b;
+    return (x > y) - (x < y);
+}
+
+static void ras_problem(rasVerifier* v, size_t off, const char* why) {
+    if (!v->report) return;
+    v->problems++;
+    if (!v->f) return;
+    u32 w = 0;
+    if (off + 4 <= v->size) memcpy(&w, v->ctx->code + off, 4);
+    char buf[128];
+    rasDisasmA64(w, v->base + off, buf, sizeof buf);
+    fprintf(v->f, "%lx: %08x  %s; // %s\n", v->base + off, w, buf, why);
+}
+
+static void ras_reach(rasVerifier* v, size_t off) {
+    if (v->seen[off / 4]) return;
+    v->seen[off / 4] = 1;
+    v->work[v->nwork++] = off;
+}
+
+static bool ras_is_external(rasVerifier* v, uintptr_t addr) {
+    return bsearch(&addr, v->ext, v->next, sizeof addr, ras_cmp_addr);
+}
+
+// branch targets have to be an instruction in the block or an external
+// label, the ones in the block are followed
+static void ras_branch(rasVerifier* v, size_t from, uintptr_t target) {
+    size_t off = target - v->base;
+    if (target >= v->base && off < v->size && ISLOWBITS0(off, 2)) {
+        ras_reach(v, off);
+    } else if (!ras_is_external(v, target)) {
+        ras_problem(v, from, "branch target outside the block");
+    }
+}
+
+static void ras_address(rasVerifier* v, size_t from, uintptr_t target) {
+    if ((target < v->base || target - v->base >= v->size) &&
+        !ras_is_external(v, target))
+        ras_problem(v, from, "address outside the block");
+}
+
+// SP has to stay 16 byte aligned when it is moved by a constant
+static bool ras_sp_misaligned(u32 w) {
+    if ((w & 0x1f800000) == 0x11000000) {
+        // add/sub immediate, the flag setting ones write ZR
+        if (F(w, 29, 1) || RD(w) != 31 || RN(w) != 31) return false;
+        return F(w, 22, 1) ? false : !ISLOWBITS0(F(w, 10, 12), 4);
+    }
+    if ((w & 0x3b200400) == 0x38000400) {
+        // load/store pre or post index
+        return RN(w) == 31 && !ISLOWBITS0(F(w, 12, 9), 4);
+    }
+    if ((w & 0x3a000000) == 0x28000000 && (F(w, 23, 2) & 1)) {
+        // load/store pair pre or post index
+        u32 opc = F(w, 30, 2), vr = F(w, 26, 1);
+        u32 size = vr ? opc + 2 : (opc & 2) ? 3 : 2;
+        return RN(w) == 31 && !ISLOWBITS0(F(w, 15, 7) << size, 4);
+    }
+    return false;
+}
+
+static void ras_verify_inst(rasVerifier* v, size_t off) {
+    u32 w;
+    memcpy(&w, v->ctx->code + off, 4);
+    uintptr_t pc = v->base + off;
+    if (!rasDisasmA64(w, pc, NULL, 0)) {
+        ras_problem(v, off, "not an instruction ras can emit");
+        return;
+    }
+    if (ras_sp_misaligned(w)) ras_problem(v, off, "misaligned SP");
+
+    bool next = true;
+    if ((w & 0x7c000000) == 0x14000000) {
+        // B or BL
+        ras_branch(v, off, pc + (ras_sext(F(w, 0, 26), 26) << 2));
+        next = F(w, 31, 1);
+    } else if ((w & 0xff000010) == 0x54000000 ||
+               (w & 0x7e000000) == 0x34000000) {
+        // B.cond, CBZ and CBNZ
+        ras_branch(v, off, pc + (ras_sext(F(w, 5, 19), 19) << 2));
+    } else if ((w & 0x7e000000) == 0x36000000) {
+        ras_branch(v, off, pc + (ras_sext(F(w, 5, 14), 14) << 2));
+    } else if ((w & 0xfffffc1f) == 0xd61f0000 ||
+               (w & 0xfffffc1f) == 0xd65f0000) {
+        // BR and RET
+        next = false;
+    } else if ((w & 0x3b000000) == 0x18000000) {
+        ras_address(v, off, pc + (ras_sext(F(w, 5, 19), 19) << 2));
+    } else if ((w & 0x9f000000) == 0x10000000) {
+        // ADR
+        s64 imm = ras_sext(F(w, 5, 19) << 2 | F(w, 29, 2), 21);
+        ras_address(v, off, pc + imm);
+    }
+
+    if (!next) return;
+    if (off + 8 > v->size) {
+        ras_problem(v, off, "falls through the end of the block");
+    } else {
+        ras_reach(v, off + 4);
+    }
+}
+
+size_t rasVerifyA64(rasBlock* ctx, FILE* f) {
+    rasVerifier v = {ctx, f, rasGetBaseAddr(ctx), ctx->curr - ctx->code};
+    size_t nwords = v.size / 4;
+    v.seen = calloc(nwords + 1, 1);
+    v.work = malloc((nwords + 1) * sizeof *v.work);
+
+    size_t nsyms = 0;
+    for (typeof(ctx->symbols) l = ctx->symbols; l; l = l->next) {
+        nsyms += l->count;
+    }
+    v.ext = malloc((nsyms + 1) * sizeof *v.ext);
+
+    // code is found by following it from the start, from labels other code
+    // can know about and from jump tables, everything else is data
+    if (nwords) ras_reach(&v, 0);
+    for (typeof(ctx->symbols) l = ctx->symbols; l; l = l->next) {
+        for (int i = 0; i < l->count; i++) {
+            rasSymbol* s = &l->d[i];
+            if (s->type == SYM_EXTERNAL) {
+                v.ext[v.next++] = (uintptr_t) s->extAddr;
+            } else if (s->type == SYM_INTERNAL && s->name &&
+                       s->intOffset < nwords * 4 &&
+                       ISLOWBITS0(s->intOffset, 2)) {
+                ras_reach(&v, s->intOffset);
+            }
+        }
+    }
+    qsort(v.ext, v.next, sizeof *v.ext, ras_cmp_addr);
+    for (typeof(ctx->patches) l = ctx->patches; l; l = l->next) {
+        for (int i = 0; i < l->count; i++) {
+            rasPatch* p = &l->d[i];
+            if (p->type < RAS_PATCH_TBL32 || p->sym->type != SYM_INTERNAL)
+                continue;
+            if (p->sym->intOffset < nwords * 4 &&
+                ISLOWBITS0(p->sym->intOffset, 2))
+                ras_reach(&v, p->sym->intOffset);
+        }
+    }
+
+    while (v.nwork) ras_verify_inst(&v, v.work[--v.nwork]);
+    v.report = true;
+    for (size_t i = 0; i < nwords; i++) {
+        if (v.seen[i]) ras_verify_inst(&v, i * 4);
+    }
+
+    free(v.seen);
+    free(v.work);
+    free(v.ext);
+    return v.problems;
+}
@@ -0,0 +1,70 @@
+#ifndef __RAS_TESTS_CHECK_H
+#define __RAS_TESTS_CHECK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ras/ras.h"
+
+// small helpers shared by the tests that run on any host. errors raised by
+// ras are counted instead of aborting so tests can check for them
+
+static int failct;
+static int errorct;
+static rasError firstError;
+
+static void check_error_cb(rasError err, void* userdata) {
+    if (!errorct++) firstError = err;
+}
+
+#define CHECK(c)                                                               \
+    do {                                                                       \
+        if (!(c)) {                                                            \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #c);                     \
+            failct++;                                                          \
+        }                                                                      \
+    } while (0)
+
+#define CHECK_EQ(a, b)                                                         \
+    do {                                                                       \
+        unsigned long long _a = (a), _b = (b);                                 \
+        if (_a != _b) {                                                        \
+            printf("%s:%d: %s == %s: %llx != %llx\n", __FILE__, __LINE__, #a,  \
+                   #b, _a, _b);                                                \
+            failct++;                                                          \
+        }                                                                      \
+    } while (0)
+
+// runs stmt and checks the first error it raised was err
+#define CHECK_ERROR(err, stmt)                                                 \
+    do {                                                                       \
+        int _errors = errorct;                                                 \
+        rasError _first = firstError;                                          \
+        errorct = 0;                                                           \
+        firstError = RAS_OK;                                                   \
+        stmt;                                                                  \
+        if (errorct == 0 || firstError != (err)) {                             \
+            printf("%s:%d: %s: expected %s, got %s\n", __FILE__, __LINE__,     \
+                   #stmt, rasErrorStrings[err], rasErrorStrings[firstError]);  \
+            failct++;                                                          \
+        }                                                                      \
+        errorct = _errors;                                                     \
+        firstError = _first;                                                   \
+    } while (0)
+
+static void check_begin(void) {
+    rasSetErrorCallback(check_error_cb, NULL);
+}
+
+// any error outside CHECK_ERROR is a failure
+static int check_end(const char* name) {
+    if (errorct) {
+        printf("%d unexpected errors, first: %s\n", errorct,
+               rasErrorStrings[firstError]);
+        failct++;
+    }
+    printf("%s: %d failed\n", name, failct);
+    return failct != 0;
+}
+
+#endif
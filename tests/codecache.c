@@ -0,0 +1,145 @@
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RAS_CTX_VAR ctx
+#include "check.h"
+#include "ras/ras_a64.h"
+
+// adds functions to a code cache, frees one and compacts the rest, and
+// checks the slots, the references between functions and to their own data
+// follow the code to its new place
+
+static uint32_t read32(const void* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+static uint64_t read64(const void* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+static int64_t sext(uint64_t v, int bits) {
+    return (int64_t) (v << (64 - bits)) >> (64 - bits);
+}
+
+static uintptr_t b_target(const uint8_t* code) {
+    return (uintptr_t) code + sext(read32(code) & 0x3ffffff, 26) * 4;
+}
+
+static uintptr_t adr_target(const uint8_t* code) {
+    uint32_t w = read32(code);
+    return (uintptr_t) code + sext((w >> 5 & 0x7ffff) << 2 | (w >> 29 & 3), 21);
+}
+
+static rasBlock* filler(size_t size) {
+    rasBlock* ctx = rasCreate(size + 4096);
+    for (size_t i = 0; i < size / 4; i++) NOP();
+    return ctx;
+}
+
+static rasBlock* leaf(void) {
+    rasBlock* ctx = rasCreate(4096);
+    MOVZW(R0, 42);
+    RET();
+    return ctx;
+}
+
+// calls another function in the cache and refers to its own data
+static rasBlock* caller(void* target, rasLabel* lother) {
+    rasBlock* ctx = rasCreate(4096);
+    LABEL(ltarget, target);
+    LABEL(ldata);
+    *lother = LNEW((void*) 0x1000);
+    B(ltarget);
+    ADR(R0, ldata);
+    RET();
+    ALIGN(8);
+    L(ldata);
+    DWORD(ldata);
+    DWORD(*lother);
+    return ctx;
+}
+
+static rasBlock* aligned_leaf(void) {
+    rasBlock* ctx = rasCreate(4096);
+    ALIGN(64);
+    MOVZW(R0, 7);
+    RET();
+    return ctx;
+}
+
+// checks code is the caller and refers to target and its own data
+static void check_caller(uint8_t* code, void* target) {
+    CHECK_EQ(b_target(code), (uintptr_t) target);
+    CHECK_EQ(adr_target(code + 4), (uintptr_t) code + 16);
+    CHECK_EQ(read64(code + 16), (uintptr_t) code + 16);
+}
+
+int main() {
+    check_begin();
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    rasCodeCache* cache = rasCreateCodeCache(8 * pagesize, NULL);
+
+    void *fillerSlot, *leafSlot, *callerSlot, *alignedSlot;
+    uint8_t* f = rasCacheAdd(cache, filler(4 * pagesize), &fillerSlot);
+    uint8_t* l = rasCacheAdd(cache, leaf(), &leafSlot);
+    rasLabel lother;
+    uint8_t* c = rasCacheAdd(cache, caller(l, &lother), &callerSlot);
+    uint8_t* a = rasCacheAdd(cache, aligned_leaf(), &alignedSlot);
+    CHECK(f && l && c && a);
+    if (!f || !l || !c || !a) return check_end("codecache");
+    CHECK(fillerSlot == f && leafSlot == l && callerSlot == c &&
+          alignedSlot == a);
+    CHECK_EQ(l - f, 4 * pagesize);
+    CHECK_EQ((uintptr_t) c % 16, 0);
+    CHECK_EQ((uintptr_t) a % 64, 0);
+    check_caller(c, l);
+    CHECK_EQ(read64(c + 24), 0x1000);
+    CHECK_EQ(read32(a), 0x528000e0);
+
+    // redefining an external and repatching only changes that function
+    rasDefineLabelExternal(lother, (void*) 0x2000);
+    rasCacheRepatch(cache, c + 8);
+    CHECK_EQ(read64(c + 24), 0x2000);
+    check_caller(c, l);
+
+    // freeing counts the bytes but doesn't move anything
+    rasCacheFree(cache, f + 100);
+    rasCacheFree(cache, f);
+    rasCacheFree(cache, a + 64);
+    CHECK_EQ(rasGetCodeCacheFree(cache), 4 * pagesize);
+    CHECK(leafSlot == l);
+
+    // everything moves down over the freed function and the pages after the
+    // last function are released
+    uint8_t* oldLeaf = l;
+    size_t released = rasCompactCodeCache(cache);
+    CHECK_EQ(released, 4 * pagesize);
+    CHECK_EQ(rasGetCodeCacheFree(cache), 0);
+    l = leafSlot;
+    c = callerSlot;
+    a = alignedSlot;
+    CHECK(l == f);
+    CHECK(c > l && c < oldLeaf);
+    CHECK_EQ((uintptr_t) a % 64, 0);
+    CHECK_EQ(read32(l), 0x52800540);
+    check_caller(c, l);
+    CHECK_EQ(read64(c + 24), 0x2000);
+    CHECK_EQ(read32(a), 0x528000e0);
+    CHECK(fillerSlot == f);
+
+    // the space at the end can be used again
+    uint8_t* again = rasCacheAdd(cache, filler(4 * pagesize), NULL);
+    CHECK(again != NULL && again > a);
+    // a function that doesn't fit stays with the caller
+    rasBlock* big = filler(4 * pagesize);
+    CHECK(rasCacheAdd(cache, big, NULL) == NULL);
+    rasDestroy(big);
+
+    rasDestroyCodeCache(cache);
+    return check_end("codecache");
+}
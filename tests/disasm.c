@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RAS_CTX_VAR testCode
+#define RAS_DEFAULT_SUFFIX W
+#include "ras/ras.h"
+#include "ras/ras_a64.h"
+
+// encodes every test instruction and checks that the built in disassembler
+// prints it back in the macro syntax
+
+void errorCb(rasError err) {
+    fprintf(stderr, "%s\n", rasErrorStrings[err]);
+    abort();
+}
+
+int main() {
+    rasSetErrorCallback((rasErrorCallback) errorCb, NULL);
+
+    rasBlock* testCode = rasCreate(16384);
+
+#include "test_input.txt"
+
+    rasReady(testCode);
+
+    FILE* testin = fopen("disasm_expected.txt", "r");
+    FILE* testout = fopen("disasm_actual.txt", "w");
+    if (!testin || !testout) exit(1);
+
+    int failct = 0;
+
+    uint32_t* code = rasGetCode(testCode);
+    size_t count = rasGetSize(testCode) / 4;
+    for (size_t i = 0; i < count; i++) {
+        char expected[1000];
+        if (!fgets(expected, 1000, testin)) expected[0] = '\0';
+        char actual[1000];
+        if (!rasDisasmA64(code[i], i * 4, actual, 1000)) failct++;
+        strcat(actual, "\n");
+
+        if (strcmp(expected, actual)) {
+            failct++;
+            fprintf(stderr, "expected:%sactual:%s\n", expected, actual);
+        }
+
+        fprintf(testout, "%s", actual);
+    }
+
+    fclose(testin);
+    fclose(testout);
+
+    rasDestroy(testCode);
+
+    return failct;
+}
@@ -0,0 +1,233 @@
+#include <stdint.h>
+#include <string.h>
+
+#define RAS_CTX_VAR ctx
+#include "check.h"
+#include "ras/ras_a64.h"
+
+// writes an object with rasWriteElf and checks its sections, symbols and
+// relocations by reading the elf structures back
+
+typedef struct {
+    uint8_t ident[16];
+    uint16_t type, machine;
+    uint32_t version;
+    uint64_t entry, phoff, shoff;
+    uint32_t flags;
+    uint16_t ehsize, phentsize, phnum, shentsize, shnum, shstrndx;
+} ElfHeader;
+
+typedef struct {
+    uint32_t name, type;
+    uint64_t flags, addr, offset, size;
+    uint32_t link, info;
+    uint64_t addralign, entsize;
+} ElfSection;
+
+typedef struct {
+    uint32_t name;
+    uint8_t info, other;
+    uint16_t shndx;
+    uint64_t value, size;
+} ElfSymbol;
+
+typedef struct {
+    uint64_t offset, info;
+    int64_t addend;
+} ElfRela;
+
+#define SHT_PROGBITS 1
+#define SHT_SYMTAB 2
+#define SHT_STRTAB 3
+#define SHT_RELA 4
+
+#define R_AARCH64_ABS64 257
+#define R_AARCH64_PREL32 261
+#define R_AARCH64_LD_PREL_LO19 273
+#define R_AARCH64_ADR_PREL_LO21 274
+#define R_AARCH64_ADR_PREL_PG_HI21 275
+#define R_AARCH64_ADD_ABS_LO12_NC 277
+#define R_AARCH64_TSTBR14 279
+#define R_AARCH64_CONDBR19 280
+#define R_AARCH64_JUMP26 282
+#define R_AARCH64_CALL26 283
+
+static uint8_t* obj;
+static ElfHeader* hdr;
+static ElfSection* sections;
+
+static const char* section_name(int i) {
+    return (char*) obj + sections[hdr->shstrndx].offset + sections[i].name;
+}
+
+static ElfSection* find_section(const char* name) {
+    for (int i = 0; i < hdr->shnum; i++) {
+        if (!strcmp(section_name(i), name)) return &sections[i];
+    }
+    return NULL;
+}
+
+// the name of a symbol, or of the section for section symbols
+static const char* symbol_name(uint32_t idx) {
+    ElfSection* symtab = find_section(".symtab");
+    ElfSymbol* sym = (ElfSymbol*) (obj + symtab->offset) + idx;
+    if ((sym->info & 0xf) == 3) return section_name(sym->shndx);
+    return (char*) obj + sections[symtab->link].offset + sym->name;
+}
+
+static ElfSymbol* find_symbol(const char* name) {
+    ElfSection* symtab = find_section(".symtab");
+    ElfSymbol* syms = (ElfSymbol*) (obj + symtab->offset);
+    for (size_t i = 0; i < symtab->size / sizeof *syms; i++) {
+        if (!strcmp(symbol_name(i), name)) return &syms[i];
+    }
+    return NULL;
+}
+
+static ElfRela* find_rela(uint64_t offset) {
+    ElfSection* rela = find_section(".rela.text");
+    ElfRela* r = (ElfRela*) (obj + rela->offset);
+    for (size_t i = 0; i < rela->size / sizeof *r; i++) {
+        if (r[i].offset == offset) return &r[i];
+    }
+    return NULL;
+}
+
+static void check_rela(uint64_t offset, uint32_t type, const char* sym,
+                       int64_t addend) {
+    ElfRela* r = find_rela(offset);
+    if (!r) {
+        printf("no relocation at %llx\n", (unsigned long long) offset);
+        failct++;
+        return;
+    }
+    CHECK_EQ(r->info & 0xffffffff, type);
+    CHECK(!strcmp(symbol_name(r->info >> 32), sym));
+    CHECK_EQ(r->addend, addend);
+}
+
+static uint32_t text_word(uint64_t offset) {
+    uint32_t w;
+    memcpy(&w, obj + find_section(".text")->offset + offset, sizeof w);
+    return w;
+}
+
+int main() {
+    check_begin();
+
+    rasBlock* ctx = rasCreateNoExec(NULL, 4096, 0);
+    LABEL(lfn);
+    LABEL(ldata);
+    LABEL(llocal);
+    LABEL(ltable);
+    LABEL(lputs);
+    rasNameLabel(lfn, "jit_fn");
+    rasNameLabel(ldata, "jit_data");
+    rasNameLabel(LEXT(lputs, (void*) 0x1000), "puts");
+
+    L(lfn);
+    BL(lputs);
+    B(lputs);
+    CBZX(R0, lputs);
+    TBZ(R0, 3, lputs);
+    LDRLX(R1, lputs);
+    ADR(R2, lputs);
+    ADRL(R3, ldata);
+    B(llocal);
+    L(llocal);
+    RET();
+    ALIGN(8);
+    L(ldata);
+    DWORD(ldata);
+    DWORD(lputs);
+    L(ltable);
+    TABLE32(ltable, llocal);
+    TABLE32(ltable, lputs);
+
+    size_t size = rasWriteElf(ctx, NULL, 0);
+    obj = malloc(size);
+    CHECK_EQ(rasWriteElf(ctx, obj, size), size);
+    hdr = (ElfHeader*) obj;
+    sections = (ElfSection*) (obj + hdr->shoff);
+
+    CHECK(!memcmp(hdr->ident, "\x7f" "ELF\2\1\1", 7));
+    CHECK_EQ(hdr->type, 1);
+    CHECK_EQ(hdr->machine, 183);
+    CHECK_EQ(hdr->shentsize, sizeof(ElfSection));
+
+    ElfSection* text = find_section(".text");
+    ElfSection* rela = find_section(".rela.text");
+    ElfSection* symtab = find_section(".symtab");
+    CHECK(text && rela && symtab && find_section(".strtab") &&
+          find_section(".note.GNU-stack"));
+    if (!text || !rela || !symtab) return check_end("elf");
+    CHECK_EQ(text->type, SHT_PROGBITS);
+    CHECK_EQ(text->size, rasGetSize(ctx));
+    CHECK_EQ(rela->type, SHT_RELA);
+    CHECK_EQ(rela->entsize, sizeof(ElfRela));
+    CHECK(&sections[rela->link] == symtab);
+    CHECK(&sections[rela->info] == text);
+    CHECK_EQ(symtab->type, SHT_SYMTAB);
+    CHECK_EQ(sections[symtab->link].type, SHT_STRTAB);
+
+    size_t dataOff = 40, tableOff = 56;
+    ElfSymbol* sym = find_symbol("jit_fn");
+    CHECK(sym && sym->shndx == text - sections && sym->value == 0 &&
+          sym->info >> 4 == 1);
+    sym = find_symbol("jit_data");
+    CHECK(sym && sym->shndx == text - sections && sym->value == dataOff);
+    sym = find_symbol("puts");
+    CHECK(sym && sym->shndx == 0);
+
+    check_rela(0, R_AARCH64_CALL26, "puts", 0);
+    check_rela(4, R_AARCH64_JUMP26, "puts", 0);
+    check_rela(8, R_AARCH64_CONDBR19, "puts", 0);
+    check_rela(12, R_AARCH64_TSTBR14, "puts", 0);
+    check_rela(16, R_AARCH64_LD_PREL_LO19, "puts", 0);
+    check_rela(20, R_AARCH64_ADR_PREL_LO21, "puts", 0);
+    check_rela(24, R_AARCH64_ADR_PREL_PG_HI21, ".text", dataOff);
+    check_rela(28, R_AARCH64_ADD_ABS_LO12_NC, ".text", dataOff);
+    check_rela(dataOff, R_AARCH64_ABS64, ".text", dataOff);
+    check_rela(dataOff + 8, R_AARCH64_ABS64, "puts", 0);
+    // the addend is the distance of the entry from the start of the table
+    check_rela(tableOff + 4, R_AARCH64_PREL32, "puts", 4);
+    CHECK_EQ(rela->size / sizeof(ElfRela), 11);
+
+    // fields with relocations are left for the linker, branches within the
+    // code are resolved
+    CHECK_EQ(text_word(0), 0x94000000);
+    CHECK_EQ(text_word(16), 0x58000001);
+    CHECK_EQ(text_word(32), 0x14000001);
+    CHECK_EQ(text_word(tableOff), (uint32_t) (36 - tableOff));
+    CHECK_EQ(text_word(tableOff + 4), 0);
+
+    // rasSaveElf writes the same bytes
+    CHECK(rasSaveElf(ctx, "bin/elf.o"));
+    FILE* f = fopen("bin/elf.o", "rb");
+    uint8_t* saved = malloc(size + 1);
+    CHECK(f && fread(saved, 1, size + 1, f) == size && !memcmp(saved, obj, size));
+    if (f) fclose(f);
+    remove("bin/elf.o");
+    free(saved);
+    free(obj);
+    rasDestroy(ctx);
+
+    // external labels without a name and scaled table entries to them
+    // can't be relocated
+    ctx = rasCreateNoExec(NULL, 4096, 0);
+    LABEL(lunnamed, (void*) 0x1000);
+    BL(lunnamed);
+    CHECK_ERROR(RAS_ERR_UNNAMED_LABEL, rasWriteElf(ctx, NULL, 0));
+    rasDestroy(ctx);
+
+    ctx = rasCreateNoExec(NULL, 4096, 0);
+    LABEL(ltbl16);
+    LABEL(lext16);
+    rasNameLabel(LEXT(lext16, (void*) 0x1000), "ext");
+    L(ltbl16);
+    TABLE16(ltbl16, lext16);
+    CHECK_ERROR(RAS_ERR_BAD_LABEL, rasWriteElf(ctx, NULL, 0));
+    rasDestroy(ctx);
+
+    return check_end("elf");
+}
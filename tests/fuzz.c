@@ -0,0 +1,622 @@
+#include <capstone/capstone.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RAS_CTX_VAR ctx
+#include "ras/ras.h"
+#include "ras/ras_a64.h"
+
+// encodes instructions with random operands and compares the disassembly
+// from capstone with the text expected for those operands. operands are
+// kept away from the aliases capstone prints (mov, cmp, tst, ...) and
+// immediates are compared by value so hex and decimal both match
+//
+// usage: fuzz [iterations] [seed]
+
+#define BATCH 4096
+
+static uint64_t rngState = 0x9e3779b97f4a7c15;
+
+static uint64_t rnd(void) {
+    // xorshift64*
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return rngState * 0x2545f4914f6cdd1d;
+}
+
+static uint32_t below(uint32_t n) {
+    return rnd() % n;
+}
+
+// a register that can't be ZR or SP
+static rasA64Reg reg(void) {
+    return (rasA64Reg) {below(31)};
+}
+
+// a register where 31 is SP
+static rasA64Reg regsp(void) {
+    uint32_t r = below(32);
+    return (rasA64Reg) {r, r == 31};
+}
+
+static const char* gpr(uint32_t sf, rasA64Reg r) {
+    static char bufs[8][8];
+    static int next;
+    char* b = bufs[next++ & 7];
+    if (r.idx == 31) {
+        snprintf(b, 8, "%s", r.isSp ? (sf ? "sp" : "wsp") : (sf ? "xzr" : "wzr"));
+    } else {
+        snprintf(b, 8, "%c%d", sf ? 'x' : 'w', r.idx);
+    }
+    return b;
+}
+
+static const char* conds[14] = {"eq", "ne", "hs", "lo", "mi", "pl", "vs",
+                                "vc", "hi", "ls", "ge", "lt", "gt", "le"};
+static const char* shifts[4] = {"lsl", "lsr", "asr", "ror"};
+static const char* extends[8] = {"uxtb", "uxth", "uxtw", "uxtx",
+                                 "sxtb", "sxth", "sxtw", "sxtx"};
+
+typedef void (*fuzzFn)(rasBlock* ctx, char* exp, size_t size);
+
+static void fuzz_addsub_imm(rasBlock* ctx, char* exp, size_t size) {
+    static const char* names[4] = {"add", "adds", "sub", "subs"};
+    uint32_t sf = below(2), op = below(2), s = below(2), sh = below(2);
+    uint32_t imm = 1 + below(4095);
+    // flag setting ones with ZR are cmp/cmn
+    rasA64Reg rd = s ? reg() : regsp(), rn = regsp();
+    rasEmitAddSubImm(ctx, sf, op, s, (rasA64Shift) {sh ? 12 : 0}, imm, rn, rd);
+    snprintf(exp, size, "%s %s, %s, #%u%s", names[op * 2 + s], gpr(sf, rd),
+             gpr(sf, rn), imm, sh ? ", lsl #12" : "");
+}
+
+static void fuzz_addsub_shift(rasBlock* ctx, char* exp, size_t size) {
+    static const char* names[4] = {"add", "adds", "sub", "subs"};
+    uint32_t sf = below(2), op = below(2), s = below(2);
+    uint32_t type = below(3), amt = below(sf ? 64 : 32);
+    rasA64Reg rd = reg(), rn = reg(), rm = reg();
+    rasEmitAddSubShiftedReg(ctx, sf, op, s, (rasA64Shift) {amt, type}, rm, rn,
+                            rd);
+    int n = snprintf(exp, size, "%s %s, %s, %s", names[op * 2 + s],
+                     gpr(sf, rd), gpr(sf, rn), gpr(sf, rm));
+    if (amt || type) snprintf(exp + n, size - n, ", %s #%u", shifts[type], amt);
+}
+
+static void fuzz_addsub_ext(rasBlock* ctx, char* exp, size_t size) {
+    static const char* names[4] = {"add", "adds", "sub", "subs"};
+    uint32_t sf = below(2), op = below(2), s = below(2);
+    uint32_t type = below(8), amt = below(5);
+    // with SP uxtw/uxtx are printed as lsl
+    rasA64Reg rd = reg(), rn = reg(), rm = reg();
+    rasEmitAddSubExtendedReg(ctx, sf, op, s, (rasA64Extend) {amt, type}, rm,
+                             rn, rd);
+    int n = snprintf(exp, size, "%s %s, %s, %s, %s", names[op * 2 + s],
+                     gpr(sf, rd), gpr(sf, rn), gpr(sf && (type & 3) == 3, rm),
+                     extends[type]);
+    if (amt) snprintf(exp + n, size - n, " #%u", amt);
+}
+
+static void fuzz_logical_shift(rasBlock* ctx, char* exp, size_t size) {
+    static const char* names[8] = {"and", "bic",  "orr", "orn",
+                                   "eor", "eon", "ands", "bics"};
+    uint32_t sf = below(2), opc = below(4), n = below(2);
+    uint32_t type = below(4), amt = below(sf ? 64 : 32);
+    // ZR as rn or rd would be mov, mvn or tst
+    rasA64Reg rd = reg(), rn = reg(), rm = reg();
+    rasEmitLogicalReg(ctx, sf, opc, n, (rasA64Shift) {amt, type}, rm, rn, rd);
+    int len = snprintf(exp, size, "%s %s, %s, %s", names[opc * 2 + n],
+                       gpr(sf, rd), gpr(sf, rn), gpr(sf, rm));
+    if (amt || type)
+        snprintf(exp + len, size - len, ", %s #%u", shifts[type], amt);
+}
+
+static void fuzz_logical_imm(rasBlock* ctx, char* exp, size_t size) {
+    static const char* names[4] = {"and", "orr", "eor", "ands"};
+    uint32_t sf = below(2), opc = below(4);
+    // a run of ones rotated in an element repeated over the register, kept
+    // below the sign bit since capstone prints some of those as negative
+    uint32_t esize = 2 << below(sf ? 6 : 5);
+    uint32_t ones = 1 + below(esize - 1), rot = below(esize);
+    uint64_t mask = esize == 64 ? ~0ull : (1ull << esize) - 1;
+    uint64_t e = (1ull << ones) - 1;
+    if (rot) e = (e >> rot | e << (esize - rot)) & mask;
+    uint64_t imm = 0;
+    for (uint32_t i = 0; i < (sf ? 64 : 32); i += esize) imm |= e << i;
+    if (sf && imm >> 63) imm = ~imm;
+    if (!sf) imm &= 0xffffffff;
+    rasA64Reg rd = opc == 3 ? reg() : regsp(), rn = reg();
+    rasEmitLogicalImm(ctx, sf, opc, imm, rn, rd);
+    snprintf(exp, size, "%s %s, %s, #%llu", names[opc], gpr(sf, rd),
+             gpr(sf, rn), (unsigned long long) imm);
+}
+
+static void fuzz_dataproc2(rasBlock* ctx, char* exp, size_t size) {
+    static const uint32_t opcodes[6] = {2, 3, 8, 9, 10, 11};
+    static const char* names[6] = {"udiv", "sdiv", "lsl", "lsr", "asr", "ror"};
+    uint32_t sf = below(2), i = below(6);
+    rasA64Reg rd = reg(), rn = reg(), rm = reg();
+    rasEmitDataProc2Source(ctx, sf, 0, rm, opcodes[i], rn, rd);
+    snprintf(exp, size, "%s %s, %s, %s", names[i], gpr(sf, rd), gpr(sf, rn),
+             gpr(sf, rm));
+}
+
+static void fuzz_dataproc3(rasBlock* ctx, char* exp, size_t size) {
+    uint32_t sf = below(2), o0 = below(2);
+    // ZR as ra is mul/mneg
+    rasA64Reg rd = reg(), rn = reg(), rm = reg(), ra = reg();
+    rasEmitDataProc3Source(ctx, sf, 0, 0, rm, o0, ra, rn, rd);
+    snprintf(exp, size, "%s %s, %s, %s, %s", o0 ? "msub" : "madd",
+             gpr(sf, rd), gpr(sf, rn), gpr(sf, rm), gpr(sf, ra));
+}
+
+static void fuzz_condselect(rasBlock* ctx, char* exp, size_t size) {
+    static const char* names[4] = {"csel", "csinc", "csinv", "csneg"};
+    uint32_t sf = below(2), op = below(2), op2 = below(2), cond = below(14);
+    // the same register twice is cinc/cinv/cneg
+    rasA64Reg rd = reg(), rn = reg(), rm = reg();
+    if (rm.idx == rn.idx) rm.idx = (rn.idx + 1) % 31;
+    rasEmitCondSelect(ctx, sf, op, 0, rm, cond, op2, rn, rd);
+    snprintf(exp, size, "%s %s, %s, %s, %s", names[op * 2 + op2],
+             gpr(sf, rd), gpr(sf, rn), gpr(sf, rm), conds[cond]);
+}
+
+static void fuzz_bitfield(rasBlock* ctx, char* exp, size_t size) {
+    uint32_t sf = below(2), opc = below(2) * 2, bits = sf ? 64 : 32;
+    // lsb 0 or fields that reach the top are sxt/uxt or a shift
+    uint32_t lsb = 1 + below(bits - 2);
+    uint32_t width = 1 + below(bits - lsb - 1);
+    rasA64Reg rd = reg(), rn = reg();
+    rasEmitBitfield(ctx, sf, opc, sf, lsb, lsb + width - 1, rn, rd);
+    snprintf(exp, size, "%s %s, %s, #%u, #%u", opc ? "ubfx" : "sbfx",
+             gpr(sf, rd), gpr(sf, rn), lsb, width);
+}
+
+static void fuzz_shift_imm(rasBlock* ctx, char* exp, size_t size) {
+    uint32_t sf = below(2), type = below(3);
+    uint32_t amt = 1 + below((sf ? 64 : 32) - 1);
+    rasA64Reg rd = reg(), rn = reg();
+    rasEmitPseudoShiftImm(ctx, sf, type, rd, rn, amt);
+    snprintf(exp, size, "%s %s, %s, #%u", shifts[type], gpr(sf, rd),
+             gpr(sf, rn), amt);
+}
+
+static void fuzz_movk(rasBlock* ctx, char* exp, size_t size) {
+    uint32_t sf = below(2), hw = below(sf ? 4 : 2), imm = below(0x10000);
+    rasA64Reg rd = reg();
+    rasEmitMoveWide(ctx, sf, 3, (rasA64Shift) {hw * 16}, imm, rd);
+    int n = snprintf(exp, size, "movk %s, #%u", gpr(sf, rd), imm);
+    if (hw) snprintf(exp + n, size - n, ", lsl #%u", hw * 16);
+}
+
+static void fuzz_addsub_carry(rasBlock* ctx, char* exp, size_t size) {
+    static const char* names[4] = {"adc", "adcs", "sbc", "sbcs"};
+    uint32_t sf = below(2), op = below(2), s = below(2);
+    // sbc with ZR as rn is ngc
+    rasA64Reg rd = reg(), rn = reg(), rm = reg();
+    rasEmitAddSubCarry(ctx, sf, op, s, rm, rn, rd);
+    snprintf(exp, size, "%s %s, %s, %s", names[op * 2 + s], gpr(sf, rd),
+             gpr(sf, rn), gpr(sf, rm));
+}
+
+static void fuzz_extract(rasBlock* ctx, char* exp, size_t size) {
+    uint32_t sf = below(2), lsb = below(sf ? 64 : 32);
+    // the same register twice is ror
+    rasA64Reg rd = reg(), rn = reg(), rm = reg();
+    if (rm.idx == rn.idx) rm.idx = (rn.idx + 1) % 31;
+    rasEmitExtract(ctx, sf, 0, sf, 0, rm, lsb, rn, rd);
+    snprintf(exp, size, "extr %s, %s, %s, #%u", gpr(sf, rd), gpr(sf, rn),
+             gpr(sf, rm), lsb);
+}
+
+// an external label bits wide words away from the next instruction, and
+// the address capstone prints for it
+static rasLabel branch_target(rasBlock* ctx, uint32_t bits, uint64_t* addr) {
+    int64_t words = (int64_t) below(1u << bits) - (1 << (bits - 1));
+    *addr = (uint64_t) rasGetBaseAddr(ctx) + rasGetSize(ctx) + words * 4;
+    return rasDefineLabelExternal(rasDeclareLabel(ctx),
+                                  (void*) (uintptr_t) *addr);
+}
+
+static void fuzz_branch(rasBlock* ctx, char* exp, size_t size) {
+    uint64_t addr;
+    uint32_t op = below(2);
+    rasEmitBranchUncondImm(ctx, op, branch_target(ctx, 26, &addr));
+    snprintf(exp, size, "%s #%llu", op ? "bl" : "b", (unsigned long long) addr);
+}
+
+static void fuzz_branch_cond(rasBlock* ctx, char* exp, size_t size) {
+    uint64_t addr;
+    uint32_t cond = below(14);
+    rasEmitBranchCondImm(ctx, branch_target(ctx, 19, &addr), 0, cond);
+    snprintf(exp, size, "b.%s #%llu", conds[cond], (unsigned long long) addr);
+}
+
+static void fuzz_branch_comp(rasBlock* ctx, char* exp, size_t size) {
+    uint64_t addr;
+    uint32_t sf = below(2), op = below(2);
+    rasA64Reg rt = reg();
+    rasEmitBranchCompImm(ctx, sf, op, branch_target(ctx, 19, &addr), rt);
+    snprintf(exp, size, "%s %s, #%llu", op ? "cbnz" : "cbz", gpr(sf, rt),
+             (unsigned long long) addr);
+}
+
+static void fuzz_branch_test(rasBlock* ctx, char* exp, size_t size) {
+    uint64_t addr;
+    uint32_t op = below(2), b = below(64);
+    rasA64Reg rt = reg();
+    rasEmitBranchTestImm(ctx, op, b, branch_target(ctx, 14, &addr), rt);
+    // the register is printed as w for the low 32 bits
+    snprintf(exp, size, "%s %s, #%u, #%llu", op ? "tbnz" : "tbz",
+             gpr(b >= 32, rt), b, (unsigned long long) addr);
+}
+
+static void fuzz_branch_reg(rasBlock* ctx, char* exp, size_t size) {
+    static const char* names[3] = {"br", "blr", "ret"};
+    uint32_t opc = below(3);
+    rasA64Reg rn = reg();
+    rasEmitBranchReg(ctx, opc, 31, 0, rn, 0);
+    if (opc == 2 && rn.idx == 30) {
+        snprintf(exp, size, "ret");
+    } else {
+        snprintf(exp, size, "%s %s", names[opc], gpr(1, rn));
+    }
+}
+
+// loads and stores of general registers: size, opc and name
+static const struct {
+    uint32_t size, opc;
+    const char* name;
+    uint32_t sf;
+} ldst[] = {
+    {0, 0, "strb", 0},  {0, 1, "ldrb", 0},  {0, 2, "ldrsb", 1},
+    {0, 3, "ldrsb", 0}, {1, 0, "strh", 0},  {1, 1, "ldrh", 0},
+    {1, 2, "ldrsh", 1}, {1, 3, "ldrsh", 0}, {2, 0, "str", 0},
+    {2, 1, "ldr", 0},   {2, 2, "ldrsw", 1}, {3, 0, "str", 1},
+    {3, 1, "ldr", 1},
+};
+#define NLDST (sizeof ldst / sizeof ldst[0])
+
+static void fuzz_ldst_uimm(rasBlock* ctx, char* exp, size_t size) {
+    uint32_t i = below(NLDST), s = ldst[i].size;
+    uint32_t imm = below(4096) << s;
+    rasA64Reg rt = reg(), rn = regsp();
+    rasEmitLoadStoreImmOff(ctx, s, 0, ldst[i].opc, imm, 0, rn, rt);
+    if (imm) {
+        snprintf(exp, size, "%s %s, [%s, #%u]", ldst[i].name,
+                 gpr(ldst[i].sf, rt), gpr(1, rn), imm);
+    } else {
+        snprintf(exp, size, "%s %s, [%s]", ldst[i].name, gpr(ldst[i].sf, rt),
+                 gpr(1, rn));
+    }
+}
+
+static void fuzz_ldst_index(rasBlock* ctx, char* exp, size_t size) {
+    uint32_t i = below(NLDST), pre = below(2);
+    int32_t imm = (int32_t) below(512) - 256;
+    // writing back to the register being loaded is unpredictable
+    rasA64Reg rt = reg(), rn = regsp();
+    if (rn.idx == rt.idx) rn = (rasA64Reg) {31, 1};
+    rasEmitLoadStoreImmOff(ctx, ldst[i].size, 0, ldst[i].opc, imm,
+                           pre ? 3 : 1, rn, rt);
+    if (pre) {
+        snprintf(exp, size, "%s %s, [%s, #%d]!", ldst[i].name,
+                 gpr(ldst[i].sf, rt), gpr(1, rn), imm);
+    } else {
+        snprintf(exp, size, "%s %s, [%s], #%d", ldst[i].name,
+                 gpr(ldst[i].sf, rt), gpr(1, rn), imm);
+    }
+}
+
+static void fuzz_ldst_reg(rasBlock* ctx, char* exp, size_t size) {
+    // byte accesses print the shift differently, leave them out
+    uint32_t i = 4 + below(NLDST - 4), s = ldst[i].size;
+    static const uint32_t types[4] = {2, 3, 6, 7};
+    uint32_t type = types[below(4)], amt = below(2) ? s : 0;
+    rasA64Reg rt = reg(), rn = regsp(), rm = reg();
+    rasEmitLoadStoreRegOff(ctx, s, 0, ldst[i].opc, rm, (rasA64Extend) {amt, type},
+                           rn, rt);
+    int n = snprintf(exp, size, "%s %s, [%s, %s", ldst[i].name,
+                     gpr(ldst[i].sf, rt), gpr(1, rn), gpr(type & 1, rm));
+    if (type == 3) {
+        if (amt) n += snprintf(exp + n, size - n, ", lsl #%u", amt);
+    } else {
+        n += snprintf(exp + n, size - n, ", %s", extends[type]);
+        if (amt) n += snprintf(exp + n, size - n, " #%u", amt);
+    }
+    snprintf(exp + n, size - n, "]");
+}
+
+static void fuzz_ldst_pair(rasBlock* ctx, char* exp, size_t size) {
+    uint32_t sf = below(2), l = below(2), mod = 1 + below(3);
+    uint32_t scale = sf ? 3 : 2;
+    int32_t imm = ((int32_t) below(128) - 64) * (1 << scale);
+    rasA64Reg rt = reg(), rt2 = reg(), rn = regsp();
+    // loading the same register twice or writing back to one is
+    // unpredictable
+    if (rt2.idx == rt.idx) rt2.idx = (rt.idx + 1) % 31;
+    if (mod != 2 && (rn.idx == rt.idx || rn.idx == rt2.idx))
+        rn = (rasA64Reg) {31, 1};
+    rasEmitLoadStorePair(ctx, sf ? 2 : 0, 0, mod, l, imm, rt2, rn, rt);
+    const char* name = l ? "ldp" : "stp";
+    if (mod == 1) {
+        snprintf(exp, size, "%s %s, %s, [%s], #%d", name, gpr(sf, rt),
+                 gpr(sf, rt2), gpr(1, rn), imm);
+    } else if (mod == 3) {
+        snprintf(exp, size, "%s %s, %s, [%s, #%d]!", name, gpr(sf, rt),
+                 gpr(sf, rt2), gpr(1, rn), imm);
+    } else if (imm) {
+        snprintf(exp, size, "%s %s, %s, [%s, #%d]", name, gpr(sf, rt),
+                 gpr(sf, rt2), gpr(1, rn), imm);
+    } else {
+        snprintf(exp, size, "%s %s, %s, [%s]", name, gpr(sf, rt), gpr(sf, rt2),
+                 gpr(1, rn));
+    }
+}
+
+static void fuzz_atomic(rasBlock* ctx, char* exp, size_t size) {
+    static const char* names[9] = {"ldadd",  "ldclr",  "ldeor",
+                                   "ldset",  "ldsmax", "ldsmin",
+                                   "ldumax", "ldumin", "swp"};
+    static const char* order[4] = {"", "l", "a", "al"};
+    static const char* suffix[4] = {"b", "h", "", ""};
+    uint32_t i = below(9), sz = below(4), a = below(2), r = below(2);
+    // ZR as rt without acquire is the st* alias
+    rasA64Reg rs = {below(32)}, rt = reg(), rn = regsp();
+    rasEmitAtomicMemOp(ctx, sz, a, r, rs, i == 8, i == 8 ? 0 : i, 0, rn, rt);
+    snprintf(exp, size, "%s%s%s %s, %s, [%s]", names[i], order[a * 2 + r],
+             suffix[sz], gpr(sz == 3, rs), gpr(sz == 3, rt), gpr(1, rn));
+}
+
+static void fuzz_simd3same(rasBlock* ctx, char* exp, size_t size) {
+    static const struct {
+        uint32_t u, opcode;
+        const char* name;
+        // 2D exists, 8B/16B exist
+        int d, b;
+    } ops[] = {
+        {0, 16, "add", 1, 1},  {1, 16, "sub", 1, 1},  {1, 17, "cmeq", 1, 1},
+        {0, 6, "cmgt", 1, 1},  {0, 12, "smax", 0, 1}, {1, 13, "umin", 0, 1},
+        {0, 19, "mul", 0, 1},  {1, 1, "uqadd", 1, 1}, {0, 22, "sqdmulh", 0, 0},
+    };
+    static const char* arr[4][2] = {
+        {"8b", "16b"}, {"4h", "8h"}, {"2s", "4s"}, {NULL, "2d"}};
+    uint32_t i = below(sizeof ops / sizeof ops[0]);
+    uint32_t sz, q;
+    do {
+        sz = below(4);
+        q = below(2);
+    } while (!arr[sz][q] || (sz == 3 && !ops[i].d) || (sz == 0 && !ops[i].b));
+    rasA64VReg rd = {below(32)}, rn = {below(32)}, rm = {below(32)};
+    rasEmitAdvSIMD3Same(ctx, q, ops[i].u, sz, rm, ops[i].opcode, rn, rd);
+    snprintf(exp, size, "%s v%d.%s, v%d.%s, v%d.%s", ops[i].name, rd.idx,
+             arr[sz][q], rn.idx, arr[sz][q], rm.idx, arr[sz][q]);
+}
+
+static void fuzz_fp2(rasBlock* ctx, char* exp, size_t size) {
+    static const char* names[6] = {"fmul", "fdiv", "fadd",
+                                   "fsub", "fmax", "fmin"};
+    uint32_t ftype = below(2), opcode = below(6);
+    rasA64VReg rd = {below(32)}, rn = {below(32)}, rm = {below(32)};
+    rasEmitFPDataProc2Source(ctx, 0, 0, ftype, rm, opcode, rn, rd);
+    char t = ftype ? 'd' : 's';
+    snprintf(exp, size, "%s %c%d, %c%d, %c%d", names[opcode], t, rd.idx, t,
+             rn.idx, t, rm.idx);
+}
+
+static void fuzz_fp3(rasBlock* ctx, char* exp, size_t size) {
+    static const char* names[4] = {"fmadd", "fmsub", "fnmadd", "fnmsub"};
+    uint32_t ftype = below(2), o1 = below(2), o0 = below(2);
+    rasA64VReg rd = {below(32)}, rn = {below(32)}, rm = {below(32)},
+               ra = {below(32)};
+    rasEmitFPDataProc3Source(ctx, 0, 0, ftype, o1, rm, o0, ra, rn, rd);
+    char t = ftype ? 'd' : 's';
+    snprintf(exp, size, "%s %c%d, %c%d, %c%d, %c%d", names[o1 * 2 + o0], t,
+             rd.idx, t, rn.idx, t, rm.idx, t, ra.idx);
+}
+
+static void fuzz_simd2misc(rasBlock* ctx, char* exp, size_t size) {
+    static const struct {
+        uint32_t u, opcode;
+        const char* name;
+        // sizes that exist, 2D needs q
+        uint32_t sizes;
+    } ops[] = {
+        {0, 11, "abs", 15}, {1, 11, "neg", 15}, {0, 4, "cls", 7},
+        {1, 4, "clz", 7},   {0, 5, "cnt", 1},   {1, 5, "rbit", 1},
+        {0, 0, "rev64", 7}, {0, 7, "sqabs", 15},
+    };
+    static const char* arr[4][2] = {
+        {"8b", "16b"}, {"4h", "8h"}, {"2s", "4s"}, {NULL, "2d"}};
+    uint32_t i = below(sizeof ops / sizeof ops[0]);
+    uint32_t sz, q;
+    do {
+        sz = below(4);
+        q = below(2);
+    } while (!arr[sz][q] || !(ops[i].sizes >> sz & 1));
+    rasA64VReg rd = {below(32)}, rn = {below(32)};
+    // rbit is size 1 in the encoding
+    uint32_t esz = ops[i].opcode == 5 && ops[i].u ? 1 : sz;
+    rasEmitAdvSIMD2Misc(ctx, q, ops[i].u, esz, ops[i].opcode, rn, rd);
+    snprintf(exp, size, "%s v%d.%s, v%d.%s", ops[i].name, rd.idx, arr[sz][q],
+             rn.idx, arr[sz][q]);
+}
+
+static void fuzz_fp1(rasBlock* ctx, char* exp, size_t size) {
+    static const char* names[4] = {"fmov", "fabs", "fneg", "fsqrt"};
+    uint32_t ftype = below(2), opcode = below(4);
+    rasA64VReg rd = {below(32)}, rn = {below(32)};
+    rasEmitFPDataProc1Source(ctx, 0, 0, ftype, opcode, rn, rd);
+    char t = ftype ? 'd' : 's';
+    snprintf(exp, size, "%s %c%d, %c%d", names[opcode], t, rd.idx, t, rn.idx);
+}
+
+static void fuzz_fpcompare(rasBlock* ctx, char* exp, size_t size) {
+    uint32_t ftype = below(2), e = below(2), zero = below(2);
+    rasA64VReg rn = {below(32)}, rm = {zero ? 0 : below(32)};
+    rasEmitFPCompare(ctx, 0, 0, ftype, rm, 0, rn, e << 4 | zero << 3);
+    char t = ftype ? 'd' : 's';
+    if (zero) {
+        snprintf(exp, size, "%s %c%d, #0.0", e ? "fcmpe" : "fcmp", t, rn.idx);
+    } else {
+        snprintf(exp, size, "%s %c%d, %c%d", e ? "fcmpe" : "fcmp", t, rn.idx,
+                 t, rm.idx);
+    }
+}
+
+static void fuzz_fpcondselect(rasBlock* ctx, char* exp, size_t size) {
+    uint32_t ftype = below(2), cond = below(14);
+    rasA64VReg rd = {below(32)}, rn = {below(32)}, rm = {below(32)};
+    rasEmitFPCondSelect(ctx, 0, 0, ftype, rm, cond, rn, rd);
+    char t = ftype ? 'd' : 's';
+    snprintf(exp, size, "fcsel %c%d, %c%d, %c%d, %s", t, rd.idx, t, rn.idx, t,
+             rm.idx, conds[cond]);
+}
+
+static void fuzz_fpconvert(rasBlock* ctx, char* exp, size_t size) {
+    // rmode, opcode, name and whether it goes to a general register
+    static const struct {
+        uint32_t rmode, opcode;
+        const char* name;
+        int toGpr;
+    } ops[] = {
+        {0, 2, "scvtf", 0},  {0, 3, "ucvtf", 0},  {3, 0, "fcvtzs", 1},
+        {3, 1, "fcvtzu", 1}, {1, 0, "fcvtps", 1}, {2, 1, "fcvtmu", 1},
+    };
+    uint32_t sf = below(2), ftype = below(2), i = below(6);
+    rasA64Reg r = reg();
+    rasA64VReg v = {below(32)};
+    char t = ftype ? 'd' : 's';
+    if (ops[i].toGpr) {
+        rasEmitFPConvertInt(ctx, sf, 0, ftype, ops[i].rmode, ops[i].opcode, v,
+                            (rasA64VReg) {r.idx});
+        snprintf(exp, size, "%s %s, %c%d", ops[i].name, gpr(sf, r), t, v.idx);
+    } else {
+        rasEmitFPConvertInt(ctx, sf, 0, ftype, ops[i].rmode, ops[i].opcode,
+                            (rasA64VReg) {r.idx}, v);
+        snprintf(exp, size, "%s %c%d, %s", ops[i].name, t, v.idx, gpr(sf, r));
+    }
+}
+
+static const struct {
+    const char* name;
+    fuzzFn fn;
+} fuzzers[] = {
+    {"addsub_imm", fuzz_addsub_imm},
+    {"addsub_shift", fuzz_addsub_shift},
+    {"addsub_ext", fuzz_addsub_ext},
+    {"logical_shift", fuzz_logical_shift},
+    {"logical_imm", fuzz_logical_imm},
+    {"dataproc2", fuzz_dataproc2},
+    {"dataproc3", fuzz_dataproc3},
+    {"condselect", fuzz_condselect},
+    {"bitfield", fuzz_bitfield},
+    {"shift_imm", fuzz_shift_imm},
+    {"movk", fuzz_movk},
+    {"addsub_carry", fuzz_addsub_carry},
+    {"extract", fuzz_extract},
+    {"branch", fuzz_branch},
+    {"branch_cond", fuzz_branch_cond},
+    {"branch_comp", fuzz_branch_comp},
+    {"branch_test", fuzz_branch_test},
+    {"branch_reg", fuzz_branch_reg},
+    {"ldst_uimm", fuzz_ldst_uimm},
+    {"ldst_index", fuzz_ldst_index},
+    {"ldst_reg", fuzz_ldst_reg},
+    {"ldst_pair", fuzz_ldst_pair},
+    {"atomic", fuzz_atomic},
+    {"simd3same", fuzz_simd3same},
+    {"simd2misc", fuzz_simd2misc},
+    {"fp2", fuzz_fp2},
+    {"fp3", fuzz_fp3},
+    {"fp1", fuzz_fp1},
+    {"fpcompare", fuzz_fpcompare},
+    {"fpcondselect", fuzz_fpcondselect},
+    {"fpconvert", fuzz_fpconvert},
+};
+#define NFUZZERS (sizeof fuzzers / sizeof fuzzers[0])
+
+// copies s with every #immediate written in decimal as a 64 bit value
+static void normalize(const char* s, char* out, size_t size) {
+    size_t n = 0;
+    while (*s && n + 24 < size) {
+        char* end;
+        if (*s == '#' && (s[1] == '-' || (s[1] >= '0' && s[1] <= '9'))) {
+            unsigned long long v = s[1] == '-' ? (unsigned long long) strtoll(
+                                                     s + 1, &end, 0)
+                                               : strtoull(s + 1, &end, 0);
+            n += snprintf(out + n, size - n, "#%llu", v);
+            s = end;
+        } else {
+            out[n++] = *s++;
+        }
+    }
+    out[n] = '\0';
+}
+
+void errorCb(rasError err) {
+    fprintf(stderr, "%s\n", rasErrorStrings[err]);
+    abort();
+}
+
+int main(int argc, char** argv) {
+    rasSetErrorCallback((rasErrorCallback) errorCb, NULL);
+    size_t iters = argc > 1 ? strtoull(argv[1], NULL, 0) : 1 << 20;
+    if (argc > 2) rngState = strtoull(argv[2], NULL, 0) | 1;
+
+    csh handle;
+    cs_open(CS_ARCH_ARM64, CS_MODE_LITTLE_ENDIAN, &handle);
+    cs_option(handle, CS_OPT_SKIPDATA, CS_OPT_ON);
+
+    static char expected[BATCH][96];
+    static uint8_t family[BATCH];
+    size_t fails[NFUZZERS] = {0}, counts[NFUZZERS] = {0};
+    size_t failct = 0;
+
+    for (size_t done = 0; done < iters; done += BATCH) {
+        rasBlock* ctx = rasCreate(BATCH * 4);
+        size_t n = iters - done < BATCH ? iters - done : BATCH;
+        for (size_t i = 0; i < n; i++) {
+            family[i] = below(NFUZZERS);
+            fuzzers[family[i]].fn(ctx, expected[i], sizeof expected[i]);
+            counts[family[i]]++;
+        }
+        rasReady(ctx);
+
+        cs_insn* insn;
+        // at the real address so branch targets are printed as expected
+        size_t count = cs_disasm(handle, rasGetCode(ctx), rasGetSize(ctx),
+                                 (uint64_t) rasGetBaseAddr(ctx), 0, &insn);
+        for (size_t i = 0; i < n; i++) {
+            char actual[256], a[256], e[256];
+            if (i < count) {
+                snprintf(actual, sizeof actual, "%s%s%s", insn[i].mnemonic,
+                         insn[i].op_str[0] ? " " : "", insn[i].op_str);
+            } else {
+                actual[0] = '\0';
+            }
+            normalize(actual, a, sizeof a);
+            normalize(expected[i], e, sizeof e);
+            if (strcmp(a, e)) {
+                // only print the first few of each kind
+                if (fails[family[i]]++ < 8) {
+                    fprintf(stderr, "%s %08x expected:%s actual:%s\n",
+                            fuzzers[family[i]].name,
+                            ((uint32_t*) rasGetCode(ctx))[i], expected[i],
+                            actual);
+                }
+                failct++;
+            }
+        }
+        cs_free(insn, count);
+        rasDestroy(ctx);
+    }
+    cs_close(&handle);
+
+    for (size_t i = 0; i < NFUZZERS; i++) {
+        printf("%-14s %8zu %8zu\n", fuzzers[i].name, counts[i], fails[i]);
+    }
+    printf("%zu instructions, %zu failed\n", iters, failct);
+    return failct != 0;
+}
@@ -0,0 +1,498 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RAS_CTX_VAR ctx
+#include "ras/ras.h"
+#include "ras/ras_a64.h"
+
+// runs random sequences of integer instructions and compares the registers
+// afterwards with the same sequence computed in C. this covers the pseudo
+// instructions too, which expand to sequences the disassembly fuzzer can't
+// check: large immediates, calls with their argument moves, switches and
+// the prologue and epilogue around each sequence. the code only runs on
+// aarch64, natively or under qemu-aarch64, on other hosts the sequences are
+// just encoded
+//
+// usage: fuzz_exec [sequences] [seed]
+
+#define NREGS 8
+#define NOPS 32
+// values live in callee saved registers so they survive calls
+#define VAL(r) R(19 + (r))
+#define STATE R(27)
+#define TMP R(16)
+#define NARGS 4
+#define NCASES 4
+
+enum {
+    OP_ADD,
+    OP_SUB,
+    OP_AND,
+    OP_ORR,
+    OP_EOR,
+    OP_ADDIMM,
+    OP_ANDIMM,
+    OP_ORRIMM,
+    OP_EORIMM,
+    OP_MOVIMM,
+    OP_MADD,
+    OP_MSUB,
+    OP_UDIV,
+    OP_SDIV,
+    OP_LSLV,
+    OP_LSRV,
+    OP_ASRV,
+    OP_LSL,
+    OP_LSR,
+    OP_ASR,
+    OP_UBFX,
+    OP_SBFX,
+    OP_CLZ,
+    OP_RBIT,
+    OP_REV,
+    OP_CSEL,
+    OP_CALL,
+    OP_SWITCH,
+    OP_MAX
+};
+
+typedef struct {
+    uint8_t op, sf, rd, rn, rm, ra, cond;
+    // shift amounts, lsb and width, a second register, or for calls the
+    // source of each argument in 3 bits (NARGS for the immediate)
+    uint32_t a, b;
+    uint64_t imm;
+} Op;
+
+static uint64_t rngState = 0x9e3779b97f4a7c15;
+
+static uint64_t rnd(void) {
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return rngState * 0x2545f4914f6cdd1d;
+}
+
+static uint32_t below(uint32_t n) {
+    return rnd() % n;
+}
+
+// values near the edges the encoders special case
+static uint64_t interesting(void) {
+    switch (below(8)) {
+        case 0:
+            return below(4096);
+        case 1:
+            return (uint64_t) below(4096) << 12;
+        case 2:
+            return -(uint64_t) below(4096);
+        case 3:
+            return (uint64_t) below(0x10000) << (16 * below(4));
+        case 4: {
+            uint32_t ones = 1 + below(63);
+            return ((1ull << ones) - 1) << below(64 - ones);
+        }
+        case 5:
+            return ~((uint64_t) below(0x10000) << (16 * below(4)));
+        case 6:
+            return 1ull << below(64);
+        default:
+            return rnd();
+    }
+}
+
+static uint64_t mask(uint32_t sf) {
+    return sf ? ~0ull : 0xffffffff;
+}
+
+static int64_t sext(uint64_t v, uint32_t bits) {
+    return (int64_t) (v << (64 - bits)) >> (64 - bits);
+}
+
+static int cond_holds(uint32_t cond, uint64_t a, uint64_t b, uint32_t bits) {
+    uint64_t res = (a - b) & mask(bits == 64);
+    int n = res >> (bits - 1) & 1, z = res == 0, c = a >= b;
+    int v = ((a ^ b) & (a ^ res)) >> (bits - 1) & 1;
+    int r;
+    switch (cond >> 1) {
+        case 0:
+            r = z;
+            break;
+        case 1:
+            r = c;
+            break;
+        case 2:
+            r = n;
+            break;
+        case 3:
+            r = v;
+            break;
+        case 4:
+            r = c && !z;
+            break;
+        case 5:
+            r = n == v;
+            break;
+        case 6:
+            r = !z && n == v;
+            break;
+        default:
+            r = 1;
+    }
+    return cond & 1 ? !r : r;
+}
+
+static void gen_op(Op* o) {
+    memset(o, 0, sizeof *o);
+    o->op = below(OP_MAX);
+    o->sf = below(2);
+    o->rd = below(NREGS);
+    o->rn = below(NREGS);
+    o->rm = below(NREGS);
+    o->ra = below(NREGS);
+    uint32_t bits = o->sf ? 64 : 32;
+    switch (o->op) {
+        case OP_ADD:
+        case OP_SUB:
+        case OP_AND:
+        case OP_ORR:
+        case OP_EOR:
+        case OP_LSL:
+        case OP_LSR:
+        case OP_ASR:
+            o->a = below(bits);
+            break;
+        case OP_ADDIMM:
+            o->a = below(2);
+            // fallthrough
+        case OP_ANDIMM:
+        case OP_ORRIMM:
+        case OP_EORIMM:
+        case OP_MOVIMM:
+            o->imm = interesting() & mask(o->sf);
+            break;
+        case OP_UBFX:
+        case OP_SBFX:
+            o->a = below(bits);
+            o->b = 1 + below(bits - o->a);
+            break;
+        case OP_CSEL:
+            o->cond = below(14);
+            o->a = below(NREGS);
+            break;
+        case OP_CALL:
+            o->sf = 1;
+            o->a = below(NREGS);
+            for (int i = 0; i < NARGS; i++) o->b |= below(NARGS + 1) << (i * 3);
+            o->imm = interesting();
+            break;
+        case OP_SWITCH:
+            // table entry size
+            o->sf = 1;
+            o->a = below(3);
+            o->imm = interesting();
+            break;
+    }
+}
+
+static uint64_t helper(uint64_t a, uint64_t b, uint64_t c, uint64_t d) {
+    return a + b * 3 + c * 5 + d * 7;
+}
+
+// the value a case of a switch sets
+static uint64_t case_value(const Op* o, uint32_t k) {
+    return o->imm + k * 0x9e3779b97f4a7c15;
+}
+
+// call arguments are taken from R0-R3, holding rn, rm, ra and a, so the
+// moves into place overlap
+static rasA64Arg call_arg(const Op* o, int i) {
+    uint32_t src = o->b >> (i * 3) & 7;
+    return src < NARGS ? ARG(R(src)) : ARG(o->imm);
+}
+
+static void emit_op(rasBlock* ctx, const Op* o) {
+    rasA64Reg rd = VAL(o->rd), rn = VAL(o->rn), rm = VAL(o->rm),
+              ra = VAL(o->ra);
+    uint32_t sf = o->sf;
+    switch (o->op) {
+        case OP_ADD:
+            ADDSUB(sf, 0, 0, rd, rn, rm, LSL(o->a));
+            break;
+        case OP_SUB:
+            ADDSUB(sf, 1, 0, rd, rn, rm, LSL(o->a));
+            break;
+        case OP_AND:
+            LOGICAL(sf, 0, 0, rd, rn, rm, LSL(o->a));
+            break;
+        case OP_ORR:
+            LOGICAL(sf, 1, 0, rd, rn, rm, LSL(o->a));
+            break;
+        case OP_EOR:
+            LOGICAL(sf, 2, 0, rd, rn, rm, LSL(o->a));
+            break;
+        case OP_ADDIMM:
+            ADDSUB(sf, o->a, 0, rd, rn, o->imm, TMP);
+            break;
+        case OP_ANDIMM:
+            LOGICAL(sf, 0, 0, rd, rn, o->imm, TMP);
+            break;
+        case OP_ORRIMM:
+            LOGICAL(sf, 1, 0, rd, rn, o->imm, TMP);
+            break;
+        case OP_EORIMM:
+            LOGICAL(sf, 2, 0, rd, rn, o->imm, TMP);
+            break;
+        case OP_MOVIMM:
+            MOVEGPR(sf, rd, o->imm);
+            break;
+        case OP_MADD:
+            DATAPROC3SOURCE(sf, 0, 0, 0, rd, rn, rm, ra);
+            break;
+        case OP_MSUB:
+            DATAPROC3SOURCE(sf, 0, 0, 1, rd, rn, rm, ra);
+            break;
+        case OP_UDIV:
+            DATAPROC2SOURCE(sf, 0, 2, rd, rn, rm);
+            break;
+        case OP_SDIV:
+            DATAPROC2SOURCE(sf, 0, 3, rd, rn, rm);
+            break;
+        case OP_LSLV:
+        case OP_LSRV:
+        case OP_ASRV:
+            SHIFT(sf, o->op - OP_LSLV, rd, rn, rm);
+            break;
+        case OP_LSL:
+        case OP_LSR:
+        case OP_ASR:
+            SHIFT(sf, o->op - OP_LSL, rd, rn, o->a);
+            break;
+        case OP_UBFX:
+            BITFIELD(sf, 2, sf, rd, rn, o->a, o->a + o->b - 1);
+            break;
+        case OP_SBFX:
+            BITFIELD(sf, 0, sf, rd, rn, o->a, o->a + o->b - 1);
+            break;
+        case OP_CLZ:
+            DATAPROC1SOURCE(sf, 0, 0, 4, rd, rn);
+            break;
+        case OP_RBIT:
+            DATAPROC1SOURCE(sf, 0, 0, 0, rd, rn);
+            break;
+        case OP_REV:
+            DATAPROC1SOURCE(sf, 0, 0, sf ? 3 : 2, rd, rn);
+            break;
+        case OP_CSEL:
+            ADDSUB(sf, 1, 1, ZR, rn, rm);
+            CONDSELECT(sf, 0, 0, 0, rd, ra, VAL(o->a), o->cond);
+            break;
+        case OP_CALL:
+            MOVX(R0, rn);
+            MOVX(R1, rm);
+            MOVX(R2, ra);
+            MOVX(R3, VAL(o->a));
+            CALL(LNEW(helper), call_arg(o, 0), call_arg(o, 1), call_arg(o, 2),
+                 call_arg(o, 3));
+            MOVX(rd, R0);
+            break;
+        case OP_SWITCH: {
+            LABEL(ldefault);
+            LABEL(lend);
+            rasLabel cases[NCASES];
+            for (int k = 0; k < NCASES; k++) cases[k] = LNEW();
+            // half the indices are out of range
+            LOGICAL(0, 0, 0, R0, rn, 2 * NCASES - 1, TMP);
+            switch (o->a) {
+                case 0:
+                    SWITCH(R0, ldefault, cases[0], cases[1], cases[2],
+                           cases[3]);
+                    break;
+                case 1:
+                    SWITCH16(R0, ldefault, cases[0], cases[1], cases[2],
+                             cases[3]);
+                    break;
+                default:
+                    SWITCH8(R0, ldefault, cases[0], cases[1], cases[2],
+                            cases[3]);
+                    break;
+            }
+            for (int k = 0; k < NCASES; k++) {
+                L(cases[k]);
+                MOVEGPR(1, rd, case_value(o, k));
+                B(lend);
+            }
+            L(ldefault);
+            MOVX(rd, ra);
+            L(lend);
+            break;
+        }
+    }
+}
+
+static void run_op(uint64_t* x, const Op* o) {
+    uint32_t sf = o->sf, bits = sf ? 64 : 32;
+    uint64_t m = mask(sf);
+    uint64_t n = x[o->rn] & m, mm = x[o->rm] & m, a = x[o->ra] & m, r = 0;
+    switch (o->op) {
+        case OP_ADD:
+            r = n + (mm << o->a);
+            break;
+        case OP_SUB:
+            r = n - (mm << o->a);
+            break;
+        case OP_AND:
+            r = n & (mm << o->a);
+            break;
+        case OP_ORR:
+            r = n | (mm << o->a);
+            break;
+        case OP_EOR:
+            r = n ^ (mm << o->a);
+            break;
+        case OP_ADDIMM:
+            r = o->a ? n - o->imm : n + o->imm;
+            break;
+        case OP_ANDIMM:
+            r = n & o->imm;
+            break;
+        case OP_ORRIMM:
+            r = n | o->imm;
+            break;
+        case OP_EORIMM:
+            r = n ^ o->imm;
+            break;
+        case OP_MOVIMM:
+            r = o->imm;
+            break;
+        case OP_MADD:
+            r = a + n * mm;
+            break;
+        case OP_MSUB:
+            r = a - n * mm;
+            break;
+        case OP_UDIV:
+            r = mm ? n / mm : 0;
+            break;
+        case OP_SDIV: {
+            int64_t sn = sext(n, bits), sm = sext(mm, bits);
+            // the overflowing case gives back the dividend
+            r = !sm ? 0 : sm == -1 ? -(uint64_t) sn : (uint64_t) (sn / sm);
+            break;
+        }
+        case OP_LSLV:
+            r = n << (mm & (bits - 1));
+            break;
+        case OP_LSRV:
+            r = n >> (mm & (bits - 1));
+            break;
+        case OP_ASRV:
+            r = sext(n, bits) >> (mm & (bits - 1));
+            break;
+        case OP_LSL:
+            r = n << o->a;
+            break;
+        case OP_LSR:
+            r = n >> o->a;
+            break;
+        case OP_ASR:
+            r = sext(n, bits) >> o->a;
+            break;
+        case OP_UBFX:
+            r = (n >> o->a) & (o->b == 64 ? ~0ull : (1ull << o->b) - 1);
+            break;
+        case OP_SBFX:
+            r = sext(n >> o->a, o->b);
+            break;
+        case OP_CLZ:
+            r = n ? __builtin_clzll(n) - (64 - bits) : bits;
+            break;
+        case OP_RBIT:
+            for (uint32_t i = 0; i < bits; i++) r |= (n >> i & 1) << (bits - 1 - i);
+            break;
+        case OP_REV:
+            r = sf ? __builtin_bswap64(n) : __builtin_bswap32(n);
+            break;
+        case OP_CSEL:
+            r = cond_holds(o->cond, n, mm, bits) ? a : x[o->a];
+            break;
+        case OP_CALL: {
+            uint64_t src[NARGS + 1] = {n, mm, a, x[o->a], o->imm}, args[NARGS];
+            for (int i = 0; i < NARGS; i++) args[i] = src[o->b >> (i * 3) & 7];
+            r = helper(args[0], args[1], args[2], args[3]);
+            break;
+        }
+        case OP_SWITCH: {
+            uint32_t idx = n & (2 * NCASES - 1);
+            r = idx < NCASES ? case_value(o, idx) : a;
+            break;
+        }
+    }
+    x[o->rd] = r & m;
+}
+
+void errorCb(rasError err) {
+    fprintf(stderr, "%s\n", rasErrorStrings[err]);
+    abort();
+}
+
+int main(int argc, char** argv) {
+    rasSetErrorCallback((rasErrorCallback) errorCb, NULL);
+    size_t iters = argc > 1 ? strtoull(argv[1], NULL, 0) : 1 << 16;
+    if (argc > 2) rngState = strtoull(argv[2], NULL, 0) | 1;
+
+#ifndef __aarch64__
+    printf("not on aarch64, only encoding\n");
+#endif
+
+    size_t failct = 0;
+    for (size_t i = 0; i < iters; i++) {
+        Op ops[NOPS];
+        uint64_t init[NREGS], expected[NREGS], actual[NREGS];
+        for (int r = 0; r < NREGS; r++) init[r] = interesting();
+        for (int j = 0; j < NOPS; j++) gen_op(&ops[j]);
+
+        rasBlock* ctx = rasCreate(16384);
+        // the values and state are callee saved, the locals are unused but
+        // move the saved registers around
+        rasA64Frame frame = {.gprs = 0x1ff << 19, .localSize = 16 * below(4)};
+        PROLOGUE(&frame);
+        MOVX(STATE, R0);
+        for (int r = 0; r < NREGS; r += 2)
+            LDPX(VAL(r), VAL(r + 1), (STATE, r * 8));
+        for (int j = 0; j < NOPS; j++) emit_op(ctx, &ops[j]);
+        for (int r = 0; r < NREGS; r += 2)
+            STPX(VAL(r), VAL(r + 1), (STATE, r * 8));
+        EPILOGUE(&frame);
+        RET();
+        rasReady(ctx);
+
+        memcpy(expected, init, sizeof init);
+        for (int j = 0; j < NOPS; j++) run_op(expected, &ops[j]);
+
+#ifdef __aarch64__
+        memcpy(actual, init, sizeof init);
+        void (*f)(uint64_t*) = rasGetCode(ctx);
+        f(actual);
+        if (memcmp(actual, expected, sizeof actual)) {
+            if (failct++ < 8) {
+                fprintf(stderr, "sequence %zu mismatch\n", i);
+                for (int r = 0; r < NREGS; r++) {
+                    fprintf(stderr, "x%d: %016llx expected %016llx%s\n", r,
+                            (unsigned long long) actual[r],
+                            (unsigned long long) expected[r],
+                            actual[r] != expected[r] ? " <-" : "");
+                }
+                rasDumpA64(ctx, stderr);
+            }
+        }
+#else
+        (void) actual;
+#endif
+        rasDestroy(ctx);
+    }
+
+    printf("%zu sequences, %zu failed\n", iters, failct);
+    return failct != 0;
+}
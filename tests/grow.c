@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#define RAS_CTX_VAR ctx
+#include "ras/ras.h"
+#include "ras/ras_a64.h"
+
+// emits templates into a growing block that isn't full yet and checks the
+// code is contiguous. build with RAS_AUTOGROW
+
+void errorCb(rasError err) {
+    fprintf(stderr, "%s\n", rasErrorStrings[err]);
+    abort();
+}
+
+#define NNOPS 600
+
+int main() {
+    rasSetErrorCallback((rasErrorCallback) errorCb, NULL);
+
+    rasBlock* ctx = rasCreate(4096);
+    rasBeginTemplate(ctx);
+    for (int i = 0; i < NNOPS; i++) NOP();
+    rasTemplate* t = rasEndTemplate(ctx);
+
+    MOVW(R0, 1);
+    TEMPLATE(t, NULL, NULL);
+    TEMPLATE(t, NULL, NULL);
+    RET();
+    rasReady(ctx);
+
+    int failct = 0;
+    uint32_t* code = rasGetCode(ctx);
+    size_t count = rasGetSize(ctx) / 4;
+    if (count != 2 * NNOPS + 2) {
+        printf("expected %d instructions, got %zu\n", 2 * NNOPS + 2, count);
+        failct++;
+    }
+    for (size_t i = 1; i + 1 < count; i++) {
+        if (code[i] != 0xd503201f) {
+            printf("%zu: %08x is not a nop\n", i, code[i]);
+            if (++failct > 8) break;
+        }
+    }
+
+    rasDestroyTemplate(t);
+    rasDestroy(ctx);
+    printf("grow: %d failed\n", failct);
+    return failct != 0;
+}
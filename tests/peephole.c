@@ -0,0 +1,258 @@
+#include <stdint.h>
+#include <string.h>
+
+#define RAS_CTX_VAR ctx
+#include "check.h"
+#include "ras/ras_a64.h"
+
+// emits short sequences with the peephole pass enabled and checks the
+// encoded result of each rule, and that nothing is rewritten across
+// patched words, fragments, labels or data
+
+#define NOP_W 0xd503201f
+#define RET_W 0xd65f03c0
+
+static rasBlock* start(uint32_t flags) {
+    rasBlock* ctx = rasCreateNoExec(NULL, 4096, 0x10000);
+    rasEnablePeephole(ctx, flags);
+    return ctx;
+}
+
+// readies ctx, checks its code is exactly the n words in expected and
+// destroys it
+static void expect(rasBlock* ctx, int line, const uint32_t* expected,
+                   size_t n) {
+    rasReady(ctx);
+    const uint32_t* code = rasGetCode(ctx);
+    size_t count = rasGetSize(ctx) / 4;
+    int same = count == n;
+    for (size_t i = 0; same && i < n; i++) same = code[i] == expected[i];
+    if (!same) {
+        printf("%s:%d: got", __FILE__, line);
+        for (size_t i = 0; i < count; i++) printf(" %08x", code[i]);
+        printf(", expected");
+        for (size_t i = 0; i < n; i++) printf(" %08x", expected[i]);
+        printf("\n");
+        failct++;
+    }
+    rasDestroy(ctx);
+}
+
+#define EXPECT(...)                                                            \
+    expect(ctx, __LINE__, (uint32_t[]) {__VA_ARGS__},                          \
+           sizeof((uint32_t[]) {__VA_ARGS__}) / sizeof(uint32_t))
+
+int main() {
+    check_begin();
+    rasBlock* ctx;
+
+    // RAS_PEEPHOLE_MEM
+    ctx = start(RAS_PEEPHOLE_MEM);
+    STRX(R0, (R1, 8));
+    STRX(R2, (R1, 8));
+    rasPeepholeStats stats = rasGetPeepholeStats(ctx);
+    CHECK_EQ(stats.removed, 1);
+    CHECK_EQ(stats.mem, 1);
+    EXPECT(0xf9000422);
+
+    ctx = start(RAS_PEEPHOLE_MEM);
+    STRW(R0, (R1));
+    LDRW(R0, (R1));
+    EXPECT(0xb9000020, 0x2a0003e0);
+
+    ctx = start(RAS_PEEPHOLE_MEM);
+    STRB(R0, (R1));
+    LDRB(R0, (R1));
+    EXPECT(0x39000020, 0x53001c00);
+
+    ctx = start(RAS_PEEPHOLE_MEM);
+    STRH(R0, (R1));
+    LDRH(R0, (R1));
+    EXPECT(0x79000020, 0x53003c00);
+
+    ctx = start(RAS_PEEPHOLE_MEM);
+    STRX(R0, (R1));
+    LDRX(R0, (R1));
+    EXPECT(0xf9000020);
+
+    ctx = start(RAS_PEEPHOLE_MEM);
+    LDRX(R0, (R1));
+    STRX(R0, (R1));
+    EXPECT(0xf9400020);
+
+    ctx = start(RAS_PEEPHOLE_MEM);
+    LDRX(R0, (R1));
+    LDRX(R0, (R1));
+    EXPECT(0xf9400020);
+
+    // the load changes its own base, a different address
+    ctx = start(RAS_PEEPHOLE_MEM);
+    LDRX(R1, (R1));
+    LDRX(R1, (R1));
+    EXPECT(0xf9400021, 0xf9400021);
+
+    ctx = start(RAS_PEEPHOLE_MEM);
+    STRX(R0, (R1));
+    STRX(R2, (R1, 8));
+    EXPECT(0xf9000020, 0xf9000422);
+
+    // RAS_PEEPHOLE_MOV
+    ctx = start(RAS_PEEPHOLE_MOV);
+    MOVX(R0, R1);
+    MOVX(R0, R2);
+    EXPECT(0xaa0203e0);
+
+    ctx = start(RAS_PEEPHOLE_MOV);
+    NOP();
+    MOVX(R0, R0);
+    EXPECT(NOP_W);
+
+    // a 32 bit mov to itself clears the top half
+    ctx = start(RAS_PEEPHOLE_MOV);
+    NOP();
+    MOVW(R0, R0);
+    EXPECT(NOP_W, 0x2a0003e0);
+
+    ctx = start(RAS_PEEPHOLE_MOV);
+    MOVZW(R0, 1);
+    MOVZW(R0, 2);
+    MOVZW(R0, 3);
+    stats = rasGetPeepholeStats(ctx);
+    CHECK_EQ(stats.removed, 2);
+    CHECK_EQ(stats.mov, 2);
+    EXPECT(0x52800060);
+
+    ctx = start(RAS_PEEPHOLE_MOV);
+    MOVX(R0, R1);
+    MOVX(R1, R0);
+    EXPECT(0xaa0103e0);
+
+    ctx = start(RAS_PEEPHOLE_MOV);
+    UXTB(R0, R0);
+    ADDW(R0, R0, 1);
+    UXTB(R0, R0);
+    EXPECT(0x11000400, 0x53001c00);
+
+    ctx = start(RAS_PEEPHOLE_MOV);
+    MOVX(R0, R1);
+    MOVX(R2, R0);
+    EXPECT(0xaa0103e0, 0xaa0003e2);
+
+    // RAS_PEEPHOLE_BRANCH
+    ctx = start(RAS_PEEPHOLE_BRANCH);
+    LABEL(lback);
+    L(lback);
+    NOP();
+    CMPX(R0, 0);
+    BEQ(lback);
+    stats = rasGetPeepholeStats(ctx);
+    CHECK_EQ(stats.branch, 1);
+    EXPECT(NOP_W, 0xb4ffffe0);
+
+    // cbz reaches as far as b.cond, forward branches are folded too
+    ctx = start(RAS_PEEPHOLE_BRANCH);
+    LABEL(lfwd);
+    CMPW(R0, 0);
+    BNE(lfwd);
+    NOP();
+    L(lfwd);
+    EXPECT(0x35000040, NOP_W);
+
+    ctx = start(RAS_PEEPHOLE_BRANCH);
+    LABEL(llt);
+    L(llt);
+    NOP();
+    CMPX(R0, 0);
+    BLT(llt);
+    EXPECT(NOP_W, 0xb7ffffe0);
+
+    ctx = start(RAS_PEEPHOLE_BRANCH);
+    LABEL(ltst);
+    L(ltst);
+    NOP();
+    TSTW(R0, 8);
+    BNE(ltst);
+    EXPECT(NOP_W, 0x371fffe0);
+
+    ctx = start(RAS_PEEPHOLE_BRANCH);
+    LABEL(ltstx);
+    L(ltstx);
+    NOP();
+    TSTX(R5, 1ull << 40);
+    BEQ(ltstx);
+    EXPECT(NOP_W, 0xb647ffe5);
+
+    // tbz to a label that isn't defined yet might not reach
+    ctx = start(RAS_PEEPHOLE_BRANCH);
+    LABEL(lltfwd);
+    CMPX(R0, 0);
+    BLT(lltfwd);
+    L(lltfwd);
+    EXPECT(0xf100001f, 0x5400002b);
+
+    // RAS_PEEPHOLE_ADDR
+    ctx = start(RAS_PEEPHOLE_ADDR);
+    ADDX(R0, R1, 16);
+    LDRX(R0, (R0, 8));
+    stats = rasGetPeepholeStats(ctx);
+    CHECK_EQ(stats.addr, 1);
+    EXPECT(0xf9400c20);
+
+    ctx = start(RAS_PEEPHOLE_ADDR);
+    ADDX(R0, R1, R2, LSL(3));
+    LDRX(R0, (R0));
+    EXPECT(0xf8627820);
+
+    ctx = start(RAS_PEEPHOLE_ADDR);
+    ADDX(R0, R1, R2);
+    LDRW(R0, (R0));
+    EXPECT(0xb8626820);
+
+    // the shift doesn't match the size of the load
+    ctx = start(RAS_PEEPHOLE_ADDR);
+    ADDX(R0, R1, R2, LSL(2));
+    LDRX(R0, (R0));
+    EXPECT(0x8b020820, 0xf9400000);
+
+    // the add of ADRL is a mov until it is patched, and can't be folded
+    // into the load
+    ctx = start(RAS_PEEPHOLE_ALL);
+    LABEL(ldata);
+    ADRL(R0, ldata);
+    LDRX(R0, (R0, 8));
+    RET();
+    L(ldata);
+    DWORD(0);
+    EXPECT(0x90000000, 0x91004000, 0xf9400400, RET_W, 0, 0);
+
+    // nothing is rewritten across fragments, in either direction
+    ctx = start(RAS_PEEPHOLE_ALL);
+    uint32_t frag = rasCreateFragment(ctx, 0);
+    STRX(R0, (R1));
+    rasSwitchFragment(ctx, frag);
+    STRX(R2, (R1));
+    rasSwitchFragment(ctx, 0);
+    STRX(R3, (R1));
+    EXPECT(0xf9000020, 0xf9000023, 0xf9000022);
+
+    // or across labels
+    ctx = start(RAS_PEEPHOLE_ALL);
+    LABEL(lmid);
+    STRX(R0, (R1));
+    L(lmid);
+    STRX(R2, (R1));
+    EXPECT(0xf9000020, 0xf9000022);
+
+    // or data, even when it looks like an instruction
+    ctx = start(RAS_PEEPHOLE_ALL);
+    WORD(0xf9000020);
+    STRX(R2, (R1));
+    EXPECT(0xf9000020, 0xf9000022);
+
+    ctx = start(RAS_PEEPHOLE_ALL);
+    MOVZW(R0, 1);
+    WORD(0x52800040);
+    EXPECT(0x52800020, 0x52800040);
+
+    return check_end("peephole");
+}
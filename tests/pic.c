@@ -0,0 +1,147 @@
+#include <stdint.h>
+#include <string.h>
+
+#define RAS_CTX_VAR ctx
+#include "check.h"
+#include "ras/ras_a64.h"
+
+// checks how a pic block reaches external labels, that references it can't
+// relocate are rejected, and that a copy works after rasWriteGot
+
+#define BASE 0x10000000
+#define EXT_ADDR 0x12345678
+#define MOVED_ADDR 0x87654320
+
+#define LDR_IP1 0x58000011
+#define BR_IP1 0xd61f0220
+#define BLR_IP1 0xd63f0220
+
+static void* resolve(const char* name, void* userdata) {
+    return strcmp(name, "ext_fn") ? NULL : (void*) MOVED_ADDR;
+}
+
+static void* resolve_none(const char* name, void* userdata) {
+    return NULL;
+}
+
+static uint32_t word(rasBlock* ctx, size_t off) {
+    uint32_t w;
+    memcpy(&w, (uint8_t*) rasGetCode(ctx) + off, sizeof w);
+    return w;
+}
+
+static uint64_t read64(const void* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+static int64_t sext(uint64_t v, int bits) {
+    return (int64_t) (v << (64 - bits)) >> (64 - bits);
+}
+
+static size_t b_target(rasBlock* ctx, size_t off) {
+    return off + sext(word(ctx, off) & 0x3ffffff, 26) * 4;
+}
+
+static size_t rel19_target(rasBlock* ctx, size_t off) {
+    return off + sext(word(ctx, off) >> 5 & 0x7ffff, 19) * 4;
+}
+
+// checks off is a veneer loading the address of the external from slot
+static void check_veneer(rasBlock* ctx, size_t off, size_t slot) {
+    CHECK_EQ(word(ctx, off) & 0xff00001f, LDR_IP1);
+    CHECK_EQ(rel19_target(ctx, off), slot);
+    CHECK_EQ(word(ctx, off + 4), BR_IP1);
+}
+
+int main() {
+    check_begin();
+
+    rasBlock* ctx = rasCreateNoExec(NULL, 4096, BASE);
+    rasEnablePIC(ctx);
+    LABEL(lext);
+    LABEL(lloop);
+    LABEL(lstr);
+    rasNameLabel(LEXT(lext, (void*) EXT_ADDR), "ext_fn");
+    L(lloop);
+    B(lext);
+    CBZX(R0, lext);
+    CALL(lext);
+    LDRGOT(R1, lext);
+    ADR(R2, lstr);
+    ADRL(R3, lstr);
+    B(lloop);
+    L(lstr);
+    WORD(0x6f6c6c65);
+    rasReady(ctx);
+
+    // b and cbz share one veneer, call and LDRGOT load from the table
+    size_t veneer = b_target(ctx, 0);
+    CHECK_EQ(rel19_target(ctx, 4), veneer);
+    CHECK_EQ(word(ctx, 8) & 0xff00001f, LDR_IP1);
+    CHECK_EQ(word(ctx, 12), BLR_IP1);
+    size_t slot = rel19_target(ctx, 8);
+    CHECK_EQ(word(ctx, 16) & 0xff00001f, 0x58000001);
+    CHECK_EQ(rel19_target(ctx, 16), slot);
+    check_veneer(ctx, veneer, slot);
+    CHECK_EQ(slot % 8, 0);
+    CHECK(slot + 8 <= rasGetSize(ctx));
+    uint8_t* code = rasGetCode(ctx);
+    CHECK_EQ(read64(code + slot), EXT_ADDR);
+
+    // a copy only needs its table rewritten, the rest is the same bytes
+    size_t size = rasGetSize(ctx);
+    uint8_t* copy = malloc(size);
+    memcpy(copy, code, size);
+    memset(copy + slot, 0, 8);
+    rasWriteGot(ctx, copy, NULL, NULL);
+    CHECK(!memcmp(copy, code, size));
+    rasWriteGot(ctx, copy, resolve, NULL);
+    CHECK_EQ(read64(copy + slot), MOVED_ADDR);
+    CHECK(!memcmp(copy, code, slot));
+    CHECK(!memcmp(copy + slot + 8, code + slot + 8, size - slot - 8));
+    CHECK_ERROR(RAS_ERR_UNDEF_LABEL,
+                rasWriteGot(ctx, copy, resolve_none, NULL));
+    free(copy);
+    rasDestroy(ctx);
+
+    // absolute addresses of the block's own labels
+    ctx = rasCreateNoExec(NULL, 4096, BASE);
+    rasEnablePIC(ctx);
+    LABEL(lself);
+    L(lself);
+    RET();
+    ALIGN(8);
+    DWORD(lself);
+    CHECK_ERROR(RAS_ERR_NOT_PIC, rasReady(ctx));
+    rasDestroy(ctx);
+
+    // a literal load from an external would need the veneer to be data
+    ctx = rasCreateNoExec(NULL, 4096, BASE);
+    rasEnablePIC(ctx);
+    LABEL(lextdata);
+    LEXT(lextdata, (void*) EXT_ADDR);
+    LDRLX(R0, lextdata);
+    RET();
+    CHECK_ERROR(RAS_ERR_NOT_PIC, rasReady(ctx));
+    rasDestroy(ctx);
+
+    // outside pic blocks calls to labels that become external after the
+    // call is emitted go through a veneer
+    ctx = rasCreateNoExec(NULL, 4096, BASE);
+    LABEL(llater);
+    CALL(llater);
+    RET();
+    LEXT(llater, (void*) EXT_ADDR);
+    rasReady(ctx);
+    veneer = b_target(ctx, 0);
+    CHECK_EQ(word(ctx, 0) >> 26, 0x25);
+    CHECK(veneer > 4);
+    check_veneer(ctx, veneer, rel19_target(ctx, veneer));
+    CHECK_EQ(read64((uint8_t*) rasGetCode(ctx) + rel19_target(ctx, veneer)),
+             EXT_ADDR);
+    rasDestroy(ctx);
+
+    return check_end("pic");
+}
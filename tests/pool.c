@@ -0,0 +1,143 @@
+#include <setjmp.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RAS_CTX_VAR ctx
+#include "check.h"
+#include "ras/ras_a64.h"
+
+// gets blocks from a rasBlockPool and checks chunks are reused, and that a
+// page is only executable (not writable) when none of the blocks on it are
+// being written. build with RAS_AUTOGROW
+
+#define BLOCK_SIZE 1000
+// blocks are rounded up to 16 bytes
+#define CHUNK_SIZE 1008
+#define MAX_BLOCKS 64
+
+static sigjmp_buf probeJmp;
+
+static void probe_fault(int sig) {
+    siglongjmp(probeJmp, 1);
+}
+
+// whether a byte can be written, by trying it
+static int writable(void* p) {
+    volatile uint8_t* b = p;
+    if (sigsetjmp(probeJmp, 1)) return 0;
+    *b = *b;
+    return 1;
+}
+
+static rasBlock* get(rasBlockPool* pool) {
+    rasBlock* ctx = rasPoolGet(pool);
+    MOVZW(R0, 1);
+    RET();
+    return ctx;
+}
+
+int main() {
+    check_begin();
+    struct sigaction sa = {0};
+    sa.sa_handler = probe_fault;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, NULL);
+    sigaction(SIGBUS, &sa, NULL);
+
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    rasBlockPool* pool = rasCreateBlockPool(BLOCK_SIZE);
+
+    // blocks share pages, a page is writable while any block on it is
+    rasBlock* a = get(pool);
+    uint8_t* codeA = rasGetCode(a);
+    CHECK(writable(codeA));
+    rasReady(a);
+    CHECK(!writable(codeA));
+    rasBlock* b = get(pool);
+    uint8_t* codeB = rasGetCode(b);
+    CHECK_EQ((uintptr_t) codeA / pagesize, (uintptr_t) codeB / pagesize);
+    CHECK(writable(codeA));
+    rasReady(b);
+    CHECK(!writable(codeA));
+    rasUnready(a);
+    CHECK(writable(codeB));
+    rasReady(a);
+    CHECK(!writable(codeB));
+
+    // a put back block and its chunk are handed out again
+    rasPoolPut(pool, b);
+    rasBlock* again = get(pool);
+    CHECK(again == b);
+    CHECK(rasGetCode(again) == codeB);
+    CHECK(writable(codeA));
+    rasReady(again);
+    CHECK(!writable(codeA));
+
+    // find a chunk that spans two pages
+    rasBlock* blocks[MAX_BLOCKS];
+    size_t n = 0, span = 0;
+    int found = 0;
+    while (!found && n < MAX_BLOCKS) {
+        blocks[n] = get(pool);
+        uintptr_t start = (uintptr_t) rasGetCode(blocks[n]);
+        if (start / pagesize != (start + CHUNK_SIZE - 1) / pagesize) {
+            span = n;
+            found = 1;
+        } else {
+            rasReady(blocks[n]);
+        }
+        n++;
+    }
+    CHECK(found);
+    if (!found) return check_end("pool");
+    uint8_t* spanCode = rasGetCode(blocks[span]);
+    uint8_t* firstPage = (uint8_t*) ((uintptr_t) spanCode & ~(pagesize - 1));
+    uint8_t* secondPage = firstPage + pagesize;
+    CHECK(writable(firstPage) && writable(secondPage));
+
+    // the next block is only on the second page
+    rasBlock* next = get(pool);
+    CHECK((uint8_t*) rasGetCode(next) >= secondPage);
+    rasReady(blocks[span]);
+    CHECK(!writable(firstPage));
+    CHECK(writable(secondPage));
+    rasReady(next);
+    CHECK(!writable(secondPage));
+    rasUnready(blocks[span]);
+    CHECK(writable(firstPage) && writable(secondPage));
+    rasReady(blocks[span]);
+    CHECK(!writable(firstPage) && !writable(secondPage));
+
+    // a block that outgrows its chunk moves to its own pages and gives the
+    // chunk back, leaving the other blocks on the page executable
+    rasBlock* big = rasPoolGet(pool);
+    uint8_t* bigChunk = rasGetCode(big);
+    rasBlock* ctx = big;
+    for (int i = 0; i < 2 * BLOCK_SIZE / 4; i++) NOP();
+    RET();
+    uint8_t* bigCode = rasGetCode(big);
+    CHECK(bigCode != bigChunk);
+    CHECK_EQ((uintptr_t) bigCode % pagesize, 0);
+    CHECK(!writable(codeA));
+    rasReady(big);
+    CHECK(!writable(bigCode));
+    CHECK_EQ(((uint32_t*) bigCode)[2 * BLOCK_SIZE / 4], 0xd65f03c0);
+    rasBlock* reuse = get(pool);
+    CHECK(rasGetCode(reuse) == bigChunk);
+    rasReady(reuse);
+    rasUnready(big);
+    CHECK(writable(bigCode));
+    CHECK(!writable(bigChunk));
+    rasReady(big);
+
+    rasDestroy(big);
+    rasDestroy(reuse);
+    rasDestroy(next);
+    for (size_t i = 0; i < n; i++) rasPoolPut(pool, blocks[i]);
+    rasPoolPut(pool, again);
+    rasPoolPut(pool, a);
+    rasDestroyBlockPool(pool);
+    return check_end("pool");
+}
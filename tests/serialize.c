@@ -0,0 +1,189 @@
+#include <stdint.h>
+#include <string.h>
+
+#define RAS_CTX_VAR ctx
+#include "check.h"
+#include "ras/ras_a64.h"
+
+// round trips a block through rasSerialize and rasDeserialize, checks the
+// references to the code and to external labels are redone for the new
+// address, and checks broken data is rejected
+
+#define HDR_NRELOCS 4
+#define HDR_CODESIZE 8
+#define HDR_NAMESSIZE 16
+#define HDR_SIZE 24
+#define RELOC_SIZE 24
+
+static uint64_t extData;
+
+static void* resolve(const char* name, void* userdata) {
+    return strcmp(name, "ext_data") ? NULL : &extData;
+}
+
+static void* resolve_none(const char* name, void* userdata) {
+    return NULL;
+}
+
+static uint64_t read64(const void* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+static uint32_t read32(const void* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+// deserializes a copy of buf with n bytes at off replaced by val
+static rasBlock* load_modified(const uint8_t* buf, size_t size, size_t off,
+                               const void* val, size_t n) {
+    uint8_t* copy = malloc(size);
+    memcpy(copy, buf, size);
+    memcpy(copy + off, val, n);
+    rasBlock* ctx = rasDeserialize(copy, size, resolve, NULL);
+    free(copy);
+    return ctx;
+}
+
+int main() {
+    check_begin();
+
+    rasBlock* ctx = rasCreateNoExec(NULL, 4096, 0x10000000);
+    LABEL(ldata);
+    LABEL(lslot);
+    LABEL(lext);
+    rasNameLabel(LEXT(lext, (void*) 0x1234), "ext_data");
+    ADRL(R0, ldata);
+    LDRLX(R1, ldata);
+    LDRLX(R2, lslot);
+    RET();
+    ALIGN(8);
+    L(ldata);
+    DWORD(ldata);
+    L(lslot);
+    DWORD(lext);
+    rasReady(ctx);
+
+    uint8_t* orig = rasGetCode(ctx);
+    size_t codeSize = rasGetSize(ctx);
+    size_t dataOff = (uint8_t*) rasGetLabelAddr(ctx, ldata) - orig;
+    size_t slotOff = (uint8_t*) rasGetLabelAddr(ctx, lslot) - orig;
+
+    size_t size = rasSerialize(ctx, NULL, 0);
+    uint8_t* buf = malloc(size);
+    CHECK_EQ(rasSerialize(ctx, buf, size), size);
+    // adrp, add, the internal and the external abs64, not the ldr literals
+    CHECK_EQ(read32(buf + HDR_NRELOCS), 4);
+    CHECK_EQ(read64(buf + HDR_CODESIZE), codeSize);
+
+    rasBlock* d = rasDeserialize(buf, size, resolve, NULL);
+    CHECK(d != NULL);
+    if (d) {
+        rasReady(d);
+        uint8_t* code = rasGetCode(d);
+        uintptr_t base = (uintptr_t) code;
+        CHECK_EQ(rasGetSize(d), codeSize);
+        CHECK_EQ(read64(code + dataOff), base + dataOff);
+        CHECK_EQ(read64(code + slotOff), (uintptr_t) &extData);
+
+        // adrp page and add offset
+        uint32_t adrp = read32(code), add = read32(code + 4);
+        int64_t pages = (int64_t) ((uint64_t) (adrp >> 5 & 0x7ffff) << 45 |
+                                   (uint64_t) (adrp >> 29 & 3) << 43) >>
+                        31;
+        CHECK_EQ((base & ~(uintptr_t) 0xfff) + pages,
+                 (base + dataOff) & ~(uintptr_t) 0xfff);
+        CHECK_EQ(add >> 10 & 0xfff, (base + dataOff) & 0xfff);
+
+        // pc relative loads within the code are copied as they are
+        CHECK_EQ(read32(code + 8), read32(orig + 8));
+        CHECK_EQ(read32(code + 12), read32(orig + 12));
+        rasDestroy(d);
+    }
+
+    // the same through a file
+    CHECK(rasSaveFile(ctx, "bin/serialize.ras"));
+    d = rasLoadFile("bin/serialize.ras", resolve, NULL);
+    CHECK(d != NULL);
+    if (d) {
+        rasReady(d);
+        CHECK_EQ(read64((uint8_t*) rasGetCode(d) + slotOff),
+                 (uintptr_t) &extData);
+        rasDestroy(d);
+    }
+    remove("bin/serialize.ras");
+
+    // broken data
+    CHECK_ERROR(RAS_ERR_UNDEF_LABEL,
+                d = rasDeserialize(buf, size, resolve_none, NULL));
+    CHECK(d == NULL);
+    CHECK_ERROR(RAS_ERR_BAD_FORMAT,
+                d = rasDeserialize(buf, size - 1, resolve, NULL));
+    CHECK(d == NULL);
+    CHECK_ERROR(RAS_ERR_BAD_FORMAT, d = rasDeserialize(buf, 8, resolve, NULL));
+    CHECK(d == NULL);
+
+    uint32_t magic = 0;
+    CHECK_ERROR(RAS_ERR_BAD_FORMAT,
+                d = load_modified(buf, size, 0, &magic, sizeof magic));
+    CHECK(d == NULL);
+    uint64_t hugeSize = ~0ull - 3;
+    CHECK_ERROR(RAS_ERR_BAD_FORMAT, d = load_modified(buf, size, HDR_CODESIZE,
+                                                      &hugeSize, 8));
+    CHECK(d == NULL);
+    uint32_t hugeCount = ~0u;
+    CHECK_ERROR(RAS_ERR_BAD_FORMAT, d = load_modified(buf, size, HDR_NRELOCS,
+                                                      &hugeCount, 4));
+    CHECK(d == NULL);
+    CHECK_ERROR(RAS_ERR_BAD_FORMAT, d = load_modified(buf, size, HDR_NAMESSIZE,
+                                                      &hugeSize, 8));
+    CHECK(d == NULL);
+    char unterminated = 'x';
+    CHECK_ERROR(RAS_ERR_BAD_FORMAT,
+                d = load_modified(buf, size, size - 1, &unterminated, 1));
+    CHECK(d == NULL);
+
+    // the relocations follow the code padded to 8 bytes
+    size_t relocs = HDR_SIZE + ((codeSize + 7) & ~(size_t) 7);
+    size_t ext = relocs;
+    while (!read32(buf + ext + 4)) ext += RELOC_SIZE;
+    uint32_t badType = RAS_PATCH_MAX;
+    CHECK_ERROR(RAS_ERR_BAD_FORMAT,
+                d = load_modified(buf, size, relocs, &badType, 4));
+    CHECK(d == NULL);
+    uint64_t badOffset = codeSize - 4;
+    CHECK_ERROR(RAS_ERR_BAD_FORMAT, d = load_modified(buf, size, ext + 8,
+                                                      &badOffset, 8));
+    CHECK(d == NULL);
+    uint64_t badTarget = 1000;
+    CHECK_ERROR(RAS_ERR_BAD_FORMAT, d = load_modified(buf, size, ext + 16,
+                                                      &badTarget, 8));
+    CHECK(d == NULL);
+    uint32_t tblType = RAS_PATCH_TBL32;
+    CHECK_ERROR(RAS_ERR_BAD_FORMAT,
+                d = load_modified(buf, size, ext, &tblType, 4));
+    CHECK(d == NULL);
+    free(buf);
+    rasDestroy(ctx);
+
+    // blocks that can't be serialized
+    ctx = rasCreateNoExec(NULL, 4096, 0);
+    LABEL(lunnamed, (void*) 0x1234);
+    DWORD(lunnamed);
+    CHECK_ERROR(RAS_ERR_UNNAMED_LABEL, rasSerialize(ctx, NULL, 0));
+    rasDestroy(ctx);
+
+    ctx = rasCreateNoExec(NULL, 4096, 0);
+    LABEL(ltable);
+    LABEL(lexttbl);
+    rasNameLabel(LEXT(lexttbl, (void*) 0x1234), "ext_data");
+    L(ltable);
+    TABLE32(ltable, lexttbl);
+    CHECK_ERROR(RAS_ERR_BAD_LABEL, rasSerialize(ctx, NULL, 0));
+    rasDestroy(ctx);
+
+    return check_end("serialize");
+}
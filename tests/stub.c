@@ -0,0 +1,146 @@
+#include <stdint.h>
+#include <string.h>
+
+#define RAS_CTX_VAR ctx
+#include "check.h"
+#include "ras/ras_a64.h"
+
+// interns stubs into a stub cache and checks which ones are shared, that
+// the copies are patched for where they are placed, and that lookups still
+// work after the table grows
+
+#define NMANY 100
+
+static uint64_t read64(const void* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+static int64_t sext(uint64_t v, int bits) {
+    return (int64_t) (v << (64 - bits)) >> (64 - bits);
+}
+
+// an adr to the stub's own data and the data's absolute address
+static rasBlock* data_stub(uintptr_t vbase, uint32_t val) {
+    rasBlock* ctx = rasCreateNoExec(NULL, 256, vbase);
+    LABEL(ldata);
+    ADR(R0, ldata);
+    MOVZW(R1, val);
+    RET();
+    ALIGN(8);
+    L(ldata);
+    DWORD(ldata);
+    return ctx;
+}
+
+static rasBlock* ext_stub(void* addr) {
+    rasBlock* ctx = rasCreateNoExec(NULL, 256, 0);
+    LABEL(lext, addr);
+    NOP();
+    RET();
+    DWORD(lext);
+    return ctx;
+}
+
+static rasBlock* movz_stub(uint32_t val) {
+    rasBlock* ctx = rasCreateNoExec(NULL, 256, 0);
+    MOVZW(R0, val);
+    RET();
+    return ctx;
+}
+
+static void* intern(rasStubCache* cache, rasBlock* stub) {
+    void* addr = rasInternStub(cache, stub);
+    rasDestroy(stub);
+    return addr;
+}
+
+int main() {
+    check_begin();
+    rasStubCache* cache = rasCreateStubCache(16384);
+
+    // something first so the next stubs aren't at the start of the cache
+    uint8_t* first = intern(cache, movz_stub(1234));
+    CHECK(first != NULL);
+
+    // the same stub at different addresses before interning is one stub,
+    // patched for where it is in the cache
+    rasBlock* stub = data_stub(0x10000, 7);
+    rasReady(stub);
+    uint8_t* a = intern(cache, stub);
+    stub = data_stub(0x7f0000, 7);
+    rasReady(stub);
+    uint8_t* b = intern(cache, stub);
+    CHECK(a != NULL && a != first);
+    CHECK(a == b);
+    uint32_t adr;
+    memcpy(&adr, a, sizeof adr);
+    int64_t rel = sext((adr >> 5 & 0x7ffff) << 2 | (adr >> 29 & 3), 21);
+    CHECK_EQ(rel, 16);
+    CHECK_EQ(read64(a + 16), (uintptr_t) a + 16);
+    rasStubCacheStats stats = rasGetStubCacheStats(cache);
+    CHECK_EQ(stats.lookups, 3);
+    CHECK_EQ(stats.hits, 1);
+    CHECK_EQ(stats.bytesSaved, 24);
+
+    // a different operand is a different stub
+    uint8_t* c = intern(cache, data_stub(0, 8));
+    CHECK(c != NULL && c != a);
+    CHECK_EQ(read64(c + 16), (uintptr_t) c + 16);
+
+    // externals that only differ in address have the same code before
+    // patching but are different stubs
+    uint8_t* e1 = intern(cache, ext_stub((void*) 0x1000));
+    uint8_t* e2 = intern(cache, ext_stub((void*) 0x2000));
+    CHECK(e1 != NULL && e2 != NULL && e1 != e2);
+    CHECK_EQ(read64(e1 + 8), 0x1000);
+    CHECK_EQ(read64(e2 + 8), 0x2000);
+    CHECK(intern(cache, ext_stub((void*) 0x1000)) == e1);
+
+    // a stub that asks for more alignment than the copy it matches has gets
+    // its own copy
+    stub = movz_stub(1234);
+    rasAlign(stub, 64);
+    uint8_t* aligned = intern(cache, stub);
+    CHECK(aligned != NULL && aligned != first);
+    CHECK_EQ((uintptr_t) aligned % 64, 0);
+    CHECK_EQ((uintptr_t) first % 16, 0);
+    CHECK(!memcmp(aligned, first, 8));
+    stub = movz_stub(1234);
+    rasAlign(stub, 64);
+    CHECK(intern(cache, stub) == aligned);
+
+    // enough stubs to grow the table, all of them still found afterwards
+    uint8_t* many[NMANY];
+    for (int i = 0; i < NMANY; i++) {
+        many[i] = intern(cache, movz_stub(i));
+        CHECK(many[i] != NULL);
+    }
+    stats = rasGetStubCacheStats(cache);
+    size_t hits = stats.hits;
+    for (int i = 0; i < NMANY; i++) {
+        CHECK(intern(cache, movz_stub(i)) == many[i]);
+    }
+    CHECK_EQ(rasGetStubCacheStats(cache).hits, hits + NMANY);
+    CHECK(intern(cache, movz_stub(1234)) == first);
+
+    // stubs using labels that aren't defined
+    stub = rasCreateNoExec(NULL, 256, 0);
+    rasBlock* ctx = stub;
+    LABEL(lundef);
+    B(lundef);
+    CHECK_ERROR(RAS_ERR_UNDEF_LABEL, a = rasInternStub(cache, stub));
+    CHECK(a == NULL);
+    rasDestroy(stub);
+    rasDestroyStubCache(cache);
+
+    // a full cache returns NULL
+    cache = rasCreateStubCache(4096);
+    size_t n = 0;
+    while (n < 1000 && intern(cache, movz_stub(n))) n++;
+    CHECK_EQ(n, 4096 / 16);
+    rasDestroyStubCache(cache);
+
+    return check_end("stub");
+}
@@ -0,0 +1,156 @@
+#include <stdint.h>
+#include <string.h>
+
+#define RAS_CTX_VAR ctx
+#include "check.h"
+#include "ras/ras_a64.h"
+
+// gives rasVerifyA64 blocks with one kind of problem each and checks it
+// finds exactly those, and nothing in blocks without problems
+
+#define BASE 0x10000
+
+static rasBlock* start(void) {
+    return rasCreateNoExec(NULL, 4096, BASE);
+}
+
+// checks ctx has count problems, all of them for why, and destroys it
+static void expect(rasBlock* ctx, int line, size_t count, const char* why) {
+    rasReady(ctx);
+    FILE* f = tmpfile();
+    size_t problems = rasVerifyA64(ctx, f);
+    if (problems != count) {
+        printf("%s:%d: %zu problems, expected %zu\n", __FILE__, line, problems,
+               count);
+        failct++;
+    }
+    rewind(f);
+    char buf[256];
+    size_t lines = 0;
+    while (fgets(buf, sizeof buf, f)) {
+        lines++;
+        if (!why || !strstr(buf, why)) {
+            printf("%s:%d: unexpected problem %s", __FILE__, line, buf);
+            failct++;
+        }
+    }
+    if (lines != problems) {
+        printf("%s:%d: %zu lines for %zu problems\n", __FILE__, line, lines,
+               problems);
+        failct++;
+    }
+    fclose(f);
+    CHECK_EQ(rasVerifyA64(ctx, NULL), problems);
+    rasDestroy(ctx);
+}
+
+#define EXPECT(count, why) expect(ctx, __LINE__, count, why)
+
+int main() {
+    check_begin();
+    rasBlock* ctx;
+
+    // code with branches, a table, data and a named entry point
+    ctx = start();
+    LABEL(lloop);
+    LABEL(ltable);
+    LABEL(lcase);
+    LABEL(lentry);
+    LABEL(ldata);
+    LABEL(lext, (void*) 0x123450);
+    rasNameLabel(lentry, "entry");
+    PUSH(R29, R30);
+    SUBX(SP, SP, 32);
+    L(lloop);
+    SUBSW(R0, R0, 1);
+    BNE(lloop);
+    ADR(R1, ltable);
+    LDRLX(R2, ldata);
+    BL(lext);
+    ADDX(SP, SP, 32);
+    POP(R29, R30);
+    RET();
+    L(lcase);
+    B(lext);
+    L(lentry);
+    CBZX(R0, lcase);
+    RET();
+    L(ltable);
+    TABLE32(ltable, lcase);
+    ALIGN(8);
+    L(ldata);
+    DWORD(0xffffffffffffffff);
+    EXPECT(0, NULL);
+
+    // words that don't decode to anything ras emits, the code isn't
+    // followed past them
+    ctx = start();
+    WORD(0);
+    WORD(0xffffffff);
+    EXPECT(1, "not an instruction");
+
+    // data after the return isn't checked
+    ctx = start();
+    RET();
+    WORD(0);
+    EXPECT(0, NULL);
+
+    // b.eq -0x400, cbz +0x400 and b +0x400 with nothing there
+    ctx = start();
+    WORD(0x54ffe000);
+    WORD(0xb4002000);
+    WORD(0x14000100);
+    EXPECT(3, "branch target outside");
+
+    // ldr literal +0x80 and adr -0x80
+    ctx = start();
+    WORD(0x58000400);
+    WORD(0x10fffc00);
+    RET();
+    EXPECT(2, "address outside");
+
+    ctx = start();
+    MOVZW(R0, 1);
+    EXPECT(1, "falls through the end");
+
+    // a conditional branch at the end falls through when not taken
+    ctx = start();
+    LABEL(lstart);
+    L(lstart);
+    CBZX(R0, lstart);
+    EXPECT(1, "falls through the end");
+
+    // SP moved by add/sub immediates
+    ctx = start();
+    SUBX(SP, SP, 8);
+    ADDX(SP, SP, 0x18);
+    ADDX(SP, SP, 1, LSL(12));
+    SUBX(R0, SP, 8);
+    RET();
+    EXPECT(2, "misaligned SP");
+
+    // pre and post index single registers
+    ctx = start();
+    STRX(R0, (SP, -8, PRE));
+    LDRX(R0, (SP, 8, POST));
+    STRW(R0, (SP, -16, PRE));
+    LDRB(R0, (SP, 1, POST));
+    STRX(R0, (SP, 8));
+    STRX(R0, (R1, -8, PRE));
+    RET();
+    EXPECT(3, "misaligned SP");
+
+    // pre and post index pairs, the offset is scaled by the register size
+    ctx = start();
+    STPW(R0, R1, (SP, -8, PRE));
+    LDPX(R0, R1, (SP, 24, POST));
+    STPX(R0, R1, (SP, -16, PRE));
+    LDPW(R0, R1, (SP, 16, POST));
+    STPD(V0, V1, (SP, -8, PRE));
+    STPQ(V0, V1, (SP, -32, PRE));
+    LDPX(R0, R1, (SP, 8));
+    RET();
+    EXPECT(3, "misaligned SP");
+
+    return check_end("verify");
+}